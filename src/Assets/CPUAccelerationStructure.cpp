@@ -5,18 +5,31 @@
 #include <chrono>
 #include <fstream>
 #include <xxhash.h>
+#include <bit>
+#include <cassert>
+#include <filesystem>
+#include <numeric>
+#include <span>
+#include <thread>
 
 #define TINYBVH_IMPLEMENTATION
 #include "TextureImage.hpp"
 #include "Runtime/Engine.hpp"
 #include "ThirdParty/tinybvh/tiny_bvh.h"
+#include "Utilities/FileHelper.hpp"
 #include "Utilities/Math.hpp"
 
-static tinybvh::BVH GCpuBvh;
-static std::vector<tinybvh::BLASInstance>* GbvhInstanceList;
-static std::vector<FCPUTLASInstanceInfo>* GbvhTLASContexts;
 static std::vector<FCPUBLASContext>* GbvhBLASContexts;
 
+// a full build when more instances than this moved at once, or after this many refits
+static constexpr uint32_t TLAS_REFIT_DIRTY_RATIO = 4;
+static constexpr uint32_t TLAS_MAX_REFIT_COUNT = 32;
+
+// 16 x 16 columns of cubes are baked as one group
+static constexpr int BAKE_GROUP_SIZE = 16;
+// moved instances dirty the cubes around them as well, their distance to solid changes
+static constexpr float DIRTY_REGION_MARGIN = CUBE_UNIT * 4;
+
 Assets::SphericalHarmonics HDRSHs[100];
 
 using namespace Assets;
@@ -35,126 +48,365 @@ FMaterial& FetchMaterial(uint matId)
     return materials[matId];
 }
 
-uint FetchMaterialId(uint MaterialIdx, uint InstanceId)
+uint FetchMaterialId(const FCPUTLASSnapshot& snapshot, uint MaterialIdx, uint InstanceId)
 {
-    return (*GbvhTLASContexts)[InstanceId].matIdxs[MaterialIdx];
+    return snapshot.infos[InstanceId].matIdxs[MaterialIdx];
 }
 
-bool TraceRay(vec3 origin, vec3 rayDir, float Dist, vec3& OutNormal, uint& OutMaterialId, float& OutRayDist, uint& OutInstanceId )
+// rays traced together, one bit each in the active mask
+static constexpr uint32_t RAY_PACKET_SIZE = 64;
+
+// ray data the packet slab test needs, in SoA order so the per-node loop vectorizes
+struct FRayPacket
 {
-    tinybvh::Ray ray(tinybvh::bvhvec3(origin.x, origin.y, origin.z), tinybvh::bvhvec3(rayDir.x, rayDir.y, rayDir.z), Dist);
-    GCpuBvh.Intersect(ray);
+    alignas(64) float ox[RAY_PACKET_SIZE];
+    alignas(64) float oy[RAY_PACKET_SIZE];
+    alignas(64) float oz[RAY_PACKET_SIZE];
+    alignas(64) float rdx[RAY_PACKET_SIZE];
+    alignas(64) float rdy[RAY_PACKET_SIZE];
+    alignas(64) float rdz[RAY_PACKET_SIZE];
+    alignas(64) float tfar[RAY_PACKET_SIZE];
+    uint32_t count;
+};
+
+static uint64_t PacketSlabTest(const tinybvh::BVH::BVHNode& node, const FRayPacket& packet, uint64_t mask, float& outNearest)
+{
+    uint64_t hits = 0;
+    float nearest = BVH_FAR;
+    for (uint32_t i = 0; i < packet.count; ++i)
+    {
+        const float tx1 = (node.aabbMin.x - packet.ox[i]) * packet.rdx[i], tx2 = (node.aabbMax.x - packet.ox[i]) * packet.rdx[i];
+        const float ty1 = (node.aabbMin.y - packet.oy[i]) * packet.rdy[i], ty2 = (node.aabbMax.y - packet.oy[i]) * packet.rdy[i];
+        const float tz1 = (node.aabbMin.z - packet.oz[i]) * packet.rdz[i], tz2 = (node.aabbMax.z - packet.oz[i]) * packet.rdz[i];
+        const float tmin = std::max(std::max(std::min(tx1, tx2), std::min(ty1, ty2)), std::min(tz1, tz2));
+        const float tmax = std::min(std::min(std::max(tx1, tx2), std::max(ty1, ty2)), std::max(tz1, tz2));
+        const bool hit = tmax >= tmin && tmin < packet.tfar[i] && tmax >= 0.0f && ((mask >> i) & 1);
+        hits |= uint64_t(hit) << i;
+        nearest = hit ? std::min(nearest, tmin) : nearest;
+    }
+    outNearest = nearest;
+    return hits;
+}
 
-    if (ray.hit.t < Dist)
+static void IntersectBLAS(const tinybvh::BVHBase* blas, tinybvh::Ray& ray)
+{
+#if CPU_BVH_USE_SOA
+    if (blas->layout == tinybvh::BVHBase::LAYOUT_BVH_SOA)
     {
-        uint32_t primIdx = ray.hit.prim;
-        tinybvh::BLASInstance& instance = (*GbvhInstanceList)[ray.hit.inst];
-        FCPUTLASInstanceInfo& instContext = (*GbvhTLASContexts)[ray.hit.inst];
-        FCPUBLASContext& context = (*GbvhBLASContexts)[instance.blasIdx];
-        mat4* worldTS = (mat4*)instance.transform;
-        vec4 normalWS = vec4( context.extinfos[primIdx].normal, 0.0f) * *worldTS;
+        static_cast<const tinybvh::BVH_SoA*>(blas)->Intersect(ray);
+        return;
+    }
+#endif
+    static_cast<const tinybvh::BVH*>(blas)->Intersect(ray);
+}
 
-        OutRayDist = ray.hit.t;
-        OutNormal = vec3(normalWS.x, normalWS.y, normalWS.z);
-        OutMaterialId =  FetchMaterialId( context.extinfos[primIdx].matIdx, ray.hit.inst );
-        OutInstanceId = instContext.nodeId;
-        return true;
+// per ray filtering of gameplay queries, the bake traces everything without one
+struct FPacketFilter
+{
+    const FCPUTLASInstanceInfo* infos = nullptr;
+    // one per ray, tested against the instance ray mask
+    const uint32_t* rayMasks = nullptr;
+    // rays are done with their first hit
+    bool anyHit = false;
+};
+
+// TLAS packet traversal: the top level is walked once per packet with a mask of the rays still
+// inside the node, rays reaching a leaf continue into the BLAS with the simd single ray kernel.
+static void IntersectPacket(const tinybvh::BVH& tlas, tinybvh::Ray* rays, uint32_t count, const FPacketFilter* filter = nullptr)
+{
+    FRayPacket packet;
+    packet.count = count;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        packet.ox[i] = rays[i].O.x;
+        packet.oy[i] = rays[i].O.y;
+        packet.oz[i] = rays[i].O.z;
+        packet.rdx[i] = rays[i].rD.x;
+        packet.rdy[i] = rays[i].rD.y;
+        packet.rdz[i] = rays[i].rD.z;
+        packet.tfar[i] = rays[i].hit.t;
+    }
+
+    struct FStackEntry
+    {
+        uint32_t node;
+        uint64_t mask;
+    } stack[64];
+    uint32_t stackPtr = 0;
+
+    // any hit rays that already hit something, they are dropped from the masks on the stack as well
+    uint64_t done = 0;
+    float nearest;
+    uint32_t nodeIdx = 0;
+    uint64_t mask = PacketSlabTest(tlas.bvhNode[0], packet, count == RAY_PACKET_SIZE ? ~0ull : (1ull << count) - 1, nearest);
+    auto pop = [&]()
+    {
+        while (stackPtr > 0)
+        {
+            --stackPtr;
+            nodeIdx = stack[stackPtr].node;
+            mask = stack[stackPtr].mask & ~done;
+            if (mask) return true;
+        }
+        return false;
+    };
+    while (mask)
+    {
+        const tinybvh::BVH::BVHNode& node = tlas.bvhNode[nodeIdx];
+        if (node.isLeaf())
+        {
+            for (uint32_t j = 0; j < node.triCount; ++j)
+            {
+                const uint32_t instIdx = tlas.primIdx[node.leftFirst + j];
+                const tinybvh::BLASInstance& inst = tlas.instList[instIdx];
+                const tinybvh::BVHBase* blas = tlas.blasList[inst.blasIdx];
+                for (uint64_t m = mask & ~done; m; m &= m - 1)
+                {
+                    const uint32_t i = std::countr_zero(m);
+                    if (filter && filter->rayMasks && (filter->infos[instIdx].rayMask & filter->rayMasks[i]) == 0)
+                    {
+                        continue;
+                    }
+                    tinybvh::Ray& ray = rays[i];
+                    tinybvh::Ray tmp;
+                    tmp.O = tinybvh::tinybvh_transform_point(ray.O, inst.invTransform);
+                    tmp.D = tinybvh::tinybvh_transform_vector(ray.D, inst.invTransform);
+                    tmp.rD = tinybvh::tinybvh_safercp(tmp.D);
+                    tmp.instIdx = instIdx << (32 - INST_IDX_BITS);
+                    tmp.hit = ray.hit;
+                    IntersectBLAS(blas, tmp);
+                    if (tmp.hit.t < ray.hit.t)
+                    {
+#if INST_IDX_BITS == 32
+                        // not every blas kernel writes it, the neon soa one only sets prim
+                        tmp.hit.inst = instIdx;
+#endif
+                        if (filter && filter->anyHit)
+                        {
+                            done |= 1ull << i;
+                        }
+                    }
+                    ray.hit = tmp.hit;
+                    packet.tfar[i] = ray.hit.t;
+                }
+            }
+            if (!pop()) break;
+            continue;
+        }
+
+        float nearest1, nearest2;
+        uint32_t child1 = node.leftFirst, child2 = node.leftFirst + 1;
+        uint64_t mask1 = PacketSlabTest(tlas.bvhNode[child1], packet, mask, nearest1);
+        uint64_t mask2 = PacketSlabTest(tlas.bvhNode[child2], packet, mask, nearest2);
+        if (mask1 && mask2)
+        {
+            // continue with the nearest, push the far one
+            if (nearest1 > nearest2)
+            {
+                std::swap(child1, child2);
+                std::swap(mask1, mask2);
+            }
+            stack[stackPtr++] = { child2, mask2 };
+            nodeIdx = child1;
+            mask = mask1;
+        }
+        else if (mask1 || mask2)
+        {
+            nodeIdx = mask1 ? child1 : child2;
+            mask = mask1 ? mask1 : mask2;
+        }
+        else
+        {
+            if (!pop()) break;
+        }
     }
-    
-    return false;
 }
 
-#define float2 vec2
-#define float3 vec3
-#define float4 vec4
+// coherent rays, like the same direction from neighbor origins, get the most out of this
+void TraceRays(const FCPUTLASSnapshot& snapshot, std::span<tinybvh::Ray> rays)
+{
+    if (snapshot.instances.empty())
+    {
+        return;
+    }
+    for (size_t i = 0; i < rays.size(); i += RAY_PACKET_SIZE)
+    {
+        IntersectPacket(snapshot.tlas, rays.data() + i, uint32_t(std::min<size_t>(RAY_PACKET_SIZE, rays.size() - i)));
+    }
+}
 
-float DetectDistance( float3 origin, float3 rayDir)
+// same as BVH::Refit, but the leaves bound instances instead of triangles
+static void RefitTLAS(tinybvh::BVH& tlas)
 {
-    vec3 OutNormal;
-    float OutRayDist;
-    uint TempMaterialId;
-    uint TempInstanceId;
-    if( TraceRay(origin, rayDir, CUBE_UNIT * 64, OutNormal, TempMaterialId, OutRayDist, TempInstanceId))
+    for (int32_t i = int32_t(tlas.usedNodes) - 1; i >= 0; i--)
     {
-        return OutRayDist;
+        // node 1 is left unused for alignment
+        if (i == 1) continue;
+
+        tinybvh::BVH::BVHNode& node = tlas.bvhNode[i];
+        if (node.isLeaf())
+        {
+            node.aabbMin = tinybvh::bvhvec3( BVH_FAR ), node.aabbMax = tinybvh::bvhvec3( -BVH_FAR );
+            for (uint32_t j = 0; j < node.triCount; j++)
+            {
+                const tinybvh::BLASInstance& inst = tlas.instList[tlas.primIdx[node.leftFirst + j]];
+                node.aabbMin = tinybvh::tinybvh_min( node.aabbMin, inst.aabbMin );
+                node.aabbMax = tinybvh::tinybvh_max( node.aabbMax, inst.aabbMax );
+            }
+            continue;
+        }
+        const tinybvh::BVH::BVHNode& left = tlas.bvhNode[node.leftFirst], & right = tlas.bvhNode[node.leftFirst + 1];
+        node.aabbMin = tinybvh::tinybvh_min( left.aabbMin, right.aabbMin );
+        node.aabbMax = tinybvh::tinybvh_max( left.aabbMax, right.aabbMax );
     }
-    return 255;
+    tlas.aabbMin = tlas.bvhNode[0].aabbMin, tlas.aabbMax = tlas.bvhNode[0].aabbMax;
 }
 
-bool InsideGeometry( float3& origin, float3 rayDir, VoxelData& OutCube, float& distance)
+// pins the front snapshot for the lifetime of a task
+class FSnapshotScope
 {
-    // 求交测试
-    vec3 OutNormal;
-    float OutRayDist;
-    uint TempMaterialId;
-    uint TempInstanceId;
+public:
+    explicit FSnapshotScope(const FCPUAccelerationStructure& cpuAS) : cpuAS_(cpuAS), snapshot_(cpuAS.AcquireSnapshot()) {}
+    ~FSnapshotScope() { cpuAS_.ReleaseSnapshot(snapshot_); }
+
+    const FCPUTLASSnapshot& Get() const { return snapshot_; }
+
+private:
+    const FCPUAccelerationStructure& cpuAS_;
+    const FCPUTLASSnapshot& snapshot_;
+};
+
+void ResolveHit(const FCPUTLASSnapshot& snapshot, const tinybvh::Ray& ray, vec3& OutNormal, uint& OutMaterialId, uint& OutInstanceId)
+{
+    uint32_t primIdx = ray.hit.prim;
+    const tinybvh::BLASInstance& instance = snapshot.instances[ray.hit.inst];
+    const FCPUTLASInstanceInfo& instContext = snapshot.infos[ray.hit.inst];
+    FCPUBLASContext& context = (*GbvhBLASContexts)[instance.blasIdx];
+    const mat4* worldTS = (const mat4*)instance.transform;
+    vec4 normalWS = vec4( context.extinfos[primIdx].normal, 0.0f) * *worldTS;
+
+    OutNormal = vec3(normalWS.x, normalWS.y, normalWS.z);
+    OutMaterialId =  FetchMaterialId( snapshot, context.extinfos[primIdx].matIdx, ray.hit.inst );
+    OutInstanceId = instContext.nodeId;
+}
+
+#define float2 vec2
+#define float3 vec3
+#define float4 vec4
 
-    if (TraceRay(origin, rayDir, CUBE_UNIT * 64, OutNormal, TempMaterialId, OutRayDist, TempInstanceId))
+void InsideGeometry( const FCPUTLASSnapshot& snapshot, const tinybvh::Ray& ray, float Dist, VoxelData& OutCube, float& distance)
+{
+    // 求交测试
+    if (ray.hit.t < Dist)
     {
-        distance = OutRayDist;
+        vec3 OutNormal;
+        uint TempMaterialId;
+        uint TempInstanceId;
+        ResolveHit(snapshot, ray, OutNormal, TempMaterialId, TempInstanceId);
+
+        distance = ray.hit.t;
         if( distance <= CUBE_UNIT)
         {
             FMaterial hitMaterial = FetchMaterial(TempMaterialId);
             OutCube.matId = TempMaterialId;
 
             // 命中反面，识别为固体，并将lightprobe推出体外
-            if (dot(OutNormal, rayDir) > 0.0 || ((hitMaterial.gpuMaterial_.MaterialModel == Material::Enum::DiffuseLight) && OutRayDist < 0.02f))
+            float3 rayDir = float3(ray.D.x, ray.D.y, ray.D.z);
+            if (dot(OutNormal, rayDir) > 0.0 || ((hitMaterial.gpuMaterial_.MaterialModel == Material::Enum::DiffuseLight) && ray.hit.t < 0.02f))
             {
                 distance = 0;
-                return true;
             }
         }
     }
-    return false;
 }
 
-void VoxelizeCube(VoxelData& Cube, float3 origin)
+// voxelize up to RAY_PACKET_SIZE cubes, the rays of one direction are traced together as a packet
+void VoxelizeCubes(const FCPUTLASSnapshot& snapshot, std::span<VoxelData*> cubes, std::span<const float3> origins)
 {
-    // just write matid and solid status
-    Cube.age = 0;
-    Cube.matId = 0;
-
-    float distPY = 255.0f;
-    float distNY = 255.0f;
-    float distPX = 255.0f;
-    float distNX = 255.0f;
-    float distPZ = 255.0f;
-    float distNZ = 255.0f;
+    const uint32_t count = uint32_t(cubes.size());
+    const float traceDist = CUBE_UNIT * 64;
 
     // 现在是向轴向上发射了6根光线，记录下距离，并用于后续采样判断
-    InsideGeometry(origin, float3(0, 1, 0), Cube, distPY);
-    InsideGeometry(origin, float3(0, -1, 0), Cube, distNY);
-    InsideGeometry(origin, float3(1, 0, 0), Cube, distPX);
-    InsideGeometry(origin, float3(-1, 0, 0), Cube, distNX);
-    InsideGeometry(origin, float3(0, 0, 1), Cube, distPZ);
-    InsideGeometry(origin, float3(0, 0, -1), Cube, distNZ);
+    // order matters, the last hit within a unit decides the matId
+    static const float3 axisDirs[6] = { float3(0, 1, 0), float3(0, -1, 0), float3(1, 0, 0), float3(-1, 0, 0), float3(0, 0, 1), float3(0, 0, -1) };
+    static const float3 diagonalDirs[6] = { float3(1, 1, 1), float3(-1, 1, 1), float3(-1, -1, 1), float3(1, 1, -1), float3(-1, 1, -1), float3(-1, -1, -1) };
+
+    tinybvh::Ray rays[RAY_PACKET_SIZE];
+    float dists[6][RAY_PACKET_SIZE];
+    float minDists[RAY_PACKET_SIZE];
 
-    // get the min dist of each direction
-    float minDist = std::min({distPY, distNY, distPX, distNX, distPZ, distNZ});
-    if( minDist > 254.0f )
+    for (uint32_t i = 0; i < count; ++i)
     {
-        minDist = std::min( { minDist, DetectDistance(origin, float3(1, 1, 1))});
-        minDist = std::min( { minDist, DetectDistance(origin, float3(-1, 1, 1))});
-        minDist = std::min( { minDist, DetectDistance(origin, float3(-1, -1, 1))});
-        minDist = std::min( { minDist, DetectDistance(origin, float3(-1, 1, 1))});
-        minDist = std::min( { minDist, DetectDistance(origin, float3(1, 1, -1))});
-        minDist = std::min( { minDist, DetectDistance(origin, float3(-1, 1, -1))});
-        minDist = std::min( { minDist, DetectDistance(origin, float3(-1, -1, -1))});
-        minDist = std::min( { minDist, DetectDistance(origin, float3(-1, 1, -1))});
+        // just write matid and solid status
+        cubes[i]->age = 0;
+        cubes[i]->matId = 0;
     }
 
-    // 现在，相当于每一个体素，都有了一个距离场，通过判断这个，可以快速跳过？
-    distPY = glm::fclamp(distPY / CUBE_UNIT, 0.0f, 1.0f);
-    distNY = glm::fclamp(distNY / CUBE_UNIT, 0.0f, 1.0f);
-    distPX = glm::fclamp(distPX / CUBE_UNIT, 0.0f, 1.0f);
-    distNX = glm::fclamp(distNX / CUBE_UNIT, 0.0f, 1.0f);
-    distPZ = glm::fclamp(distPZ / CUBE_UNIT, 0.0f, 1.0f);
-    distNZ = glm::fclamp(distNZ / CUBE_UNIT, 0.0f, 1.0f);
+    for (uint32_t d = 0; d < 6; ++d)
+    {
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            rays[i] = tinybvh::Ray(tinybvh::bvhvec3(origins[i].x, origins[i].y, origins[i].z), tinybvh::bvhvec3(axisDirs[d].x, axisDirs[d].y, axisDirs[d].z), traceDist);
+        }
+        TraceRays(snapshot, std::span(rays, count));
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            dists[d][i] = 255.0f;
+            InsideGeometry(snapshot, rays[i], traceDist, *cubes[i], dists[d][i]);
+        }
+    }
+
+    // get the min dist of each direction, cubes far from everything probe the diagonals as well
+    uint32_t farCubes[RAY_PACKET_SIZE];
+    uint32_t farCount = 0;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        minDists[i] = std::min({dists[0][i], dists[1][i], dists[2][i], dists[3][i], dists[4][i], dists[5][i]});
+        if( minDists[i] > 254.0f )
+        {
+            farCubes[farCount++] = i;
+        }
+    }
+
+    for (uint32_t d = 0; d < 6 && farCount > 0; ++d)
+    {
+        for (uint32_t f = 0; f < farCount; ++f)
+        {
+            const float3& origin = origins[farCubes[f]];
+            rays[f] = tinybvh::Ray(tinybvh::bvhvec3(origin.x, origin.y, origin.z), tinybvh::bvhvec3(diagonalDirs[d].x, diagonalDirs[d].y, diagonalDirs[d].z), traceDist);
+        }
+        TraceRays(snapshot, std::span(rays, farCount));
+        for (uint32_t f = 0; f < farCount; ++f)
+        {
+            if (rays[f].hit.t < traceDist)
+            {
+                minDists[farCubes[f]] = std::min(minDists[farCubes[f]], rays[f].hit.t);
+            }
+        }
+    }
 
-    float inside = distPY * distNY * distPX * distNX * distPZ * distNZ;
+    for (uint32_t i = 0; i < count; ++i)
+    {
+        // 现在，相当于每一个体素，都有了一个距离场，通过判断这个，可以快速跳过？
+        float distPY = glm::fclamp(dists[0][i] / CUBE_UNIT, 0.0f, 1.0f);
+        float distNY = glm::fclamp(dists[1][i] / CUBE_UNIT, 0.0f, 1.0f);
+        float distPX = glm::fclamp(dists[2][i] / CUBE_UNIT, 0.0f, 1.0f);
+        float distNX = glm::fclamp(dists[3][i] / CUBE_UNIT, 0.0f, 1.0f);
+        float distPZ = glm::fclamp(dists[4][i] / CUBE_UNIT, 0.0f, 1.0f);
+        float distNZ = glm::fclamp(dists[5][i] / CUBE_UNIT, 0.0f, 1.0f);
+
+        float inside = distPY * distNY * distPX * distNX * distPZ * distNZ;
+
+        VoxelData& Cube = *cubes[i];
+        Cube.distanceToSolid_gg_z01 = pack_bytes(glm::u32vec4(minDists[i] / CUBE_UNIT, uint(inside * 255.0f), uint(distPZ * 255.0f), uint(distNZ * 255.0f)));
+        Cube.distanceToSolid_x01_y01 = pack_bytes(glm::u32vec4(uint(distPX * 255.0f), uint(distNX * 255.0f), uint(distPY * 255.0f), uint(distNY * 255.0f)));
+    }
+}
 
-    Cube.distanceToSolid_gg_z01 = pack_bytes(glm::u32vec4(minDist / CUBE_UNIT, uint(inside * 255.0f), uint(distPZ * 255.0f), uint(distNZ * 255.0f)));
-    Cube.distanceToSolid_x01_y01 = pack_bytes(glm::u32vec4(uint(distPX * 255.0f), uint(distNX * 255.0f), uint(distPY * 255.0f), uint(distNY * 255.0f)));
+void VoxelizeCube(const FCPUTLASSnapshot& snapshot, VoxelData& Cube, float3 origin)
+{
+    VoxelData* cube = &Cube;
+    VoxelizeCubes(snapshot, std::span(&cube, 1), std::span(&origin, 1));
 }
 
 #undef float2
@@ -168,6 +420,147 @@ void FCPUProbeBaker::Init(float unit_size, vec3 offset)
     voxels.resize( CUBE_SIZE_XY * CUBE_SIZE_XY * CUBE_SIZE_Z );
 }
 
+// blases below this size build faster than the cache file opens
+static constexpr size_t BLAS_CACHE_MIN_TRIANGLES = 2048;
+static constexpr uint32_t BLAS_CACHE_MAGIC = 0x53414c42; // "BLAS"
+static constexpr uint32_t BLAS_CACHE_VERSION = 1;
+
+// cache file layout: header, triangles, extinfos, bvh nodes, bvh prim indices
+struct FBLASCacheHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t bvhVersion;
+    uint32_t triCount;
+    uint32_t usedNodes;
+    uint32_t idxCount;
+};
+
+static uint32_t GetTinyBVHVersion()
+{
+    return TINY_BVH_VERSION_SUB + (TINY_BVH_VERSION_MINOR << 8) + (TINY_BVH_VERSION_MAJOR << 16);
+}
+
+static void SaveBLASCache(const std::string& cacheFileName, const FCPUBLASContext& context)
+{
+    const tinybvh::BVH& bvh = context.bvh;
+    FBLASCacheHeader header { BLAS_CACHE_MAGIC, BLAS_CACHE_VERSION, GetTinyBVHVersion(), uint32_t(context.extinfos.size()), bvh.usedNodes, bvh.idxCount };
+
+    // identical meshes share the file
+    Utilities::FileHelper::WriteFileAtomically(cacheFileName, [&](std::ostream& writer)
+    {
+        writer.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        writer.write(reinterpret_cast<const char*>(context.triangles.data()), context.triangles.size() * sizeof(tinybvh::bvhvec4));
+        writer.write(reinterpret_cast<const char*>(context.extinfos.data()), context.extinfos.size() * sizeof(FCPUBLASVertInfo));
+        writer.write(reinterpret_cast<const char*>(bvh.bvhNode), bvh.usedNodes * sizeof(tinybvh::BVH::BVHNode));
+        writer.write(reinterpret_cast<const char*>(bvh.primIdx), bvh.idxCount * sizeof(uint32_t));
+        return bool(writer);
+    });
+}
+
+static bool LoadBLASCache(const std::string& cacheFileName, uint32_t triCount, FCPUBLASContext& context)
+{
+    Utilities::FileHelper::FMappedFile file(cacheFileName);
+    if (!file.IsValid() || file.Size() < sizeof(FBLASCacheHeader))
+    {
+        return false;
+    }
+
+    FBLASCacheHeader header;
+    std::memcpy(&header, file.Data(), sizeof(header));
+    const size_t triangleBytes = size_t(triCount) * 3 * sizeof(tinybvh::bvhvec4);
+    const size_t extinfoBytes = size_t(triCount) * sizeof(FCPUBLASVertInfo);
+    const size_t nodeBytes = size_t(header.usedNodes) * sizeof(tinybvh::BVH::BVHNode);
+    const size_t idxBytes = size_t(header.idxCount) * sizeof(uint32_t);
+    if (header.magic != BLAS_CACHE_MAGIC || header.version != BLAS_CACHE_VERSION || header.bvhVersion != GetTinyBVHVersion()
+        || header.triCount != triCount || header.usedNodes == 0
+        || file.Size() != sizeof(header) + triangleBytes + extinfoBytes + nodeBytes + idxBytes)
+    {
+        return false;
+    }
+
+    const uint8_t* data = file.Data() + sizeof(header);
+    context.triangles.resize(size_t(triCount) * 3);
+    context.extinfos.resize(triCount);
+    std::memcpy(context.triangles.data(), data, triangleBytes);
+    std::memcpy(context.extinfos.data(), data + triangleBytes, extinfoBytes);
+    data += triangleBytes + extinfoBytes;
+
+    // what BVH::Load does, minus the stream
+    tinybvh::BVH& bvh = context.bvh;
+    bvh.bvhNode = static_cast<tinybvh::BVH::BVHNode*>(bvh.AlignedAlloc(nodeBytes));
+    bvh.primIdx = static_cast<uint32_t*>(bvh.AlignedAlloc(idxBytes));
+    std::memcpy(bvh.bvhNode, data, nodeBytes);
+    std::memcpy(bvh.primIdx, data + nodeBytes, idxBytes);
+    bvh.allocatedNodes = bvh.usedNodes = header.usedNodes;
+    bvh.triCount = triCount;
+    bvh.idxCount = header.idxCount;
+    bvh.aabbMin = bvh.bvhNode[0].aabbMin;
+    bvh.aabbMax = bvh.bvhNode[0].aabbMax;
+    bvh.verts = tinybvh::bvhvec4slice{ context.triangles.data(), triCount * 3, sizeof(tinybvh::bvhvec4) };
+    // no fragments, a loaded bvh can't be rebuilt
+    bvh.rebuildable = false;
+    return true;
+}
+
+// returns true when loaded from the cache
+static bool BuildBLAS(const Model& model, FCPUBLASContext& context)
+{
+    const std::vector<Vertex>& vertices = model.CPUVertices();
+    const std::vector<uint32_t>& indices = model.CPUIndices();
+    const uint32_t triCount = uint32_t(indices.size() / 3);
+
+    const bool useCache = triCount >= BLAS_CACHE_MIN_TRIANGLES;
+    std::string cacheFileName;
+    if (useCache)
+    {
+        XXH64_hash_t vhash = XXH64(vertices.data(), vertices.size() * sizeof(Vertex), 0);
+        vhash = XXH64(indices.data(), indices.size() * sizeof(uint32_t), vhash);
+        cacheFileName = Utilities::CookHelper::GetCookedFileName(fmt::format("{:016x}", vhash), "cpublas");
+        if (LoadBLASCache(cacheFileName, triCount, context))
+        {
+            return true;
+        }
+    }
+
+    // gather the positions and materials out of the fat vertices first, the triangle loop then stays in cache
+    std::vector<vec3> positions(vertices.size());
+    std::vector<uint32_t> materialIdxs(vertices.size());
+    for (size_t v = 0; v < vertices.size(); ++v)
+    {
+        positions[v] = vertices[v].Position;
+        materialIdxs[v] = vertices[v].MaterialIndex;
+    }
+
+    context.triangles.resize(size_t(triCount) * 3);
+    context.extinfos.resize(triCount);
+    for (uint32_t t = 0; t < triCount; ++t)
+    {
+        // Get the three vertices of the triangle
+        const vec3& p0 = positions[indices[t * 3]];
+        const vec3& p1 = positions[indices[t * 3 + 1]];
+        const vec3& p2 = positions[indices[t * 3 + 2]];
+
+        // Calculate face normal
+        vec3 normal = normalize(cross(p1 - p0, p2 - p1));
+
+        // Add triangle vertices to BVH
+        context.triangles[t * 3] = tinybvh::bvhvec4(p0.x, p0.y, p0.z, 0);
+        context.triangles[t * 3 + 1] = tinybvh::bvhvec4(p1.x, p1.y, p1.z, 0);
+        context.triangles[t * 3 + 2] = tinybvh::bvhvec4(p2.x, p2.y, p2.z, 0);
+
+        // Store additional triangle information
+        context.extinfos[t] = { normal, materialIdxs[indices[t * 3]] };
+    }
+
+    context.bvh.Build( context.triangles.data(), triCount );
+    if (useCache)
+    {
+        SaveBLASCache(cacheFileName, context);
+    }
+    return false;
+}
+
 void FCPUAccelerationStructure::InitBVH(Scene& scene)
 {
     auto& HDR = GlobalTexturePool::GetInstance()->GetHDRSphericalHarmonics();
@@ -175,57 +568,67 @@ void FCPUAccelerationStructure::InitBVH(Scene& scene)
     
     const auto timer = std::chrono::high_resolution_clock::now();
 
+    // the instances of both snapshots point into the old blases, the bake of them is useless now.
+    // only ray queries may still read them, those end quickly
+    CancelBake();
+    for (FCPUTLASSnapshot& snapshot : tlasSnapshots)
+    {
+        while (snapshot.readers.load() > 0)
+        {
+            std::this_thread::yield();
+        }
+        snapshot.instances.clear();
+        snapshot.infos.clear();
+        snapshot.revisions.clear();
+    }
+    frontSnapshot = &tlasSnapshots[0];
+
     bvhBLASList.clear();
     bvhBLASContexts.clear();
 
     bvhBLASContexts.resize(scene.Models().size());
-    for ( size_t m = 0; m < scene.Models().size(); ++m )
+
+    // biggest first, so the long builds don't end up last on one worker
+    std::vector<uint32_t> buildOrder(scene.Models().size());
+    std::iota(buildOrder.begin(), buildOrder.end(), 0);
+    std::sort(buildOrder.begin(), buildOrder.end(), [&scene](uint32_t a, uint32_t b) {
+        return scene.Models()[a].CPUIndices().size() > scene.Models()[b].CPUIndices().size();
+    });
+
+    std::atomic<uint32_t> cachedCount = 0;
+    auto counter = TaskCoordinator::GetInstance()->CreateCounter();
+    for (uint32_t m : buildOrder)
     {
-        const Model& model = scene.Models()[m];
-        for (size_t i = 0; i < model.CPUIndices().size(); i += 3)
+        if (scene.Models()[m].CPUIndices().empty())
         {
-            // Get the three vertices of the triangle
-            const Vertex& v0 = model.CPUVertices()[model.CPUIndices()[i]];
-            const Vertex& v1 = model.CPUVertices()[model.CPUIndices()[i + 1]];
-            const Vertex& v2 = model.CPUVertices()[model.CPUIndices()[i + 2]];
-            
-            // Calculate face normal
-            vec3 edge1 = vec3(v1.Position) - vec3(v0.Position);
-            vec3 edge2 = vec3(v2.Position) - vec3(v1.Position);
-            vec3 normal = normalize(cross(edge1, edge2));
-            
-            // Add triangle vertices to BVH
-            bvhBLASContexts[m].triangles.push_back(tinybvh::bvhvec4(v0.Position.x, v0.Position.y, v0.Position.z, 0));
-            bvhBLASContexts[m].triangles.push_back(tinybvh::bvhvec4(v1.Position.x, v1.Position.y, v1.Position.z, 0));
-            bvhBLASContexts[m].triangles.push_back(tinybvh::bvhvec4(v2.Position.x, v2.Position.y, v2.Position.z, 0));
-
-            // Store additional triangle information
-            bvhBLASContexts[m].extinfos.push_back({normal, v0.MaterialIndex});
+            continue;
         }
 
-        // here we can cache the blas to disk if its big enough
-        if (bvhBLASContexts[m].triangles.size() > 16384 * 3)
+        TaskCoordinator::GetInstance()->AddParralledTask([this, &scene, &cachedCount, m](ResTask& task)
         {
-            XXH64_hash_t vhash = XXH64(bvhBLASContexts[m].triangles.data(), bvhBLASContexts[m].triangles.size() * sizeof(tinybvh::bvhvec4), 0);
-            std::string cacheFileName = Utilities::CookHelper::GetCookedFileName(fmt::format("{:016x}", vhash), "cpubvh");
-
-            if (!std::filesystem::exists(cacheFileName))
-            {
-                bvhBLASContexts[m].bvh.Build( bvhBLASContexts[m].triangles.data(), static_cast<int>(bvhBLASContexts[m].triangles.size()) / 3 );
-                bvhBLASContexts[m].bvh.Save(cacheFileName.c_str());
-            }
-            else
+            FCPUBLASContext& context = bvhBLASContexts[m];
+            if (BuildBLAS(scene.Models()[m], context))
             {
-                bvhBLASContexts[m].bvh.Load(cacheFileName.c_str(), bvhBLASContexts[m].triangles.data(), static_cast<int>(bvhBLASContexts[m].triangles.size()) / 3 );
+                cachedCount++;
             }
-        }
-        else
-        {
-            bvhBLASContexts[m].bvh.Build( bvhBLASContexts[m].triangles.data(), static_cast<int>(bvhBLASContexts[m].triangles.size()) / 3 );
-        }
+#if CPU_BVH_USE_SOA
+            context.bvhSoA.ConvertFrom( context.bvh );
+#endif
+        }, nullptr, {}, counter);
+    }
+    TaskCoordinator::GetInstance()->WaitForCounter(counter);
 
-        bvhBLASList.push_back( &bvhBLASContexts[m].bvh );
+    for (FCPUBLASContext& context : bvhBLASContexts)
+    {
+#if CPU_BVH_USE_SOA
+        bvhBLASList.push_back( &context.bvhSoA );
+#else
+        bvhBLASList.push_back( &context.bvh );
+#endif
     }
+
+    fmt::print("cpu blas built: {} models, {} from cache, {:.1f}ms\n", bvhBLASContexts.size(), cachedCount.load(),
+        std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - timer).count());
     
     probeBaker.Init( CUBE_UNIT, CUBE_OFFSET );
     cpuPageIndex.Init();
@@ -235,78 +638,262 @@ void FCPUAccelerationStructure::InitBVH(Scene& scene)
 
 void FCPUAccelerationStructure::UpdateBVH(Scene& scene)
 {
-    std::vector<tinybvh::BLASInstance> tmpbvhInstanceList;
-    std::vector<FCPUTLASInstanceInfo> tmpbvhTLASContexts;
-
+    std::vector<Node*> drawables;
+    drawables.reserve(scene.Nodes().size());
     for (auto& node : scene.Nodes())
     {
-        node->RecalcTransform(true);
+        // models without triangles have no blas
+        if (node->IsDrawable() && !bvhBLASContexts[node->GetModel()].extinfos.empty())
+        {
+            drawables.push_back(node.get());
+        }
+    }
 
-        uint32_t modelId = node->GetModel();
-        if (modelId == -1) continue;
+    // nothing moved since the front snapshot, skip it
+    const FCPUTLASSnapshot* front = frontSnapshot.load();
+    bool frontUpToDate = front->instances.size() == drawables.size();
+    for (size_t i = 0; i < drawables.size() && frontUpToDate; ++i)
+    {
+        frontUpToDate = front->revisions[i] == drawables[i]->GetRevision() && front->infos[i].nodeId == drawables[i]->GetInstanceId()
+            && front->instances[i].blasIdx == drawables[i]->GetModel();
+    }
+    if (frontUpToDate && (drawables.empty() || front->tlas.usedNodes > 0))
+    {
+        return;
+    }
+
+    // the back snapshot is two updates old, readers pin it for a packet or a query batch only.
+    // still busy, keep the front one and retry next tick, the nodes stay dirty until then
+    FCPUTLASSnapshot& back = front == &tlasSnapshots[0] ? tlasSnapshots[1] : tlasSnapshots[0];
+    if (back.readers.load() > 0)
+    {
+        return;
+    }
 
-        mat4 worldTS = node->WorldTransform();
-        worldTS = transpose(worldTS);
+    // same instances as when the back tlas was built, only the dirty ones need a sync
+    bool sameLayout = back.instances.size() == drawables.size() && back.tlas.usedNodes > 0;
+    for (size_t i = 0; i < drawables.size() && sameLayout; ++i)
+    {
+        sameLayout = back.infos[i].nodeId == drawables[i]->GetInstanceId() && back.instances[i].blasIdx == drawables[i]->GetModel();
+    }
+    if (!sameLayout)
+    {
+        back.instances.resize(drawables.size());
+        back.infos.resize(drawables.size());
+        back.revisions.assign(drawables.size(), ~0u);
+    }
 
-        tinybvh::BLASInstance instance;
-        instance.blasIdx = modelId;
+    uint32_t dirtyCount = 0;
+    for (size_t i = 0; i < drawables.size(); ++i)
+    {
+        Node* node = drawables[i];
+        if (back.revisions[i] == node->GetRevision())
+        {
+            continue;
+        }
+        back.revisions[i] = node->GetRevision();
+        dirtyCount++;
+
+        mat4 worldTS = transpose(node->WorldTransform());
+        tinybvh::BLASInstance& instance = back.instances[i];
+        instance.blasIdx = node->GetModel();
         std::memcpy( (float*)instance.transform, &(worldTS[0]), sizeof(float) * 16);
+        instance.Update( bvhBLASList[instance.blasIdx] );
+
+        FCPUTLASInstanceInfo& info = back.infos[i];
+        info.matIdxs = node->Materials();
+        info.nodeId = node->GetInstanceId();
+        info.rayMask = node->GetRayMask();
+    }
+
+    if (!back.instances.empty())
+    {
+        // refit keeps the topology, good enough while only a few instances move
+        if (sameLayout && dirtyCount * TLAS_REFIT_DIRTY_RATIO <= back.instances.size() && back.refitCount < TLAS_MAX_REFIT_COUNT)
+        {
+            RefitTLAS(back.tlas);
+            back.refitCount++;
+        }
+        else
+        {
+            // instances are up to date already, no blas list needed here
+            back.tlas.Build( back.instances.data(), static_cast<int>(back.instances.size()), nullptr, 0 );
+            back.tlas.blasList = bvhBLASList.data();
+            back.tlas.blasCount = static_cast<uint32_t>(bvhBLASList.size());
+            back.refitCount = 0;
+        }
+    }
+
+    // new tasks trace the back one from now on. flipped before the requests below, a group task that
+    // takes a request when it begins is sure to trace the new snapshot
+    frontSnapshot = &back;
+    GbvhBLASContexts = &bvhBLASContexts;
+
+    // the bake has only seen the old front snapshot so far, re-voxelize wherever back differs from it
+    auto diffInstance = [this, front, &back](uint32_t j, size_t i)
+    {
+        if (front->revisions[j] == back.revisions[i])
+        {
+            return;
+        }
+        const tinybvh::BLASInstance& prev = front->instances[j];
+        const tinybvh::BLASInstance& curr = back.instances[i];
+        if (prev.blasIdx != curr.blasIdx || std::memcmp(prev.transform, curr.transform, sizeof(prev.transform)) != 0 || front->infos[j].matIdxs != back.infos[i].matIdxs)
+        {
+            RequestInstanceUpdate(prev);
+            RequestInstanceUpdate(curr);
+        }
+    };
 
-        tmpbvhInstanceList.push_back(instance);
-        FCPUTLASInstanceInfo info;
-        for ( int i = 0; i < node->Materials().size(); ++i )
+    bool frontLayout = front->instances.size() == back.instances.size();
+    for (size_t i = 0; i < back.instances.size() && frontLayout; ++i)
+    {
+        frontLayout = front->infos[i].nodeId == back.infos[i].nodeId;
+    }
+    if (frontLayout)
+    {
+        for (size_t i = 0; i < back.instances.size(); ++i)
+        {
+            diffInstance(uint32_t(i), i);
+        }
+    }
+    else
+    {
+        // nodes added or removed, match them up by instance id
+        std::unordered_map<uint32_t, uint32_t> frontIndices;
+        frontIndices.reserve(front->instances.size());
+        for (uint32_t j = 0; j < front->instances.size(); ++j)
+        {
+            frontIndices[front->infos[j].nodeId] = j;
+        }
+        for (size_t i = 0; i < back.instances.size(); ++i)
+        {
+            auto it = frontIndices.find(back.infos[i].nodeId);
+            if (it == frontIndices.end())
+            {
+                RequestInstanceUpdate(back.instances[i]);
+                continue;
+            }
+            diffInstance(it->second, i);
+            frontIndices.erase(it);
+        }
+        for (auto& [nodeId, j] : frontIndices)
         {
-            uint32_t matId = node->Materials()[i];
-            FMaterial& mat = scene.Materials()[matId];
-            info.matIdxs[i] = matId;
-            info.nodeId = node->GetInstanceId();
+            RequestInstanceUpdate(front->instances[j]);
         }
-        tmpbvhTLASContexts.push_back( info );
     }
+}
 
-    if (tmpbvhInstanceList.size() > 0)
+const FCPUTLASSnapshot& FCPUAccelerationStructure::AcquireSnapshot() const
+{
+    while (true)
     {
-        GCpuBvh.Build( tmpbvhInstanceList.data(), static_cast<int>(tmpbvhInstanceList.size()), bvhBLASList.data(), static_cast<int>(bvhBLASList.size()) );
+        const FCPUTLASSnapshot* snapshot = frontSnapshot.load();
+        snapshot->readers++;
+        // UpdateBVH may flip in between, it only rewrites a snapshot after seeing no readers
+        if (snapshot == frontSnapshot.load())
+        {
+            return *snapshot;
+        }
+        snapshot->readers--;
     }
+}
+
+void FCPUAccelerationStructure::ReleaseSnapshot(const FCPUTLASSnapshot& snapshot) const
+{
+    snapshot.readers--;
+}
 
-    TaskCoordinator::GetInstance()->WaitForAllParralledTask();
+void FCPUAccelerationStructure::TraceRays(std::span<tinybvh::Ray> rays) const
+{
+    FSnapshotScope snapshot(*this);
+    ::TraceRays(snapshot.Get(), rays);
+}
 
-    bvhInstanceList.swap(tmpbvhInstanceList);
-    bvhTLASContexts.swap(tmpbvhTLASContexts);
-    
-    // rebind with new address
-    GbvhInstanceList = &bvhInstanceList;
-    GbvhTLASContexts = &bvhTLASContexts;
-    GbvhBLASContexts = &bvhBLASContexts;
+RayCastResult FCPUAccelerationStructure::RayCastInCPU(vec3 rayOrigin, vec3 rayDir) const
+{
+    FRayQuery query{ rayOrigin, rayDir };
+    RayCastResult Result{};
+    RayQuery(std::span(&query, 1), std::span(&Result, 1));
+    return Result;
 }
 
-RayCastResult FCPUAccelerationStructure::RayCastInCPU(vec3 rayOrigin, vec3 rayDir)
+static void TraceQueries(const FCPUTLASSnapshot& snapshot, std::span<const FRayQuery> queries, std::span<RayCastResult> results, ERayQueryType type)
 {
-    RayCastResult Result;
+    tinybvh::Ray rays[RAY_PACKET_SIZE];
+    uint32_t rayMasks[RAY_PACKET_SIZE];
+    FPacketFilter filter{ snapshot.infos.data(), rayMasks, type == ERayQueryType::ERQT_AnyHit };
+    for (size_t i = 0; i < queries.size(); i += RAY_PACKET_SIZE)
+    {
+        const uint32_t count = uint32_t(std::min<size_t>(RAY_PACKET_SIZE, queries.size() - i));
+        bool masked = false;
+        for (uint32_t j = 0; j < count; ++j)
+        {
+            const FRayQuery& query = queries[i + j];
+            rays[j] = tinybvh::Ray(tinybvh::bvhvec3(query.origin.x, query.origin.y, query.origin.z), tinybvh::bvhvec3(query.direction.x, query.direction.y, query.direction.z), query.maxDistance);
+            rayMasks[j] = query.rayMask;
+            masked |= query.rayMask != ~0u;
+        }
+        // unmasked batches skip the per instance test
+        filter.rayMasks = masked ? rayMasks : nullptr;
+        IntersectPacket(snapshot.tlas, rays, count, &filter);
 
-    tinybvh::Ray ray(tinybvh::bvhvec3(rayOrigin.x, rayOrigin.y, rayOrigin.z), tinybvh::bvhvec3(rayDir.x, rayDir.y, rayDir.z), 2000.0f);
-    GCpuBvh.Intersect(ray);
-    
-    if (ray.hit.t < 2000.f)
-    {
-        vec3 hitPos = rayOrigin + rayDir * ray.hit.t;
-        uint32_t primIdx = ray.hit.prim;
-        tinybvh::BLASInstance& instance = (*GbvhInstanceList)[ray.hit.inst];
-        FCPUTLASInstanceInfo& instContext = (*GbvhTLASContexts)[ray.hit.inst];
-        FCPUBLASContext& context = (*GbvhBLASContexts)[instance.blasIdx];
-        mat4* worldTS = (mat4*)instance.transform;
-        vec4 normalWS = vec4( context.extinfos[primIdx].normal, 0.0f) * *worldTS;
-        Result.HitPoint = vec4(hitPos, 0);
-        Result.Normal = normalWS;
-        Result.Hitted = true;
-        Result.T = ray.hit.t;
-        Result.InstanceId = instContext.nodeId;
+        for (uint32_t j = 0; j < count; ++j)
+        {
+            const tinybvh::Ray& ray = rays[j];
+            RayCastResult& Result = results[i + j];
+            Result = RayCastResult{};
+            if (ray.hit.t < queries[i + j].maxDistance)
+            {
+                vec3 Normal;
+                uint MaterialId, InstanceId;
+                ResolveHit(snapshot, ray, Normal, MaterialId, InstanceId);
+                Result.HitPoint = vec4(queries[i + j].origin + vec3(ray.D.x, ray.D.y, ray.D.z) * ray.hit.t, 0);
+                Result.Normal = vec4(Normal, 0);
+                Result.T = ray.hit.t;
+                Result.InstanceId = InstanceId;
+                Result.MaterialId = MaterialId;
+                Result.Hitted = true;
+            }
+        }
     }
+}
 
-    return Result;
+// queries per task, small batches are traced on the calling thread alone
+static constexpr size_t RAY_QUERY_TASK_SIZE = 1024;
+
+void FCPUAccelerationStructure::RayQuery(std::span<const FRayQuery> queries, std::span<RayCastResult> results, ERayQueryType type) const
+{
+    assert(results.size() >= queries.size());
+
+    FSnapshotScope snapshot(*this);
+    if (snapshot.Get().instances.empty())
+    {
+        std::fill_n(results.begin(), queries.size(), RayCastResult{});
+        return;
+    }
+
+    // the scope above keeps the snapshot pinned for all of the tasks
+    const FCPUTLASSnapshot& pinned = snapshot.Get();
+    std::shared_ptr<TaskCounter> counter;
+    for (size_t i = RAY_QUERY_TASK_SIZE; i < queries.size(); i += RAY_QUERY_TASK_SIZE)
+    {
+        if (!counter)
+        {
+            counter = TaskCoordinator::GetInstance()->CreateCounter();
+        }
+        const size_t count = std::min(RAY_QUERY_TASK_SIZE, queries.size() - i);
+        TaskCoordinator::GetInstance()->AddParralledTask([&pinned, chunk = queries.subspan(i, count), out = results.subspan(i, count), type](ResTask& task)
+        {
+            TraceQueries(pinned, chunk, out, type);
+        }, nullptr, {}, counter);
+    }
+
+    TraceQueries(pinned, queries.first(std::min(RAY_QUERY_TASK_SIZE, queries.size())), results, type);
+    TaskCoordinator::GetInstance()->WaitForCounter(counter);
 }
 
-void FCPUProbeBaker::ProcessCube(int x, int y, int z, ECubeProcType procType)
+void FCPUProbeBaker::ProcessCube(const FCPUTLASSnapshot& snapshot, int x, int y, int z, ECubeProcType procType)
 {
     auto& ubo = NextEngine::GetInstance()->GetUniformBufferObject();
     vec3 probePos = vec3(x, y, z) * UNIT_SIZE + CUBE_OFFSET;
@@ -319,11 +906,44 @@ void FCPUProbeBaker::ProcessCube(int x, int y, int z, ECubeProcType procType)
         case ECubeProcType::ECPT_Fence:
             break;
         case ECubeProcType::ECPT_Voxelize:
-            VoxelizeCube(voxel, probePos);
+            VoxelizeCube(snapshot, voxel, probePos);
             break;
     }
 }
 
+void FCPUProbeBaker::ProcessGroup(const FCPUAccelerationStructure& cpuAS, int x0, int z0, int groupSize, ECubeProcType procType)
+{
+    if (procType != ECubeProcType::ECPT_Voxelize)
+    {
+        return;
+    }
+
+    // x rows of neighbor cubes stacked along y, rays of one packet stay coherent
+    VoxelData* cubes[RAY_PACKET_SIZE];
+    vec3 origins[RAY_PACKET_SIZE];
+    uint32_t count = 0;
+    for (int z = z0; z < z0 + groupSize; z++)
+        for (int y = 0; y < CUBE_SIZE_Z; y++)
+            for (int x = x0; x < x0 + groupSize; x++)
+            {
+                cubes[count] = &voxels[y * CUBE_SIZE_XY * CUBE_SIZE_XY + z * CUBE_SIZE_XY + x];
+                origins[count] = vec3(x, y, z) * UNIT_SIZE + CUBE_OFFSET;
+                if (++count == RAY_PACKET_SIZE)
+                {
+                    // the snapshot current when the packet starts, changes after it re-queue the group anyway
+                    FSnapshotScope snapshot(cpuAS);
+                    VoxelizeCubes(snapshot.Get(), std::span(cubes, count), std::span(origins, count));
+                    count = 0;
+                }
+            }
+
+    if (count > 0)
+    {
+        FSnapshotScope snapshot(cpuAS);
+        VoxelizeCubes(snapshot.Get(), std::span(cubes, count), std::span(origins, count));
+    }
+}
+
 void FCPUProbeBaker::UploadGPU(Vulkan::DeviceMemory& VoxelGPUMemory)
 {
     VoxelData* data = reinterpret_cast<VoxelData*>(VoxelGPUMemory.Map(0, sizeof(VoxelData) * voxels.size()));
@@ -331,27 +951,63 @@ void FCPUProbeBaker::UploadGPU(Vulkan::DeviceMemory& VoxelGPUMemory)
     VoxelGPUMemory.Unmap();
 }
 
-void FCPUAccelerationStructure::AsyncProcessFull(Assets::Scene& scene, Vulkan::DeviceMemory* VoxelGPUMemory, bool Incremental)
-{    
-    // clean
+void FCPUProbeBaker::UploadGroups(Vulkan::DeviceMemory& VoxelGPUMemory, const std::unordered_set<ivec3>& groups, int groupSize)
+{
+    // the memory is host coherent, writes are visible without flushing ranges
+    VoxelData* data = reinterpret_cast<VoxelData*>(VoxelGPUMemory.Map(0, sizeof(VoxelData) * voxels.size()));
+    for (const ivec3& group : groups)
+    {
+        // x is the innermost axis, each row of a group is one contiguous run
+        for (int y = 0; y < CUBE_SIZE_Z; y++)
+            for (int z = group.z; z < group.z + groupSize; z++)
+            {
+                size_t offset = size_t(y) * CUBE_SIZE_XY * CUBE_SIZE_XY + size_t(z) * CUBE_SIZE_XY + group.x;
+                std::memcpy(data + offset, voxels.data() + offset, groupSize * sizeof(VoxelData));
+            }
+    }
+    VoxelGPUMemory.Unmap();
+}
+
+void FCPUAccelerationStructure::CancelBake()
+{
+    // clean, canceled groups never finish their regions
     while (!needUpdateGroups.empty())
         needUpdateGroups.pop();
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        pendingGroups.clear();
+    }
+    bakeRegions.clear();
     lastBatchTasks.clear();
-    TaskCoordinator::GetInstance()->CancelAllParralledTasks();
+    batchDependencies.clear();
+
+    // running groups still write the voxels, let them end before the grid is cleared
+    TaskCoordinator::GetInstance()->CancelTasks(bakeCounter);
+    TaskCoordinator::GetInstance()->WaitForCounter(bakeCounter);
+
+    // complete_funcs of the old tasks may still be queued, they see another generation and do nothing
+    inFlightGroups.clear();
+    bakeGeneration++;
+}
+
+void FCPUAccelerationStructure::AsyncProcessFull(Assets::Scene& scene, Vulkan::DeviceMemory* VoxelGPUMemory, bool Incremental)
+{    
+    CancelBake();
     
+    flushGroups.clear();
     if (!Incremental)
     {
         probeBaker.ClearAmbientCubes();
         probeBaker.UploadGPU(*VoxelGPUMemory);
+        cpuPageIndex.UpdateData(probeBaker);
     }
     else
     {
         UpdateBVH(scene);
     }
     
-    const int groupSize = 16;
-    const int lengthX = CUBE_SIZE_XY / groupSize;
-    const int lengthZ = CUBE_SIZE_XY / groupSize;
+    const int lengthX = CUBE_SIZE_XY / BAKE_GROUP_SIZE;
+    const int lengthZ = CUBE_SIZE_XY / BAKE_GROUP_SIZE;
 
     // far probe gen
     // for (int x = 0; x < lengthX; x++)
@@ -371,9 +1027,11 @@ void FCPUAccelerationStructure::AsyncProcessFull(Assets::Scene& scene, Vulkan::D
         std::mt19937 g(rd());
         std::shuffle(coordinates.begin(), coordinates.end(), g);
 
-        // dispatch
+        // dispatch, the whole pass is one region
+        uint32_t regionId = nextRegionId++;
+        bakeRegions[regionId].startTime = std::chrono::high_resolution_clock::now();
         for (const auto& [x, z] : coordinates)
-            needUpdateGroups.push({ivec3(x, 0, z), ECubeProcType::ECPT_Voxelize, EBakerType::EBT_Probe});
+            EnqueueGroup(ivec3(x, 0, z), regionId);
         // add fence
         needUpdateGroups.push({ivec3(0), ECubeProcType::ECPT_Fence, EBakerType::EBT_Probe});
     }
@@ -381,12 +1039,14 @@ void FCPUAccelerationStructure::AsyncProcessFull(Assets::Scene& scene, Vulkan::D
 
 void FCPUAccelerationStructure::AsyncProcessGroup(int xInMeter, int zInMeter, Scene& scene, ECubeProcType procType, EBakerType bakerType)
 {
-    if (bvhInstanceList.empty())
+    if (!HasInstances())
     {
+        inFlightGroups.erase(ivec3(xInMeter, 0, zInMeter));
+        FinishGroup(TakePendingGroup(ivec3(xInMeter, 0, zInMeter)));
         return;
     }
     
-    int groupSize = 16; // 4 x 4 x 40 a group
+    int groupSize = BAKE_GROUP_SIZE; // 4 x 4 x 40 a group
     
     int actualX = xInMeter * groupSize;
     int actualZ = zInMeter * groupSize;
@@ -403,78 +1063,186 @@ void FCPUAccelerationStructure::AsyncProcessGroup(int xInMeter, int zInMeter, Sc
         sunDir.push_back( scene.GetSunDir() );
     }
 
+    if (!bakeCounter)
+    {
+        bakeCounter = TaskCoordinator::GetInstance()->CreateCounter();
+    }
+
+    // requests reaching the group before the task begins are merged into it, the task takes them when it begins
+    auto regions = std::make_shared<std::vector<uint32_t>>();
     uint32_t taskId = TaskCoordinator::GetInstance()->AddParralledTask(
-                [this, actualX, actualZ, groupSize, procType](ResTask& task)
+                [this, actualX, actualZ, groupSize, procType, xInMeter, zInMeter, regions](ResTask& task)
             {
-                for (int z = actualZ; z < actualZ + groupSize; z++)
-                    for (int y = 0; y < CUBE_SIZE_Z; y++)
-                        for (int x = actualX; x < actualX + groupSize; x++)
-                        {
-                            probeBaker.ProcessCube(x, y, z, procType);
-                        }
+                *regions = TakePendingGroup(ivec3(xInMeter, 0, zInMeter));
+                probeBaker.ProcessGroup(*this, actualX, actualZ, groupSize, procType);
             },
-            [this](ResTask& task)
+            [this, actualX, actualZ, xInMeter, zInMeter, regions, generation = bakeGeneration](ResTask& task)
             {
+                if (generation != bakeGeneration)
+                {
+                    return;
+                }
                 // flush here
                 //bakerType == EBakerType::EBT_Probe ? probeBaker.UploadGPU(*GPUMemory) : farProbeBaker.UploadGPU(*FarGPUMemory);
-                needFlush = true;
-            });
+                flushGroups.insert(ivec3(actualX, 0, actualZ));
+                inFlightGroups.erase(ivec3(xInMeter, 0, zInMeter));
+                FinishGroup(*regions);
+            }, batchDependencies, bakeCounter);
 
     lastBatchTasks.push_back(taskId);
 }
 
 void FCPUAccelerationStructure::Tick(Scene& scene, Vulkan::DeviceMemory* GPUMemory, Vulkan::DeviceMemory* VoxelGPUMemory, Vulkan::DeviceMemory* PageIndexMemory)
 {
-    if (needFlush)
-    {
-        // Upload to GPU, now entire range, optimize to partial upload later
-        probeBaker.UploadGPU(*VoxelGPUMemory);
-        cpuPageIndex.UpdateData(probeBaker);
-        cpuPageIndex.UploadGPU(*PageIndexMemory);
-        needFlush = false;
-    }
+    // cheap when nothing moved, a refit when a few nodes did
+    UpdateBVH(scene);
 
-    if (!lastBatchTasks.empty())
+    if (!flushGroups.empty())
     {
-        if (TaskCoordinator::GetInstance()->IsAllTaskComplete(lastBatchTasks))
+        // Upload to GPU, only the baked groups, the whole grid is ~28MB
+        probeBaker.UploadGroups(*VoxelGPUMemory, flushGroups, BAKE_GROUP_SIZE);
+        for (const ivec3& group : flushGroups)
         {
-            lastBatchTasks.clear();
+            cpuPageIndex.UpdateGroup(probeBaker, group.x, group.z, BAKE_GROUP_SIZE);
         }
+        flushGroups.clear();
     }
-    else
+    cpuPageIndex.UploadGPU(*PageIndexMemory);
+
+    // groups queued without a fence behind them, like dirty regions, never get cleared otherwise
+    std::erase_if(lastBatchTasks, [](uint32_t taskId) { return TaskCoordinator::GetInstance()->IsTaskFinished(taskId); });
+
+    // dispatch all pending groups at once, a fence makes the groups behind it start only after
+    // every group before it has finished, no frame polling needed
+    std::vector<std::tuple<ivec3, ECubeProcType, EBakerType>> busyGroups;
+    while (!needUpdateGroups.empty())
     {
-        while (!needUpdateGroups.empty())
+        auto& group = needUpdateGroups.front();
+        ECubeProcType type = std::get<1>(group);
+        if (type == ECubeProcType::ECPT_Fence)
         {
-            auto& group = needUpdateGroups.front();
-            ECubeProcType type = std::get<1>(group);
-            if (type == ECubeProcType::ECPT_Fence)
+            if (!lastBatchTasks.empty())
             {
-                if (!TaskCoordinator::GetInstance()->IsAllTaskComplete(lastBatchTasks))
-                {
-                    break; 
-                }
-                needUpdateGroups.pop();
-                continue;
+                batchDependencies = { TaskCoordinator::GetInstance()->AddFence(lastBatchTasks, nullptr, bakeCounter) };
+                lastBatchTasks.clear();
             }
-            AsyncProcessGroup(std::get<0>(group).x, std::get<0>(group).z, scene, std::get<1>(group), std::get<2>(group));
             needUpdateGroups.pop();
+            continue;
+        }
+        // one task per group at a time, two of them would write the same voxels. the later one
+        // waits for the running one to complete, requests keep merging into it meanwhile
+        if (!inFlightGroups.insert(std::get<0>(group)).second)
+        {
+            busyGroups.push_back(group);
+            needUpdateGroups.pop();
+            continue;
+        }
+        AsyncProcessGroup(std::get<0>(group).x, std::get<0>(group).z, scene, std::get<1>(group), std::get<2>(group));
+        needUpdateGroups.pop();
+    }
+    for (auto& group : busyGroups)
+    {
+        needUpdateGroups.push(group);
+    }
+}
+
+uint32_t FCPUAccelerationStructure::RequestUpdate(vec3 worldMin, vec3 worldMax)
+{
+    uint32_t regionId = nextRegionId++;
+    FBakeRegion& region = bakeRegions[regionId];
+    region.startTime = std::chrono::high_resolution_clock::now();
+
+    // world aabb to the group range, groups span the whole height
+    const int groupCount = CUBE_SIZE_XY / BAKE_GROUP_SIZE;
+    const float groupExtent = CUBE_UNIT * BAKE_GROUP_SIZE;
+    const float gridTop = CUBE_OFFSET.y + CUBE_SIZE_Z * CUBE_UNIT;
+    ivec3 min = ivec3(floor((worldMin - CUBE_OFFSET) / groupExtent));
+    ivec3 max = ivec3(floor((worldMax - CUBE_OFFSET) / groupExtent));
+    if (worldMax.y >= CUBE_OFFSET.y && worldMin.y <= gridTop)
+    {
+        for (int x = glm::max(min.x, 0); x <= glm::min(max.x, groupCount - 1); ++x) {
+            for (int z = glm::max(min.z, 0); z <= glm::min(max.z, groupCount - 1); ++z) {
+                EnqueueGroup(ivec3(x, 0, z), regionId);
+            }
         }
     }
+
+    // nothing overlapped the grid
+    if (region.groupCount == 0)
+    {
+        bakeRegions.erase(regionId);
+    }
+    return regionId;
 }
 
-void FCPUAccelerationStructure::RequestUpdate(vec3 worldPos, float radius)
+uint32_t FCPUAccelerationStructure::RequestUpdate(vec3 worldPos, float radius)
 {
-    ivec3 center = ivec3(worldPos - CUBE_OFFSET);
-    ivec3 min = center - ivec3(static_cast<int>(radius));
-    ivec3 max = center + ivec3(static_cast<int>(radius));
+    return RequestUpdate(worldPos - vec3(radius), worldPos + vec3(radius));
+}
+
+void FCPUAccelerationStructure::RequestInstanceUpdate(const tinybvh::BLASInstance& instance)
+{
+    RequestUpdate(vec3(instance.aabbMin.x, instance.aabbMin.y, instance.aabbMin.z) - vec3(DIRTY_REGION_MARGIN),
+        vec3(instance.aabbMax.x, instance.aabbMax.y, instance.aabbMax.z) + vec3(DIRTY_REGION_MARGIN));
+}
+
+void FCPUAccelerationStructure::EnqueueGroup(ivec3 group, uint32_t regionId)
+{
+    bakeRegions[regionId].groupCount++;
 
-    // Insert all points within the radius (using manhattan distance for simplicity)
-    for (int x = min.x; x <= max.x; ++x) {
-        for (int z = min.z; x <= max.z; ++z) {
-            ivec3 point(x, 1, z);
-            needUpdateGroups.push({point, ECubeProcType::ECPT_Voxelize, EBakerType::EBT_Probe});
+    // already queued and not begun yet, just wait for it as well
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    auto [it, inserted] = pendingGroups.try_emplace(group);
+    it->second.push_back(regionId);
+    if (inserted)
+    {
+        needUpdateGroups.push({group, ECubeProcType::ECPT_Voxelize, EBakerType::EBT_Probe});
+    }
+}
+
+std::vector<uint32_t> FCPUAccelerationStructure::TakePendingGroup(ivec3 group)
+{
+    // requests coming in from now on queue the group again
+    std::lock_guard<std::mutex> lock(pendingMutex);
+    std::vector<uint32_t> regions;
+    auto pending = pendingGroups.find(group);
+    if (pending != pendingGroups.end())
+    {
+        regions = std::move(pending->second);
+        pendingGroups.erase(pending);
+    }
+    return regions;
+}
+
+void FCPUAccelerationStructure::FinishGroup(const std::vector<uint32_t>& regions)
+{
+    for (uint32_t regionId : regions)
+    {
+        auto it = bakeRegions.find(regionId);
+        if (it == bakeRegions.end())
+        {
+            continue;
         }
+
+        FBakeRegion& region = it->second;
+        if (++region.finishedCount == region.groupCount)
+        {
+            lastRegionBakeTime = std::chrono::duration<float, std::milli>(std::chrono::high_resolution_clock::now() - region.startTime).count();
+            bakeRegions.erase(it);
+        }
+    }
+}
+
+void FCPUAccelerationStructure::GetBakeProgress(uint32_t& OutFinishedGroups, uint32_t& OutTotalGroups, uint32_t& OutRegionCount) const
+{
+    OutFinishedGroups = 0;
+    OutTotalGroups = 0;
+    for (auto& [regionId, region] : bakeRegions)
+    {
+        OutFinishedGroups += region.finishedCount;
+        OutTotalGroups += region.groupCount;
     }
+    OutRegionCount = uint32_t(bakeRegions.size());
 }
 
 void FCPUProbeBaker::ClearAmbientCubes()
@@ -488,6 +1256,8 @@ void FCPUProbeBaker::ClearAmbientCubes()
 void FCPUPageIndex::Init()
 {
     pageIndex.resize(Assets::ACGI_PAGE_COUNT * Assets::ACGI_PAGE_COUNT);
+    columnCounts.resize(CUBE_SIZE_XY * CUBE_SIZE_XY);
+    pageDirtyFlags.resize(pageIndex.size());
 }
 
 void FCPUPageIndex::UpdateData(FCPUProbeBaker& baker)
@@ -498,29 +1268,62 @@ void FCPUPageIndex::UpdateData(FCPUProbeBaker& baker)
         page = {};
         page.voxelCount = 0;
     }
+    std::fill(columnCounts.begin(), columnCounts.end(), 0);
+
+    // 遍历baker里的数据，按列统计，再加到对应的page上
+    for (int z = 0; z < CUBE_SIZE_XY; z++)
+        for (int x = 0; x < CUBE_SIZE_XY; x++)
+        {
+            UpdateColumn(baker, x, z);
+        }
 
-    // 遍历baker里的数据，根据index，取得worldpos，然后取page出来，给voxel数量提升
-    for ( uint gIdx = 0; gIdx < baker.voxels.size(); ++gIdx)
+    // the cleared pages have to go up as well
+    dirtyPages.clear();
+    for (uint32_t i = 0; i < pageIndex.size(); ++i)
     {
-        VoxelData& voxel = baker.voxels[gIdx];
-        if (voxel.matId == 0) continue; // 只处理活跃的cube
+        dirtyPages.push_back(i);
+        pageDirtyFlags[i] = true;
+    }
+}
 
-        // convert to local position
-        uint y = gIdx / (CUBE_SIZE_XY * CUBE_SIZE_XY);
-        uint z = (gIdx - y * CUBE_SIZE_XY * CUBE_SIZE_XY) / CUBE_SIZE_XY;
-        uint x = gIdx - y * CUBE_SIZE_XY * CUBE_SIZE_XY - z * CUBE_SIZE_XY;
+void FCPUPageIndex::UpdateGroup(FCPUProbeBaker& baker, int x0, int z0, int groupSize)
+{
+    for (int z = z0; z < z0 + groupSize; z++)
+        for (int x = x0; x < x0 + groupSize; x++)
+        {
+            UpdateColumn(baker, x, z);
+        }
+}
 
-        vec3 worldPos = vec3(x, y, z) *  CUBE_UNIT + CUBE_OFFSET;
+void FCPUPageIndex::UpdateColumn(FCPUProbeBaker& baker, int x, int z)
+{
+    // 只处理活跃的cube，每个cube对应一个voxel
+    uint16_t count = 0;
+    for (int y = 0; y < CUBE_SIZE_Z; y++)
+    {
+        count += baker.voxels[y * CUBE_SIZE_XY * CUBE_SIZE_XY + z * CUBE_SIZE_XY + x].matId != 0 ? 1 : 0;
+    }
+
+    uint16_t& columnCount = columnCounts[z * CUBE_SIZE_XY + x];
+    if (count == columnCount)
+    {
+        return;
+    }
 
-        // 获取对应的page
-        Assets::PageIndex& page = GetPage(worldPos);
+    // 获取对应的page，按差值增减voxel数量
+    vec3 worldPos = vec3(x, 0, z) * CUBE_UNIT + CUBE_OFFSET;
+    int pageIdx = GetPageIdx(worldPos);
+    pageIndex[pageIdx].voxelCount += int32_t(count) - int32_t(columnCount);
+    columnCount = count;
 
-        // 增加voxel数量
-        page.voxelCount += 1; // 假设每个cube对应一个voxel
+    if (!pageDirtyFlags[pageIdx])
+    {
+        pageDirtyFlags[pageIdx] = true;
+        dirtyPages.push_back(pageIdx);
     }
 }
 
-Assets::PageIndex& FCPUPageIndex::GetPage(glm::vec3 worldpos)
+int FCPUPageIndex::GetPageIdx(glm::vec3 worldpos) const
 {
     // 假设CUBE_OFFSET定义了世界空间的起始位置
     glm::vec3 relativePos = worldpos - Assets::ACGI_PAGE_OFFSET;
@@ -535,22 +1338,35 @@ Assets::PageIndex& FCPUPageIndex::GetPage(glm::vec3 worldpos)
     pageZ = glm::clamp(pageZ, 0, Assets::ACGI_PAGE_COUNT - 1);
 
     // 计算一维索引
-    int index = pageZ * Assets::ACGI_PAGE_COUNT + pageX;
+    return pageZ * Assets::ACGI_PAGE_COUNT + pageX;
+}
 
+Assets::PageIndex& FCPUPageIndex::GetPage(glm::vec3 worldpos)
+{
     // 返回对应的PageIndex引用
-    return pageIndex[index];
+    return pageIndex[GetPageIdx(worldpos)];
 }
 
 void FCPUPageIndex::UploadGPU(Vulkan::DeviceMemory& GPUMemory)
 {
+    if (dirtyPages.empty())
+    {
+        return;
+    }
+
     PageIndex* data = reinterpret_cast<PageIndex*>(GPUMemory.Map(0, sizeof(PageIndex) * pageIndex.size()));
-    std::memcpy(data, pageIndex.data(), pageIndex.size() * sizeof(PageIndex));
+    for (uint32_t pageIdx : dirtyPages)
+    {
+        data[pageIdx] = pageIndex[pageIdx];
+        pageDirtyFlags[pageIdx] = false;
+    }
     GPUMemory.Unmap();
+    dirtyPages.clear();
 }
 
 void FCPUAccelerationStructure::GenShadowMap(Scene& scene)
 {
-    if (bvhInstanceList.empty())
+    if (!HasInstances())
     {
         return;
     }
@@ -586,12 +1402,16 @@ void FCPUAccelerationStructure::GenShadowMap(Scene& scene)
             TaskCoordinator::GetInstance()->AddParralledTask(
                 [this, lightViewProj, invLVP, lightDir, startX, startY, tileSize, shadowMapSize](ResTask& task)
                 {
+                    // all rays share the light direction, trace them row by row as packets
+                    FSnapshotScope snapshot(*this);
+                    vec3 rayDir = normalize(lightDir);
+                    std::vector<tinybvh::Ray> rays(tileSize);
                     for (int y = 0; y < tileSize; y++)
                     {
+                        int pixelY = startY + y;
                         for (int x = 0; x < tileSize; x++)
                         {
                             int pixelX = startX + x;
-                            int pixelY = startY + y;
                             
                             // 计算NDC坐标
                             float ndcX = (pixelX / static_cast<float>(shadowMapSize - 1)) * 2.0f - 1.0f;
@@ -602,22 +1422,23 @@ void FCPUAccelerationStructure::GenShadowMap(Scene& scene)
                             worldPos /= worldPos.w;
                             
                             // 发射光线
-                            vec3 origin = vec3(worldPos);
-                            vec3 rayDir = normalize(lightDir);
-                            
-                            tinybvh::Ray ray(
-                                tinybvh::bvhvec3(origin.x, origin.y, origin.z),
+                            rays[x] = tinybvh::Ray(
+                                tinybvh::bvhvec3(worldPos.x, worldPos.y, worldPos.z),
                                 tinybvh::bvhvec3(rayDir.x, rayDir.y, rayDir.z),
                                 10000.0f
                             );
-                            
-                            GCpuBvh.Intersect(ray);
+                        }
+
+                        ::TraceRays(snapshot.Get(), rays);
+                        for (int x = 0; x < tileSize; x++)
+                        {
+                            const tinybvh::Ray& ray = rays[x];
                             if (ray.hit.t < 9999.0f)
                             {
-                                vec3 hitPoint = origin + rayDir * ray.hit.t;
+                                vec3 hitPoint = vec3(ray.O.x, ray.O.y, ray.O.z) + rayDir * ray.hit.t;
                                 vec4 hitPosInLightSpace = lightViewProj * vec4(hitPoint, 1.0f);
                                 float depth = (hitPosInLightSpace.z / hitPosInLightSpace.w + 1.0f) * 0.5f;
-                                shadowMapR32[pixelY * shadowMapSize + pixelX] = depth;
+                                shadowMapR32[pixelY * shadowMapSize + startX + x] = depth;
                             }
                         }
                     }
@@ -3,8 +3,19 @@
 #include "Assets/UniformBuffer.hpp"
 #include <glm/glm.hpp>
 #include "ThirdParty/tinybvh/tiny_bvh.h"
+#include <atomic>
+#include <chrono>
 #include <functional>
+#include <mutex>
 #include <queue>
+#include <span>
+
+// BLASes are traversed in the simd SoA layout when tinybvh has avx or neon
+#if defined(BVH_USEAVX) || defined(BVH_USENEON)
+#define CPU_BVH_USE_SOA 1
+#else
+#define CPU_BVH_USE_SOA 0
+#endif
 
 #include "Material.hpp"
 
@@ -35,6 +46,9 @@ namespace Vulkan
     class DeviceMemory;
 }
 
+class TaskCounter;
+class FCPUAccelerationStructure;
+
 enum class ECubeProcType : uint8_t
 {
     ECPT_Clear,
@@ -57,15 +71,59 @@ struct FCPUTLASInstanceInfo
 {
     std::array<uint32_t, 16> matIdxs;
     uint32_t nodeId;
+    uint32_t rayMask;
+};
+
+enum class ERayQueryType : uint8_t
+{
+    ERQT_ClosestHit,
+    // stops at the first hit found, enough for occlusion and line of sight
+    ERQT_AnyHit,
+};
+
+struct FRayQuery
+{
+    glm::vec3 origin;
+    glm::vec3 direction;
+    float maxDistance = 2000.0f;
+    // nodes whose ray mask shares no bit with it are skipped
+    uint32_t rayMask = ~0u;
 };
 
 struct FCPUBLASContext
 {
     tinybvh::BVH bvh;
+#if CPU_BVH_USE_SOA
+    // shares the nodes and triangles of bvh
+    tinybvh::BVH_SoA bvhSoA;
+#endif
     std::vector<tinybvh::bvhvec4> triangles;
     std::vector<FCPUBLASVertInfo> extinfos;
 };
 
+// TLAS with its instance arrays, double buffered: UpdateBVH rewrites the back one while bake tasks
+// keep tracing the front one they pinned
+struct FCPUTLASSnapshot
+{
+    tinybvh::BVH tlas;
+    std::vector<tinybvh::BLASInstance> instances;
+    std::vector<FCPUTLASInstanceInfo> infos;
+    // node revision each instance was synced from
+    std::vector<uint32_t> revisions;
+    // refits since the last build, the tree degrades a bit every time
+    uint32_t refitCount = 0;
+    // tasks tracing this snapshot
+    mutable std::atomic<int32_t> readers = 0;
+};
+
+// groups requested together, like the groups one moved node overlaps, progress is tracked per region
+struct FBakeRegion
+{
+    uint32_t groupCount = 0;
+    uint32_t finishedCount = 0;
+    std::chrono::high_resolution_clock::time_point startTime;
+};
+
 // 抽象一个CPUBaker，拥有独立的上下文和独立的Task发起机制
 // 由CpuAS来控制
 struct FCPUProbeBaker
@@ -76,19 +134,33 @@ struct FCPUProbeBaker
     std::vector<Assets::VoxelData> voxels;
 
     void Init( float unit_size, glm::vec3 offset );
-    void ProcessCube(int x, int y, int z, ECubeProcType procType);
+    void ProcessCube(const FCPUTLASSnapshot& snapshot, int x, int y, int z, ECubeProcType procType);
+    // pins the current snapshot per packet, a long group never holds a tlas update back
+    void ProcessGroup(const FCPUAccelerationStructure& cpuAS, int x0, int z0, int groupSize, ECubeProcType procType);
     void UploadGPU(Vulkan::DeviceMemory& voxelDeviceMemory);
+    // only the voxels of the given groups, keyed by their first cube
+    void UploadGroups(Vulkan::DeviceMemory& voxelDeviceMemory, const std::unordered_set<glm::ivec3>& groups, int groupSize);
     void ClearAmbientCubes();
 };
 
 struct FCPUPageIndex
 {
     std::vector<Assets::PageIndex> pageIndex;
+    // active voxels of each x/z column, pages only depend on x/z so a group updates them by delta
+    std::vector<uint16_t> columnCounts;
+    std::vector<uint32_t> dirtyPages;
+    std::vector<bool> pageDirtyFlags;
 
     void Init();
     void UpdateData(FCPUProbeBaker& baker);
+    void UpdateGroup(FCPUProbeBaker& baker, int x0, int z0, int groupSize);
+    int GetPageIdx(glm::vec3 worldpos) const;
     Assets::PageIndex& GetPage(glm::vec3 worldpos);
+    // uploads the dirty pages only
     void UploadGPU(Vulkan::DeviceMemory& deviceMemory);
+
+private:
+    void UpdateColumn(FCPUProbeBaker& baker, int x, int z);
 };
 
 class FCPUAccelerationStructure
@@ -96,31 +168,76 @@ class FCPUAccelerationStructure
 public:
     void InitBVH(Assets::Scene& scene);
 
+    // sync the TLAS with the scene nodes, refits when only transforms changed.
+    // deferred to a later call while tasks still trace the back snapshot
     void UpdateBVH(Assets::Scene& scene);
 
-    Assets::RayCastResult RayCastInCPU(glm::vec3 rayOrigin, glm::vec3 rayDir);
+    // pin the current TLAS snapshot, UpdateBVH won't touch it until released
+    const FCPUTLASSnapshot& AcquireSnapshot() const;
+    void ReleaseSnapshot(const FCPUTLASSnapshot& snapshot) const;
+
+    Assets::RayCastResult RayCastInCPU(glm::vec3 rayOrigin, glm::vec3 rayDir) const;
+
+    // thread safe, the whole batch sees the same snapshot. big batches are split over the task workers
+    // and the calling thread helps until all of them are traced
+    void RayQuery(std::span<const FRayQuery> queries, std::span<Assets::RayCastResult> results, ERayQueryType type = ERayQueryType::ERQT_ClosestHit) const;
+
+    // batched closest hit, rays are traversed in packets, hit.inst is the TLAS instance index
+    void TraceRays(std::span<tinybvh::Ray> rays) const;
     
     void AsyncProcessFull(Assets::Scene& scene, Vulkan::DeviceMemory* VoxelGPUMemory, bool Incremental = false);
+    // drop the queued groups and wait for the running ones, other tasks of the pool are left alone
+    void CancelBake();
     void AsyncProcessGroup(int xInMeter, int zInMeter, Assets::Scene& scene, ECubeProcType procType, EBakerType bakerType);
     
     void Tick(Assets::Scene& scene, Vulkan::DeviceMemory* GPUMemory, Vulkan::DeviceMemory* FarGPUMemory, Vulkan::DeviceMemory* PageIndexMemory);
 
-    void RequestUpdate(glm::vec3 worldPos, float radius);
+    // re-voxelize only the groups overlapping the world aabb, returns the region id
+    uint32_t RequestUpdate(glm::vec3 worldMin, glm::vec3 worldMax);
+    uint32_t RequestUpdate(glm::vec3 worldPos, float radius);
+
+    // finished / total groups of the regions still baking
+    void GetBakeProgress(uint32_t& OutFinishedGroups, uint32_t& OutTotalGroups, uint32_t& OutRegionCount) const;
+    float GetLastRegionBakeTime() const { return lastRegionBakeTime; }
 
     void GenShadowMap(Assets::Scene& scene);
 
 private:
+    bool HasInstances() const { return !frontSnapshot.load()->instances.empty(); }
+    void RequestInstanceUpdate(const tinybvh::BLASInstance& instance);
+    void EnqueueGroup(glm::ivec3 group, uint32_t regionId);
+    // called when the task of the group begins, returns the regions waiting for it
+    std::vector<uint32_t> TakePendingGroup(glm::ivec3 group);
+    void FinishGroup(const std::vector<uint32_t>& regions);
+
     std::vector<FCPUBLASContext> bvhBLASContexts;
-    std::vector<tinybvh::BLASInstance> bvhInstanceList;
-    std::vector<FCPUTLASInstanceInfo> bvhTLASContexts;
     std::vector<tinybvh::BVHBase*> bvhBLASList;
+
+    FCPUTLASSnapshot tlasSnapshots[2];
+    std::atomic<const FCPUTLASSnapshot*> frontSnapshot{ &tlasSnapshots[0] };
         
+    // every bake task and fence is attached to it, CancelBake cancels them only
+    std::shared_ptr<TaskCounter> bakeCounter;
     std::vector<uint32_t> lastBatchTasks;
+    // the fence task new groups have to wait for
+    std::vector<uint32_t> batchDependencies;
 
     std::queue<std::tuple<glm::ivec3, ECubeProcType, EBakerType> > needUpdateGroups;
+    // spatial hash of the groups not begun yet, a group is queued once no matter how many regions want it.
+    // the entry lives until the task of the group begins, a worker takes it under the mutex
+    std::unordered_map<glm::ivec3, std::vector<uint32_t>> pendingGroups;
+    std::mutex pendingMutex;
+    // groups dispatched and not completed yet, main thread only
+    std::unordered_set<glm::ivec3> inFlightGroups;
+    // bumped by CancelBake, completions of older tasks are ignored
+    uint32_t bakeGeneration = 0;
+    std::unordered_map<uint32_t, FBakeRegion> bakeRegions;
+    uint32_t nextRegionId = 0;
+    float lastRegionBakeTime = 0;
 
     std::vector<float> shadowMapR32;
-    bool needFlush = false;
+    // groups baked since the last upload
+    std::unordered_set<glm::ivec3> flushGroups;
 
     FCPUProbeBaker probeBaker;
     FCPUPageIndex cpuPageIndex;
@@ -1,5 +1,6 @@
 #include "Model.hpp"
 #include "CornellBox.hpp"
+#include "TransformHierarchy.hpp"
 #include "Utilities/FileHelper.hpp"
 #include "ThirdParty/mikktspace/mikktspace.h"
 
@@ -10,6 +11,8 @@
 #include <glm/gtc/type_ptr.hpp>
 
 #include <tiny_obj_loader.h>
+#include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <filesystem>
 #include <fmt/format.h>
@@ -39,13 +42,14 @@
 #include <fmt/format.h>
 #include <glm/gtx/matrix_decompose.hpp>
 #include <xxhash.h>
+#include <meshoptimizer.h>
 
 #include "Options.hpp"
 #include "Texture.hpp"
 #include "Runtime/Engine.hpp"
 #include "Runtime/NextPhysics.h"
+#include "Runtime/TaskCoordinator.hpp"
 
-#define FLATTEN_VERTICE 0
 #define PROVOKING_VERTICE 1
 
 using namespace glm;
@@ -257,6 +261,7 @@ namespace Assets
                               std::vector<Assets::Model>& models,
                               std::vector<Assets::FMaterial>& materials, std::vector<Assets::LightObject>& lights, std::vector<Assets::AnimationTrack>& tracks)
     {
+        const auto loadStart = std::chrono::high_resolution_clock::now();
         int32_t materialOffset = static_cast<int32_t>(materials.size());
         int32_t modelIdx = static_cast<int32_t>(models.size());
         
@@ -302,6 +307,8 @@ namespace Assets
             }
         }
 
+        const auto parseDone = std::chrono::high_resolution_clock::now();
+
         // delayed texture creation
         textureIdMap.resize(model.images.size(), -1);
         auto lambdaLoadTexture = [&textureIdMap, &model, filepath](int texture, bool srgb)
@@ -354,6 +361,7 @@ namespace Assets
             lambdaLoadTexture(mat.pbrMetallicRoughness.metallicRoughnessTexture.index, false);
             lambdaLoadTexture(mat.normalTexture.index, false);
         }
+        const auto texturesDone = std::chrono::high_resolution_clock::now();
         
         // load all materials
         for (tinygltf::Material& mat : model.materials)
@@ -437,9 +445,16 @@ namespace Assets
             materials.push_back( { mat.name, static_cast<uint32_t>(materials.size()), m } );
         }
 
+        const auto materialsDone = std::chrono::high_resolution_clock::now();
+
         // export whole scene into a big buffer, with vertice indices materials
-        for (tinygltf::Mesh& mesh : model.meshes)
+        // each mesh decodes, welds and builds its tangents (or loads them from the cache) in its own task,
+        // the models are appended in mesh order afterwards so the output does not depend on scheduling
+        std::vector<std::unique_ptr<Model>> meshModels(model.meshes.size());
+        std::vector<std::array<size_t, 3>> meshStats(model.meshes.size());
+        auto processMesh = [&model, &meshModels, &meshStats](size_t meshIdx)
         {
+            tinygltf::Mesh& mesh = model.meshes[meshIdx];
             bool hasTangent = false;
             std::vector<Vertex> vertices;
             std::vector<uint32_t> indices;
@@ -481,7 +496,8 @@ namespace Assets
                 
                 for (size_t i = 0; i < positionAccessor.count; ++i)
                 {
-                    Vertex vertex;
+                    // zeroed, welding compares whole vertices
+                    Vertex vertex{};
                     float* position = reinterpret_cast<float*>(&model.buffers[positionView.buffer].data[positionView.byteOffset + positionAccessor.byteOffset + i *
                         positionStride]);
                     vertex.Position = vec3(
@@ -553,13 +569,50 @@ namespace Assets
                 vertext_offset += static_cast<uint32_t>(positionAccessor.count);
             }
 
-            #if FLATTEN_VERTICE
-                FlattenVertices(vertices, indices);
-            #endif
-
+            const size_t rawCount = vertices.size();
+            PrepareMesh(vertices, indices);
+            meshStats[meshIdx] = {rawCount, vertices.size(), indices.size()};
             
-            models.push_back(Assets::Model(std::move(vertices), std::move(indices), !hasTangent));
+            meshModels[meshIdx].reset(new Model(std::move(vertices), std::move(indices), !hasTangent));
+        };
+
+        std::shared_ptr<TaskCounter> meshCounter = TaskCoordinator::GetInstance()->CreateCounter();
+        for (size_t meshIdx = 1; meshIdx < model.meshes.size(); ++meshIdx)
+        {
+            TaskCoordinator::GetInstance()->AddParralledTask([&processMesh, meshIdx](ResTask& task)
+            {
+                processMesh(meshIdx);
+            }, nullptr, {}, meshCounter);
+        }
+        if (!model.meshes.empty())
+        {
+            processMesh(0);
         }
+        TaskCoordinator::GetInstance()->WaitForCounter(meshCounter);
+
+        size_t rawVertexCount = 0;
+        size_t preparedVertexCount = 0;
+        size_t cornerCount = 0;
+        for (size_t meshIdx = 0; meshIdx < meshModels.size(); ++meshIdx)
+        {
+            // a mesh task that never ran left no model, nodes index models by mesh so it can't be skipped
+            if (!meshModels[meshIdx])
+            {
+                processMesh(meshIdx);
+            }
+            rawVertexCount += meshStats[meshIdx][0];
+            preparedVertexCount += meshStats[meshIdx][1];
+            cornerCount += meshStats[meshIdx][2];
+            models.push_back(std::move(*meshModels[meshIdx]));
+        }
+        meshModels.clear();
+        const auto meshesDone = std::chrono::high_resolution_clock::now();
+
+        constexpr double toMB = 1.0 / (1024.0 * 1024.0);
+        fmt::print("meshes [{}]: {} vertices loaded, {} after {}, {:.1f}MB vs {:.1f}MB flattened\n",
+            std::filesystem::path(filename).filename().string(), rawVertexCount, preparedVertexCount,
+            GetMeshLayout() == EMeshLayout::EML_Flat ? "flattening" : "welding",
+            preparedVertexCount * sizeof(Vertex) * toMB, cornerCount * sizeof(Vertex) * toMB);
 
         // default auto camera
         Camera defaultCam = Model::AutoFocusCamera(cameraInit, models);
@@ -616,6 +669,8 @@ namespace Assets
             // }
         }
 
+        const auto nodesDone = std::chrono::high_resolution_clock::now();
+
         // if no camera, add default
         if (cameraInit.cameras.empty() )
         {
@@ -668,11 +723,7 @@ namespace Assets
                             );
                         }
 
-                        AnimationKey<glm::vec3> Key;
-                        Key.Time = time;
-                        Key.Value = translation;
-
-                        CreateTrack.ScaleChannel.Keys.push_back(Key);
+                        CreateTrack.ScaleChannel.AddKey(time, translation);
                         CreateTrack.Duration_ = max(time, CreateTrack.Duration_);
                     }
                 }
@@ -717,11 +768,7 @@ namespace Assets
                             );
                         }
 
-                        AnimationKey<glm::quat> Key;
-                        Key.Time = time;
-                        Key.Value = rotation;
-                        
-                        CreateTrack.RotationChannel.Keys.push_back(Key);
+                        CreateTrack.RotationChannel.AddKey(time, rotation);
                         CreateTrack.Duration_ = max(time, CreateTrack.Duration_);
                     }
                 }
@@ -765,11 +812,7 @@ namespace Assets
                             );
                         }
 
-                        AnimationKey<glm::vec3> Key;
-                        Key.Time = time;
-                        Key.Value = translation;
-
-                        CreateTrack.TranslationChannel.Keys.push_back(Key);
+                        CreateTrack.TranslationChannel.AddKey(time, translation);
                         CreateTrack.Duration_ = max(time, CreateTrack.Duration_);
                     }
                 }
@@ -781,6 +824,12 @@ namespace Assets
             }
         }
 
+        auto phaseMs = [](auto from, auto to) { return std::chrono::duration<float, std::milli>(to - from).count(); };
+        const auto animationsDone = std::chrono::high_resolution_clock::now();
+        fmt::print("gltf phases [{}]: parse {:.1f}ms, textures {:.1f}ms, materials {:.1f}ms, meshes {:.1f}ms ({} meshes), nodes {:.1f}ms, animations {:.1f}ms\n",
+            filepath.filename().string(), phaseMs(loadStart, parseDone), phaseMs(parseDone, texturesDone), phaseMs(texturesDone, materialsDone),
+            phaseMs(materialsDone, meshesDone), model.meshes.size(), phaseMs(meshesDone, nodesDone), phaseMs(nodesDone, animationsDone));
+
         // if we got camera in the scene
         int i = 0;
         for (tinygltf::Camera& cam : model.cameras)
@@ -803,96 +852,181 @@ namespace Assets
         return true;
     }
 
+    // index of the key starting the segment that contains time, clamped to [0, count - 2]
+    static uint32_t FindKeySegment(const std::vector<float>& times, float time, uint32_t& cursor)
+    {
+        const uint32_t last = static_cast<uint32_t>(times.size()) - 2;
+        uint32_t i = std::min(cursor, last);
+
+        // still in the cached segment, or playback stepped into the next one
+        if (times[i] <= time && time < times[i + 1])
+        {
+            return i;
+        }
+        if (i < last && times[i + 1] <= time && time < times[i + 2])
+        {
+            cursor = i + 1;
+            return cursor;
+        }
+
+        // seek or loop, fall back to a binary search
+        auto it = std::upper_bound(times.begin(), times.end(), time);
+        const uint32_t upper = static_cast<uint32_t>(it - times.begin());
+        cursor = upper == 0 ? 0 : std::min(upper - 1, last);
+        return cursor;
+    }
+
+    template <typename T>
+    static T MixKey(const T& a, const T& b, float t)
+    {
+        return glm::mix(a, b, t);
+    }
+
+    // 四元数用slerp
+    static glm::quat MixKey(const glm::quat& a, const glm::quat& b, float t)
+    {
+        return glm::slerp(a, b, t);
+    }
+
     template <typename T>
     T AnimationChannel<T>::Sample(float time)
     {
-        for ( int i = 0; i < Keys.size() - 1; i++ )
+        if (Times.empty())
         {
-            auto& Key = Keys[i];
-            auto& KeyNext = Keys[i + 1];
-            if (time >= Key.Time && time < KeyNext.Time)
-            {
-                float t = (time - Key.Time) / (KeyNext.Time - Key.Time);
-                return glm::mix(Key.Value, KeyNext.Value, t);
-            }
-
-            if ( i == 0 && time < Key.Time )
-            {
-                return Key.Value;
-            }
+            return T{};
+        }
+        if (Times.size() == 1 || time < Times.front())
+        {
+            return Values.front();
+        }
+        if (time >= Times.back())
+        {
+            return Values.back();
+        }
 
-            if ( i == Keys.size() - 2)
-            {
-                return KeyNext.Value;
-            }
+        const uint32_t i = FindKeySegment(Times, time, Cursor_);
+        const float t = (time - Times[i]) / (Times[i + 1] - Times[i]);
+        return MixKey(Values[i], Values[i + 1], t);
+    }
+    
+    void AnimationTrack::Sample(float time, glm::vec3& translation, glm::quat& rotation, glm::vec3& scaling)
+    {
+        if (!TranslationChannel.Empty())
+        {
+            translation = TranslationChannel.Sample(time);
+        }
+        if (!RotationChannel.Empty())
+        {
+            rotation = RotationChannel.Sample(time);
+        }
+        if (!ScaleChannel.Empty())
+        {
+            scaling = ScaleChannel.Sample(time);
         }
-        return T{};
     }
 
-    // 偏特化T == glm::quat
-    template <>
-    glm::quat AnimationChannel<glm::quat>::Sample(float time)
+    // tracks per worker task
+    static constexpr size_t ANIMATION_TRACKS_PER_TASK = 256;
+
+    void SampleAnimationTracks(const std::vector<AnimationTrack*>& tracks)
     {
-        for ( int i = 0; i < Keys.size() - 1; i++ )
+        auto sampleRange = [&tracks](size_t begin, size_t end)
         {
-            auto& Key = Keys[i];
-            auto& KeyNext = Keys[i + 1];
-            if (time >= Key.Time && time < KeyNext.Time)
+            for (size_t i = begin; i < end; ++i)
             {
-                float t = (time - Key.Time) / (KeyNext.Time - Key.Time);
-                return glm::slerp(Key.Value, KeyNext.Value, t);
+                AnimationTrack& track = *tracks[i];
+                track.Sample(track.Time_, track.SampledTranslation_, track.SampledRotation_, track.SampledScaling_);
             }
+        };
 
-            if ( i == 0 && time < Key.Time )
+        std::shared_ptr<TaskCounter> counter;
+        for (size_t i = ANIMATION_TRACKS_PER_TASK; i < tracks.size(); i += ANIMATION_TRACKS_PER_TASK)
+        {
+            if (!counter)
             {
-                return Key.Value;
+                counter = TaskCoordinator::GetInstance()->CreateCounter();
             }
-
-            if ( i == Keys.size() - 2)
+            const size_t end = std::min(i + ANIMATION_TRACKS_PER_TASK, tracks.size());
+            TaskCoordinator::GetInstance()->AddParralledTask([&sampleRange, i, end](ResTask& task)
             {
-                return KeyNext.Value;
-            }
+                sampleRange(i, end);
+            }, nullptr, {}, counter);
         }
-        return {};
+
+        sampleRange(0, std::min(ANIMATION_TRACKS_PER_TASK, tracks.size()));
+        TaskCoordinator::GetInstance()->WaitForCounter(counter);
     }
-    
-    void AnimationTrack::Sample(float time, glm::vec3& translation, glm::quat& rotation, glm::vec3& scaling)
+
+    static EMeshLayout GMeshLayout = EMeshLayout::EML_Indexed;
+
+    void Model::SetMeshLayout(EMeshLayout layout)
     {
-        if (TranslationChannel.Keys.size() > 0)
-        {
-            translation = TranslationChannel.Sample(time);
-        }
-        if (RotationChannel.Keys.size() > 0)
+        GMeshLayout = layout;
+    }
+
+    EMeshLayout Model::GetMeshLayout()
+    {
+        return GMeshLayout;
+    }
+
+    void Model::PrepareMesh(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+    {
+        if (GMeshLayout == EMeshLayout::EML_Flat)
         {
-            rotation = RotationChannel.Sample(time);
+            FlattenVertices(vertices, indices);
         }
-        if (ScaleChannel.Keys.size() > 0)
+        else
         {
-            scaling = ScaleChannel.Sample(time);
+            OptimizeIndexedMesh(vertices, indices);
         }
     }
 
     void Model::FlattenVertices(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
     {
-        // TODO: change to use povoking vertex later
-        bool doFlatten = true;//(GOption->RendererType == 1 || GOption->RendererType == 2);
+        std::vector<Vertex> vertices_flatten;
+        std::vector<uint32_t> indices_flatten;
+        vertices_flatten.reserve(indices.size());
+        indices_flatten.reserve(indices.size());
 
-        if(doFlatten) {
-            std::vector<Vertex> vertices_flatten;
-            std::vector<uint32_t> indices_flatten;
+        uint32_t idx_counter = 0;
+        for (uint32_t index : indices)
+        {
+            if (index >= vertices.size()) continue; //fix "out of range index" error
 
-            uint32_t idx_counter = 0;
-            for (uint32_t index : indices)
-            {
-                if (index < 0 || index > vertices.size() - 1) continue; //fix "out of range index" error
+            vertices_flatten.push_back(vertices[index]);
+            indices_flatten.push_back(idx_counter++);
+        }
 
-                vertices_flatten.push_back(vertices[index]);
-                indices_flatten.push_back(idx_counter++);
-            }
+        vertices = std::move(vertices_flatten);
+        indices = std::move(indices_flatten);
+    }
 
-            vertices = std::move(vertices_flatten);
-            indices = std::move(indices_flatten);
+    void Model::OptimizeIndexedMesh(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+    {
+        if (vertices.empty() || indices.empty())
+        {
+            return;
         }
+
+        // same guard as the flat path, meshopt asserts on out of range indices
+        indices.erase(std::remove_if(indices.begin(), indices.end(), [count = vertices.size()](uint32_t index) { return index >= count; }), indices.end());
+        indices.resize(indices.size() / 3 * 3);
+
+        // weld binary identical vertices, MaterialIndex is part of the vertex so sections never merge
+        std::vector<uint32_t> remap(vertices.size());
+        const size_t uniqueCount = meshopt_generateVertexRemap(remap.data(), indices.data(), indices.size(), vertices.data(), vertices.size(), sizeof(Vertex));
+
+        std::vector<Vertex> welded(uniqueCount);
+        meshopt_remapVertexBuffer(welded.data(), vertices.data(), vertices.size(), sizeof(Vertex), remap.data());
+        meshopt_remapIndexBuffer(indices.data(), indices.data(), indices.size(), remap.data());
+
+        // triangle order for the post transform cache, then vertex order for fetch locality
+        // the provoking vertex reorder of the visibility buffer runs on top of this in Scene::RebuildMeshBuffer
+        meshopt_optimizeVertexCache(indices.data(), indices.data(), indices.size(), uniqueCount);
+        const size_t fetchCount = meshopt_optimizeVertexFetch(welded.data(), indices.data(), indices.size(), welded.data(), uniqueCount, sizeof(Vertex));
+        welded.resize(fetchCount);
+
+        vertices = std::move(welded);
     }
 
     Camera Model::AutoFocusCamera(Assets::EnvironmentSetting& cameraInit, std::vector<Model>& models)
@@ -934,9 +1068,7 @@ namespace Assets
         std::vector<Vertex> vertices;
         std::vector<uint32_t> indices;
         CornellBox::Create(scale, vertices, indices, materials, lights);
-#if FLATTEN_VERTICE
-        FlattenVertices(vertices, indices);
-#endif
+        PrepareMesh(vertices, indices);
         models.push_back(Model(
             std::move(vertices),
             std::move(indices),
@@ -991,9 +1123,7 @@ namespace Assets
             20, 21, 22, 20, 22, 23
         };
 
-#if FLATTEN_VERTICE
-        FlattenVertices(vertices, indices);
-#endif
+        PrepareMesh(vertices, indices);
 
         return Model( std::move(vertices),std::move(indices), true);
     }
@@ -1072,9 +1202,7 @@ namespace Assets
                 j1 += slices1;
             }
         }
-#if FLATTEN_VERTICE
-        FlattenVertices(vertices, indices);
-#endif
+        PrepareMesh(vertices, indices);
 
         return Model(std::move(vertices), std::move(indices));
     }
@@ -1114,9 +1242,7 @@ namespace Assets
         
         lights.push_back(light);
 
-#if FLATTEN_VERTICE
-        FlattenVertices(vertices, indices);
-#endif
+        PrepareMesh(vertices, indices);
         
         models.push_back( Model(
             std::move(vertices),
@@ -1186,15 +1312,15 @@ namespace Assets
         
         if (actualCompressedSize > 0)
         {
-            std::ofstream cacheFile(cacheFileName, std::ios::binary);
-            if (cacheFile.is_open())
+            // meshes load in parallel and identical meshes share a cache file
+            Utilities::FileHelper::WriteFileAtomically(cacheFileName, [&](std::ostream& cacheFile)
             {
                 size_t originalSize = uncompressedData.size();
                 cacheFile.write(reinterpret_cast<const char*>(&originalSize), sizeof(size_t));
                 cacheFile.write(reinterpret_cast<const char*>(&actualCompressedSize), sizeof(size_t));
                 cacheFile.write(reinterpret_cast<const char*>(compressedData.data()), actualCompressedSize);
-                cacheFile.close();
-            }
+                return bool(cacheFile);
+            });
         }
     }
 
@@ -1229,6 +1355,9 @@ namespace Assets
         }
     }
 
+    // nodes are created on loader threads too
+    static std::atomic<uint32_t> GNodeRevision;
+
     std::shared_ptr<Node> Node::CreateNode(std::string name, glm::vec3 translation, glm::quat rotation, glm::vec3 scale, uint32_t id, uint32_t instanceId, bool replace)
     {
         return std::make_shared<Node>(name, translation, rotation, scale, id, instanceId, replace);
@@ -1249,21 +1378,35 @@ namespace Assets
         scaling_ = scale;
     }
 
-    void Node::RecalcLocalTransform()
+    glm::mat4 Node::LocalTransform() const
     {
-        localTransform_ = glm::translate(glm::mat4(1), translation_) * glm::mat4_cast(rotation_) * glm::scale(glm::mat4(1), scaling_);
+        return glm::translate(glm::mat4(1), translation_) * glm::mat4_cast(rotation_) * glm::scale(glm::mat4(1), scaling_);
+    }
+
+    const glm::mat4& Node::WorldTransform() const
+    {
+        return hierarchy_ ? hierarchy_->World(transformSlot_) : transform_;
+    }
+
+    void Node::BumpRevision()
+    {
+        revision_ = ++GNodeRevision;
     }
 
     void Node::RecalcTransform(bool full)
     {
-        RecalcLocalTransform();
-        if(parent_)
+        if (hierarchy_)
         {
-            transform_ = parent_->transform_ * localTransform_;
+            // children follow in the level pass, full or not
+            hierarchy_->MarkDirty(transformSlot_);
+            return;
         }
-        else
+
+        glm::mat4 transform = parent_ ? parent_->WorldTransform() * LocalTransform() : LocalTransform();
+        if (transform != transform_)
         {
-            transform_ = localTransform_;
+            transform_ = transform;
+            BumpRevision();
         }
 
         // update children
@@ -1276,20 +1419,21 @@ namespace Assets
         }
     }
 
-    bool Node::TickVelocity(glm::mat4& combinedTS)
+    void Node::BindPhysicsBody(JPH::BodyID bodyId)
     {
-        if (!physicsBodyTemp_.IsInvalid())
+        physicsBodyTemp_ = bodyId;
+        // the physics step writes moved bodies back to their nodes, see NextPhysics::SyncActiveBodies
+        if (auto body = NextEngine::GetInstance()->GetPhysicsEngine()->GetBody(bodyId))
         {
-            auto body = NextEngine::GetInstance()->GetPhysicsEngine()->GetBody(physicsBodyTemp_);
-            if (body != nullptr)
-            {
-                SetTranslation(body->position);
-                RecalcTransform(true);
-            }
+            body->nodeInstanceId = instanceId_;
         }
-        
-        combinedTS = prevTransform_ * glm::inverse(transform_);
-        prevTransform_ = transform_;
+    }
+
+    bool Node::TickVelocity(glm::mat4& combinedTS)
+    {
+        const glm::mat4& transform = WorldTransform();
+        combinedTS = prevTransform_ * glm::inverse(transform);
+        prevTransform_ = transform;
 
         glm::vec3 newPos = combinedTS * glm::vec4(0,0,0,1);
         return length2(newPos) > 0.1;
@@ -1305,6 +1449,11 @@ namespace Assets
         parent_ = parent;
         parent_->AddChild( shared_from_this() );
 
+        if (hierarchy_)
+        {
+            // depth and slot order may change
+            hierarchy_->MarkStructureDirty();
+        }
         RecalcTransform();
     }
 
@@ -1321,6 +1470,22 @@ namespace Assets
     void Node::SetMaterial(const std::array<uint32_t, 16>& materials)
     {
         materialIdx_ = materials;
+        BumpRevision();
+    }
+
+    void Node::SetVisible(bool visible)
+    {
+        if (visible_ != visible)
+        {
+            visible_ = visible;
+            BumpRevision();
+        }
+    }
+
+    void Node::SetRayMask(uint32_t mask)
+    {
+        rayMask_ = mask;
+        BumpRevision();
     }
 
     NodeProxy Node::GetNodeProxy() const
@@ -1344,9 +1509,9 @@ namespace Assets
     Node::Node(std::string name, glm::vec3 translation, glm::quat rotation, glm::vec3 scale, uint32_t id, uint32_t instanceId, bool replace):
     name_(name),
     translation_(translation), rotation_(rotation), scaling_(scale), 
+    transform_(1.0f),
     modelId_(id), instanceId_(instanceId), visible_(false)
     {
-        RecalcLocalTransform();
         RecalcTransform();
         if(replace)
         {
@@ -1357,4 +1522,12 @@ namespace Assets
             prevTransform_ = translate(glm::mat4(1), vec3(0,-100,0));
         }
     }
+
+    Node::~Node()
+    {
+        if (hierarchy_)
+        {
+            hierarchy_->Release(transformSlot_);
+        }
+    }
 }
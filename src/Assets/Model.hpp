@@ -91,13 +91,17 @@ namespace Assets
         std::vector<Camera> cameras;
     };
 
+    class FTransformHierarchy;
+
     // node tree to represent the scene
     // but in rendering, it will flatten to renderproxys
+    // once the scene attaches it, the world transform lives in the scene's FTransformHierarchy
     class Node : public std::enable_shared_from_this<Node>
     {
     public:
         static std::shared_ptr<Node> CreateNode(std::string name, glm::vec3 translation, glm::quat rotation, glm::vec3 scale, uint32_t modelId, uint32_t instanceId, bool replace);
         Node(std::string name,  glm::vec3 translation, glm::quat rotation, glm::vec3 scale, uint32_t id, uint32_t instanceId, bool replace);
+        ~Node();
         
         void SetTranslation( glm::vec3 translation );
         void SetRotation( glm::quat rotation );
@@ -107,16 +111,22 @@ namespace Assets
         glm::quat& Rotation() const { return rotation_; }
         glm::vec3& Scale() const { return scaling_; }
 
-        void RecalcLocalTransform();
+        glm::mat4 LocalTransform() const;
+        // attached nodes only mark themselves dirty, the world transform of them and their children
+        // is refreshed by Scene::UpdateTransforms
         void RecalcTransform(bool full = true);
-        const glm::mat4& WorldTransform() const { return transform_; }
+        const glm::mat4& WorldTransform() const;
         uint32_t GetModel() const { return modelId_; }
         const std::string& GetName() const {return name_; }
 
-        void SetVisible(bool visible) { visible_ = visible; }
+        void SetVisible(bool visible);
         bool IsVisible() const { return visible_; }
         bool IsDrawable() const { return modelId_ != -1; }
 
+        // cpu ray queries skip the node unless its mask shares a bit with the query's
+        void SetRayMask(uint32_t mask);
+        uint32_t GetRayMask() const { return rayMask_; }
+
         uint32_t GetInstanceId() const { return instanceId_; }
         bool TickVelocity(glm::mat4& combinedTS);
 
@@ -132,18 +142,28 @@ namespace Assets
         std::array<uint32_t, 16>& Materials() { return materialIdx_; }
         NodeProxy GetNodeProxy() const;
 
-        void BindPhysicsBody(JPH::BodyID bodyId) { physicsBodyTemp_ = bodyId; }
+        // the body drives the translation and rotation of the node from now on
+        void BindPhysicsBody(JPH::BodyID bodyId);
+
+        // changes whenever the world transform, visibility, materials or ray mask change, unique across nodes so a recreated
+        // node never looks like the one it replaced. consumers keep the last seen value
+        uint32_t GetRevision() const { return revision_; }
         
     private:
+        friend class FTransformHierarchy;
+        void BumpRevision();
+
         std::string name_;
 
         mutable glm::vec3 translation_;
         mutable glm::quat rotation_;
         mutable glm::vec3 scaling_;
 
-        glm::mat4 localTransform_;
+        // world transform while not attached to a hierarchy
         glm::mat4 transform_;
         glm::mat4 prevTransform_;
+        FTransformHierarchy* hierarchy_{};
+        uint32_t transformSlot_ = ~0u;
         uint32_t modelId_;
         uint32_t instanceId_;
         bool visible_;
@@ -152,20 +172,23 @@ namespace Assets
         std::set< std::shared_ptr<Node> > children_;
         std::array<uint32_t, 16> materialIdx_;
         JPH::BodyID physicsBodyTemp_;
+        uint32_t revision_{};
+        uint32_t rayMask_ = ~0u;
     };
 
-    template <typename T>
-    struct AnimationKey
-    {
-        float Time;
-        T Value;
-    };
-
+    // keys are stored as separate time and value arrays, the time search only touches the times
     template <typename T>
     struct AnimationChannel
     {
-        std::vector<AnimationKey<T>> Keys;
+        std::vector<float> Times;
+        std::vector<T> Values;
+
+        void AddKey(float time, const T& value) { Times.push_back(time); Values.push_back(value); }
+        bool Empty() const { return Times.empty(); }
         T Sample(float time);
+
+        // segment of the last sample, playback mostly stays in it or moves to the next one
+        uint32_t Cursor_{};
     };
     
     struct AnimationTrack
@@ -177,6 +200,8 @@ namespace Assets
         void Sample(float time, glm::vec3& translation, glm::quat& rotation, glm::vec3& scaling);
         
         std::string NodeName_;
+        // resolved by the scene whenever its node list changes
+        Node* Target_{};
         
         AnimationChannel<glm::vec3> TranslationChannel;
         AnimationChannel<glm::quat> RotationChannel;
@@ -186,12 +211,33 @@ namespace Assets
         float Duration_;
 
         bool Playing_{};
+
+        // written by SampleAnimationTracks, channels without keys leave their value untouched
+        glm::vec3 SampledTranslation_{};
+        glm::quat SampledRotation_{1, 0, 0, 0};
+        glm::vec3 SampledScaling_{1};
     };
+
+    // sample every track at its Time_ into the Sampled* fields, large batches are split across the task pool
+    void SampleAnimationTracks(const std::vector<AnimationTrack*>& tracks);
     
+    enum class EMeshLayout : uint32_t
+    {
+        EML_Indexed,    // duplicates welded, reordered for the vertex cache and vertex fetch
+        EML_Flat,       // one vertex per triangle corner
+    };
+
     class Model final
     {
     public:
+        // picked by the renderer before a scene load, the loader threads read it
+        static void SetMeshLayout(EMeshLayout layout);
+        static EMeshLayout GetMeshLayout();
+
+        // flatten or optimize, depending on the mesh layout
+        static void PrepareMesh(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
         static void FlattenVertices(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+        static void OptimizeIndexedMesh(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
 
         static Camera AutoFocusCamera(Assets::EnvironmentSetting& cameraInit, std::vector<Model>& models);
         
@@ -5,6 +5,7 @@
 #include "Vulkan/BufferUtil.hpp"
 #include "Assets/TextureImage.hpp"
 #include <chrono>
+#include <numeric>
 #include <unordered_set>
 #include <meshoptimizer.h>
 #include <glm/detail/type_half.hpp>
@@ -16,13 +17,19 @@
 
 namespace Assets
 {
+    // node proxies and indirect draws share the capacity, one entry per model section of a drawable node
+    static constexpr uint32_t NODE_PROXY_INITIAL_CAPACITY = 65535;
+    static constexpr uint32_t SCENE_DESCRIPTOR_SET_COUNT = 2;
+
     Scene::Scene(Vulkan::CommandPool& commandPool,
                  bool supportRayTracing)
     {
         int flags = supportRayTracing ? (VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) : VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
         
+        supportRayTracing_ = supportRayTracing;
+
         // host buffers
-        Vulkan::BufferUtil::CreateDeviceBufferLocal(commandPool, "Nodes", flags, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, sizeof(NodeProxy) * 65535, nodeMatrixBuffer_, nodeMatrixBufferMemory_); // support 65535 nodes
+        ResizeNodeBuffers(commandPool, NODE_PROXY_INITIAL_CAPACITY);
         Vulkan::BufferUtil::CreateDeviceBufferLocal(commandPool, "Materials", flags, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,sizeof(Material) * 4096, materialBuffer_, materialBufferMemory_); // support 65535 nodes
 
         Vulkan::BufferUtil::CreateDeviceBufferLocal(commandPool, "VoxelDatas", flags, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,Assets::CUBE_SIZE_XY * Assets::CUBE_SIZE_XY * Assets::CUBE_SIZE_Z * sizeof(Assets::VoxelData), farAmbientCubeBuffer_,
@@ -35,8 +42,6 @@ namespace Assets
         Vulkan::BufferUtil::CreateDeviceBufferLocal( commandPool, "HDRSH", flags, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, sizeof(SphericalHarmonics) * 100, hdrSHBuffer_, hdrSHBufferMemory_ );
         
         // gpu local buffers
-        Vulkan::BufferUtil::CreateDeviceBufferLocal(commandPool, "IndirectDraws", flags | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, sizeof(VkDrawIndexedIndirectCommand) * 65535, indirectDrawBuffer_,
-                                            indirectDrawBufferMemory_); // support 65535 nodes
         Vulkan::BufferUtil::CreateDeviceBufferLocal(commandPool, "AmbientCubes", flags, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,Assets::CUBE_SIZE_XY * Assets::CUBE_SIZE_XY * Assets::CUBE_SIZE_Z * sizeof(Assets::AmbientCube), ambientCubeBuffer_,
                                             ambientCubeBufferMemory_);
 
@@ -92,10 +97,74 @@ namespace Assets
                        std::vector<AnimationTrack>& tracks)
     {
         nodes_ = std::move(nodes);
+        transforms_.Rebuild(nodes_);
+        proxyLayoutDirty_ = true;
         models_ = std::move(models);
         materials_ = std::move(materials);
         lights_ = std::move(lights);
         tracks_ = std::move(tracks);
+
+        nodesByName_.clear();
+        nodesByInstanceId_.clear();
+        nodesByName_.reserve(nodes_.size());
+        nodesByInstanceId_.reserve(nodes_.size());
+        for (auto& node : nodes_)
+        {
+            IndexNode(node.get());
+        }
+        BindTracks();
+    }
+
+    void Scene::AddNode(std::shared_ptr<Node> node)
+    {
+        IndexNode(node.get());
+        nodes_.push_back(std::move(node));
+        transforms_.MarkStructureDirty();
+        proxyLayoutDirty_ = true;
+        BindTracks();
+    }
+
+    void Scene::TruncateNodes(size_t first)
+    {
+        if (first >= nodes_.size())
+        {
+            return;
+        }
+
+        // a kept node with the same key comes first in the list and already owns the entry
+        for (size_t i = first; i < nodes_.size(); ++i)
+        {
+            Node* node = nodes_[i].get();
+            auto byName = nodesByName_.find(node->GetName());
+            if (byName != nodesByName_.end() && byName->second == node)
+            {
+                nodesByName_.erase(byName);
+            }
+            auto byId = nodesByInstanceId_.find(node->GetInstanceId());
+            if (byId != nodesByInstanceId_.end() && byId->second == node)
+            {
+                nodesByInstanceId_.erase(byId);
+            }
+        }
+
+        nodes_.erase(nodes_.begin() + first, nodes_.end());
+        transforms_.MarkStructureDirty();
+        proxyLayoutDirty_ = true;
+        BindTracks();
+    }
+
+    void Scene::IndexNode(Node* node)
+    {
+        nodesByName_.emplace(node->GetName(), node);
+        nodesByInstanceId_.emplace(node->GetInstanceId(), node);
+    }
+
+    void Scene::BindTracks()
+    {
+        for (auto& track : tracks_)
+        {
+            track.Target_ = GetNode(track.NodeName_);
+        }
     }
 
     void Scene::RebuildMeshBuffer(Vulkan::CommandPool& commandPool, bool supportRayTracing)
@@ -194,6 +263,14 @@ namespace Assets
 
             model.FreeMemory();
         }
+
+        // section counts are known now, size the node buffers before the descriptors bind them
+        proxyLayoutDirty_ = true;
+        const uint32_t proxyCount = CountNodeProxies();
+        if (proxyCount > nodeCapacity_)
+        {
+            ResizeNodeBuffers(commandPool, proxyCount);
+        }
         
         int flags = supportRayTracing ? (VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) : VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
         int rtxFlags = supportRayTracing ? VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR : 0;
@@ -225,7 +302,7 @@ namespace Assets
         // no need for shadow map
         //cpuAccelerationStructure_.GenShadowMap(*this);
         
-        uint32_t maxSets = 2;//NextEngine::GetInstance()->GetRenderer().SwapChain().ImageViews().size();
+        uint32_t maxSets = SCENE_DESCRIPTOR_SET_COUNT;//NextEngine::GetInstance()->GetRenderer().SwapChain().ImageViews().size();
 
         sceneBufferDescriptorSetManager_.reset(new Vulkan::DescriptorSetManager(commandPool.Device(), {
                 // all buffer here
@@ -293,6 +370,7 @@ namespace Assets
             DurationMax = glm::max(DurationMax, track.Duration_);
         }
 
+        std::vector<AnimationTrack*> playingTracks;
         for (auto& track : tracks_)
         {
             if (!track.Playing()) continue;
@@ -301,22 +379,31 @@ namespace Assets
             {
                 track.Time_ = 0;
             }
-            Node* node = GetNode(track.NodeName_);
-            if (node)
-            {
-                glm::vec3 translation = node->Translation();
-                glm::quat rotation = node->Rotation();
-                glm::vec3 scaling = node->Scale();
+            if (!track.Target_) continue;
+
+            // channels without keys keep the current value of the node
+            Node* node = track.Target_;
+            track.SampledTranslation_ = node->Translation();
+            track.SampledRotation_ = node->Rotation();
+            track.SampledScaling_ = node->Scale();
+            playingTracks.push_back(&track);
+        }
 
-                track.Sample(track.Time_, translation, rotation, scaling);
+        if (!playingTracks.empty())
+        {
+            SampleAnimationTracks(playingTracks);
+
+            for (AnimationTrack* track : playingTracks)
+            {
+                Node* node = track->Target_;
+                const glm::vec3& translation = track->SampledTranslation_;
+                const glm::quat& rotation = track->SampledRotation_;
 
                 node->SetTranslation(translation);
                 node->SetRotation(rotation);
-                node->SetScale(scaling);
+                node->SetScale(track->SampledScaling_);
                 node->RecalcTransform(true);
 
-                MarkDirty();
-
                 // temporal if camera node, request override
                 if (node->GetName() == "Shot.BlueCar")
                 {
@@ -324,6 +411,17 @@ namespace Assets
                     overrideModelView = glm::lookAtRH(translation, translation + rotation * glm::vec3(0, 0, -1), glm::vec3(0.0f, 1.0f, 0.0f));
                 }
             }
+
+            MarkDirty();
+        }
+
+        UpdateTransforms();
+
+        if (requestedNodeCapacity_ > nodeCapacity_)
+        {
+            // the pipelines bind the node buffers when the swapchain is created, they grow in between.
+            // going through the renderer also delivers a pending headless readback first
+            NextEngine::GetInstance()->GetRenderer().RequestRecreateSwapChain();
         }
 
         if ( NextEngine::GetInstance()->GetTotalFrames() % 10 == 0 )
@@ -332,6 +430,24 @@ namespace Assets
         }
     }
 
+    void Scene::OnSwapChainDeleted(Vulkan::CommandPool& commandPool)
+    {
+        if (requestedNodeCapacity_ > nodeCapacity_)
+        {
+            ResizeNodeBuffers(commandPool, requestedNodeCapacity_);
+            MarkDirty();
+        }
+    }
+
+    bool Scene::UpdateTransforms()
+    {
+        if (transforms_.IsStale(nodes_))
+        {
+            transforms_.Rebuild(nodes_);
+        }
+        return transforms_.Update();
+    }
+
     void Scene::UpdateMaterial()
     {
         if (materials_.empty()) return;
@@ -359,7 +475,9 @@ namespace Assets
         std::memcpy(&gpuDrivenStat_, gpuData, sizeof(GPUDrivenStat));
         std::memcpy(gpuData, &zero, sizeof(GPUDrivenStat)); // reset to zero
         gpuDrivenStatsBuffer_Memory_->Unmap();
-        
+
+        // physics ticks after the scene and moves nodes too
+        UpdateTransforms();
         return UpdateNodesGpuDriven();
     }
 
@@ -470,39 +588,30 @@ namespace Assets
                 sceneDirty_ = false;
                 {
                     PERFORMANCEAPI_INSTRUMENT_COLOR("Scene::PrepareSceneNodes", PERFORMANCEAPI_MAKE_COLOR(255, 200, 200));
-                    nodeProxys.clear();
-                    indirectDrawBatchCount_ = 0;
-                    
-                    for (auto& node : nodes_)
+                    std::vector<uint32_t> dirtyDrawables;
+                    if (proxyLayoutDirty_)
                     {
-                        // record all
-                        if (node->IsDrawable())
+                        RebuildNodeProxyLayout();
+                        dirtyDrawables.resize(proxyNodes_.size());
+                        std::iota(dirtyDrawables.begin(), dirtyDrawables.end(), 0);
+                    }
+                    else
+                    {
+                        for (uint32_t i = 0; i < proxyNodes_.size(); ++i)
                         {
-                            glm::mat4 combined;
-                            if (node->TickVelocity(combined))
-                            {
-                                MarkDirty();
-                            }
-
-                            auto model = GetModel(node->GetModel());
-                            if (model)
+                            // a node that moved last time needs one more write to reset its velocity
+                            if (proxyNodes_[i]->GetRevision() != proxyRevisions_[i] || proxyMoving_[i])
                             {
-                                for ( uint32_t section = 0; section < model->SectionCount(); ++section)
-                                {
-                                    NodeProxy proxy = node->GetNodeProxy();
-                                    proxy.combinedPrevTS = combined;
-                                    proxy.modelId = node->GetModel() * 10 + section;
-                                    proxy.nort = section == 0 ? 0 : 1;
-                                    nodeProxys.push_back(proxy);
-                                    indirectDrawBatchCount_++;
-                                }        
+                                WriteNodeProxies(i);
+                                dirtyDrawables.push_back(i);
                             }
                         }
                     }
-                    
-                    NodeProxy* data = reinterpret_cast<NodeProxy*>(nodeMatrixBufferMemory_->Map(0, sizeof(NodeProxy) * nodeProxys.size()));
-                    std::memcpy(data, nodeProxys.data(), nodeProxys.size() * sizeof(NodeProxy));
-                    nodeMatrixBufferMemory_->Unmap();
+
+                    if (!dirtyDrawables.empty())
+                    {
+                        UploadNodeProxies(dirtyDrawables);
+                    }
                 }
                 return true;
             }
@@ -510,28 +619,170 @@ namespace Assets
         return false;
     }
 
-    Node* Scene::GetNode(std::string name)
+    uint32_t Scene::CountNodeProxies() const
     {
+        uint32_t count = 0;
         for (auto& node : nodes_)
         {
-            if (node->GetName() == name)
+            if (node->IsDrawable())
             {
-                return node.get();
+                if (auto model = GetModel(node->GetModel()))
+                {
+                    count += model->SectionCount();
+                }
+            }
+        }
+        return count;
+    }
+
+    void Scene::ResizeNodeBuffers(Vulkan::CommandPool& commandPool, uint32_t capacity)
+    {
+        uint32_t newCapacity = std::max(nodeCapacity_, NODE_PROXY_INITIAL_CAPACITY);
+        while (newCapacity < capacity)
+        {
+            newCapacity *= 2;
+        }
+
+        int flags = supportRayTracing_ ? (VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT) : VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+        nodeMatrixBuffer_.reset();
+        nodeMatrixBufferMemory_.reset();
+        indirectDrawBuffer_.reset();
+        indirectDrawBufferMemory_.reset();
+
+        Vulkan::BufferUtil::CreateDeviceBufferLocal(commandPool, "Nodes", flags, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, sizeof(NodeProxy) * newCapacity, nodeMatrixBuffer_, nodeMatrixBufferMemory_);
+        Vulkan::BufferUtil::CreateDeviceBufferLocal(commandPool, "IndirectDraws", flags | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, sizeof(VkDrawIndexedIndirectCommand) * newCapacity, indirectDrawBuffer_,
+                                            indirectDrawBufferMemory_);
+
+        if (nodeCapacity_ > 0)
+        {
+            fmt::print("node buffers grow from {} to {} proxies\n", nodeCapacity_, newCapacity);
+        }
+        nodeCapacity_ = newCapacity;
+
+        // the old slots are gone, everything uploads again
+        proxyLayoutDirty_ = true;
+
+        if (sceneBufferDescriptorSetManager_)
+        {
+            auto& descriptorSets = sceneBufferDescriptorSetManager_->DescriptorSets();
+            for (uint32_t i = 0; i != SCENE_DESCRIPTOR_SET_COUNT; ++i)
+            {
+                std::vector<VkWriteDescriptorSet> descriptorWrites =
+                {
+                    descriptorSets.Bind(i, 4, { nodeMatrixBuffer_->Handle(), 0, VK_WHOLE_SIZE}),
+                };
+                descriptorSets.UpdateDescriptors(i, descriptorWrites);
             }
         }
-        return nullptr;
     }
 
-    Node* Scene::GetNodeByInstanceId(uint32_t id)
+    void Scene::RebuildNodeProxyLayout()
     {
+        proxyLayoutDirty_ = false;
+        proxyNodes_.clear();
+        proxyFirstSlots_.clear();
+
+        uint32_t slotCount = 0;
         for (auto& node : nodes_)
         {
-            if (node->GetInstanceId() == id)
+            // record all, invisible nodes keep their slot
+            if (node->IsDrawable())
             {
-                return node.get();
+                auto model = GetModel(node->GetModel());
+                if (model && model->SectionCount() > 0)
+                {
+                    proxyNodes_.push_back(node.get());
+                    proxyFirstSlots_.push_back(slotCount);
+                    slotCount += model->SectionCount();
+                }
             }
         }
-        return nullptr;
+        // sentinel, the slots of drawable i are [proxyFirstSlots_[i], proxyFirstSlots_[i + 1])
+        proxyFirstSlots_.push_back(slotCount);
+
+        nodeProxys.resize(slotCount);
+        proxyRevisions_.resize(proxyNodes_.size());
+        proxyMoving_.resize(proxyNodes_.size());
+        for (uint32_t i = 0; i < proxyNodes_.size(); ++i)
+        {
+            WriteNodeProxies(i);
+        }
+
+        if (slotCount > nodeCapacity_)
+        {
+            // draw what fits this frame, the buffers grow before the next one
+            requestedNodeCapacity_ = slotCount;
+        }
+        indirectDrawBatchCount_ = std::min(slotCount, nodeCapacity_);
+    }
+
+    bool Scene::WriteNodeProxies(uint32_t drawable)
+    {
+        Node* node = proxyNodes_[drawable];
+        glm::mat4 combined;
+        if (node->TickVelocity(combined))
+        {
+            MarkDirty();
+        }
+        // small moves stay under the dirty threshold but still leave a prev transform behind,
+        // the proxy is rewritten until it is identity again
+        const bool moving = combined != glm::mat4(1.0f);
+        proxyMoving_[drawable] = moving ? 1 : 0;
+        proxyRevisions_[drawable] = node->GetRevision();
+
+        NodeProxy proxy = node->GetNodeProxy();
+        proxy.combinedPrevTS = combined;
+        for (uint32_t slot = proxyFirstSlots_[drawable]; slot < proxyFirstSlots_[drawable + 1]; ++slot)
+        {
+            const uint32_t section = slot - proxyFirstSlots_[drawable];
+            proxy.modelId = node->GetModel() * 10 + section;
+            proxy.nort = section == 0 ? 0 : 1;
+            nodeProxys[slot] = proxy;
+        }
+        return moving;
+    }
+
+    void Scene::UploadNodeProxies(const std::vector<uint32_t>& dirtyDrawables)
+    {
+        const uint32_t slotCount = std::min(static_cast<uint32_t>(nodeProxys.size()), nodeCapacity_);
+        if (slotCount == 0)
+        {
+            return;
+        }
+
+        // drawables are in slot order, neighbours merge into one copy
+        NodeProxy* data = reinterpret_cast<NodeProxy*>(nodeMatrixBufferMemory_->Map(0, sizeof(NodeProxy) * slotCount));
+        size_t run = 0;
+        while (run < dirtyDrawables.size())
+        {
+            size_t last = run;
+            while (last + 1 < dirtyDrawables.size() && dirtyDrawables[last + 1] == dirtyDrawables[last] + 1)
+            {
+                last++;
+            }
+
+            const uint32_t begin = proxyFirstSlots_[dirtyDrawables[run]];
+            const uint32_t end = std::min(proxyFirstSlots_[dirtyDrawables[last] + 1], slotCount);
+            if (begin < end)
+            {
+                std::memcpy(data + begin, nodeProxys.data() + begin, (end - begin) * sizeof(NodeProxy));
+            }
+            run = last + 1;
+        }
+        nodeMatrixBufferMemory_->Unmap();
+    }
+
+    Node* Scene::GetNode(const std::string& name) const
+    {
+        auto it = nodesByName_.find(name);
+        return it != nodesByName_.end() ? it->second : nullptr;
+    }
+
+    Node* Scene::GetNodeByInstanceId(uint32_t id) const
+    {
+        auto it = nodesByInstanceId_.find(id);
+        return it != nodesByInstanceId_.end() ? it->second : nullptr;
     }
 
     const Model* Scene::GetModel(uint32_t id) const
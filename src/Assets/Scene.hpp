@@ -3,11 +3,13 @@
 #include "Vulkan/Vulkan.hpp"
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 #include <glm/vec2.hpp>
 
 #include "CPUAccelerationStructure.h"
 #include "Model.hpp"
+#include "TransformHierarchy.hpp"
 
 namespace Vulkan
 {
@@ -49,7 +51,11 @@ namespace Assets
 			bool supportRayTracing);
 		//void RebuildBVH();
 
-		std::vector<std::shared_ptr<Node>>& Nodes() { return nodes_; }
+		// add and remove through AddNode / TruncateNodes so the lookups stay valid
+		const std::vector<std::shared_ptr<Node>>& Nodes() const { return nodes_; }
+		void AddNode(std::shared_ptr<Node> node);
+		// drop every node from index first on, dynamic content is appended after the loaded scene
+		void TruncateNodes(size_t first);
 		const std::vector<Model>& Models() const { return models_; }
 		std::vector<FMaterial>& Materials() { return materials_; }
 		const std::vector<ModelData>& Offsets() const { return offsets_; }
@@ -71,6 +77,7 @@ namespace Assets
 		const uint32_t GetIndicesCount() const {return indicesCount_;}
 		const uint32_t GetVerticeCount() const {return verticeCount_;}
 		const uint32_t GetIndirectDrawBatchCount() const {return indirectDrawBatchCount_;}
+		const uint32_t GetNodeCapacity() const {return nodeCapacity_;}
 
 		const Assets::GPUDrivenStat& GetGpuDrivenStat() const { return gpuDrivenStat_; }
 		
@@ -78,14 +85,19 @@ namespace Assets
 		void SetSelectedId( uint32_t id ) const { selectedId_ = id; }
 
 		void Tick(float DeltaSeconds);
+		// the renderer deleted its swapchain, nothing binds the node buffers until it is created again
+		void OnSwapChainDeleted(Vulkan::CommandPool& commandPool);
+		// flush dirty node transforms, rebuilds the hierarchy first if nodes were added or removed
+		bool UpdateTransforms();
 		void UpdateMaterial();
 		bool UpdateNodes();
 		void UpdateHDRSH();
 		bool UpdateNodesLegacy();
 		bool UpdateNodesGpuDriven();
 
-		Node* GetNode(std::string name);
-		Node* GetNodeByInstanceId(uint32_t id);
+		// the first node in list order wins when names or ids repeat
+		Node* GetNode(const std::string& name) const;
+		Node* GetNodeByInstanceId(uint32_t id) const;
 		const Model* GetModel(uint32_t id) const;
 		const FMaterial* GetMaterial(uint32_t id) const;
 
@@ -126,10 +138,23 @@ namespace Assets
 		}
 		
 	private:
+		void IndexNode(Node* node);
+		void BindTracks();
+
+		uint32_t CountNodeProxies() const;
+		void ResizeNodeBuffers(Vulkan::CommandPool& commandPool, uint32_t capacity);
+		void RebuildNodeProxyLayout();
+		bool WriteNodeProxies(uint32_t drawable);
+		void UploadNodeProxies(const std::vector<uint32_t>& dirtyDrawables);
+
 		std::vector<FMaterial> materials_;
 		std::vector<Material> gpuMaterials_;
 		std::vector<Model> models_;
 		std::vector<std::shared_ptr<Node>> nodes_;
+		// declared after nodes_, so it hands the world transforms back before the nodes die
+		FTransformHierarchy transforms_;
+		std::unordered_map<std::string, Node*> nodesByName_;
+		std::unordered_map<uint32_t, Node*> nodesByInstanceId_;
 		std::vector<LightObject> lights_;
 		std::vector<AnimationTrack> tracks_;
 		std::vector<ModelData> offsets_;
@@ -195,6 +220,19 @@ namespace Assets
 		std::vector<NodeProxy> nodeProxys;
 		std::vector<VkDrawIndexedIndirectCommand> indirectDrawBufferInstanced;
 
+		// stable proxy slots, each drawable node owns one contiguous slot per model section
+		// a slot is rewritten only when its node's revision changes or it moved in the last upload
+		std::vector<Node*> proxyNodes_;
+		std::vector<uint32_t> proxyFirstSlots_;
+		std::vector<uint32_t> proxyRevisions_;
+		std::vector<uint8_t> proxyMoving_;
+		bool proxyLayoutDirty_ = true;
+
+		// node and indirect draw buffers grow on demand, recreated at load or before the next frame
+		uint32_t nodeCapacity_ {};
+		uint32_t requestedNodeCapacity_ {};
+		bool supportRayTracing_ {};
+
 		glm::mat4 overrideModelView;
 		bool requestOverrideModelView = false;
 		
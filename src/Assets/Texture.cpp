@@ -31,119 +31,170 @@ namespace Assets
         std::array<char, 256> outputInfo;
     };
     
-    void PrefilterEnvironmentMapLevel(const float* sourcePixels, int sourceWidth, int sourceHeight,
-                                    float* targetPixels, int targetWidth, int targetHeight, 
-                                    float roughness)
+    // texels per prefilter task, small mips still get split into a few rows
+    static constexpr int PREFILTER_TEXELS_PER_TASK = 4096;
+    // roughness 0 takes the most, 128
+    static constexpr int PREFILTER_MAX_SAMPLES = 128;
+
+    // atan2 with ~2e-6 rad max error, far below a texel of an 8k equirect. branch free, so the
+    // per sample loops below vectorize
+    static inline float FastAtan2(float y, float x)
+    {
+        const float ax = std::abs(x), ay = std::abs(y);
+        const float a = std::min(ax, ay) / std::max(std::max(ax, ay), 1e-30f);
+        const float s = a * a;
+        float r = (((((-0.01172120f * s + 0.05265332f) * s - 0.11643287f) * s + 0.19354346f) * s - 0.33262347f) * s + 0.99997726f) * a;
+        r = ay > ax ? 0.5f * M_NEXT_PI - r : r;
+        r = x < 0.0f ? M_NEXT_PI - r : r;
+        return y < 0.0f ? -r : r;
+    }
+
+    // GGX samples around +z, shared by every texel of one roughness level
+    struct FPrefilterSamples
+    {
+        std::vector<float> localX;
+        std::vector<float> localY;
+        std::vector<float> localZ;
+    };
+
+    static FPrefilterSamples BuildPrefilterSamples(float roughness)
     {
         const int sampleCount = std::max(1, static_cast<int>(128 * (1.0f - roughness) + 64 * roughness));
-        
-        for (int y = 0; y < targetHeight; ++y)
+        const float alpha = roughness * roughness;
+        const float alpha2 = alpha * alpha;
+
+        FPrefilterSamples samples;
+        samples.localX.resize(sampleCount);
+        samples.localY.resize(sampleCount);
+        samples.localZ.resize(sampleCount);
+        for (int i = 0; i < sampleCount; ++i)
+        {
+            // same low discrepancy pattern as before, the cached results stay comparable
+            float xi1 = static_cast<float>(i) / sampleCount;
+            float xi2 = static_cast<float>((i * 17 + 13) % sampleCount) / sampleCount;
+
+            float cosTheta = std::sqrt((1.0f - xi1) / (1.0f + (alpha2 - 1.0f) * xi1));
+            float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+            float phi = 2.0f * M_NEXT_PI * xi2;
+
+            samples.localX[i] = sinTheta * std::cos(phi);
+            samples.localY[i] = sinTheta * std::sin(phi);
+            samples.localZ[i] = cosTheta;
+        }
+        return samples;
+    }
+
+    static void PrefilterEnvironmentMapRows(const float* sourcePixels, int sourceWidth, int sourceHeight,
+                                    float* targetPixels, int targetWidth, int targetHeight,
+                                    const FPrefilterSamples& samples, const float* sinPhis, const float* cosPhis, int y0, int y1)
+    {
+        const int sampleCount = static_cast<int>(samples.localX.size());
+        const float* localX = samples.localX.data();
+        const float* localY = samples.localY.data();
+        const float* localZ = samples.localZ.data();
+        const float invSampleCount = 1.0f / sampleCount;
+        alignas(64) int32_t sampleIndices[PREFILTER_MAX_SAMPLES];
+
+        for (int y = y0; y < y1; ++y)
         {
+            float theta = (y + 0.5f) / targetHeight * M_NEXT_PI;
+            float sinTheta = std::sin(theta);
+            float cosTheta = std::cos(theta);
+
             for (int x = 0; x < targetWidth; ++x)
             {
-                // Convert target pixel to direction
-                float u = (x + 0.5f) / targetWidth;
-                float v = (y + 0.5f) / targetHeight;
-                
-                float theta = v * M_NEXT_PI;
-                float phi = u * 2.0f * M_NEXT_PI;
-                
-                float sinTheta = std::sin(theta);
-                float cosTheta = std::cos(theta);
-                float sinPhi = std::sin(phi);
-                float cosPhi = std::cos(phi);
-                
                 // Main reflection direction
-                float mainDirX = sinTheta * cosPhi;
+                float mainDirX = sinTheta * cosPhis[x];
                 float mainDirY = cosTheta;
-                float mainDirZ = sinTheta * sinPhi;
-                
+                float mainDirZ = sinTheta * sinPhis[x];
+
                 // Build tangent space around main direction
                 float upX = 0.0f, upY = 1.0f, upZ = 0.0f;
                 if (std::abs(mainDirY) > 0.999f)
                 {
                     upX = 1.0f; upY = 0.0f; upZ = 0.0f;
                 }
-                
-                // Tangent vectors
+
                 float tangentX = upY * mainDirZ - upZ * mainDirY;
                 float tangentY = upZ * mainDirX - upX * mainDirZ;
                 float tangentZ = upX * mainDirY - upY * mainDirX;
-                
-                float tangentLen = std::sqrt(tangentX * tangentX + tangentY * tangentY + tangentZ * tangentZ);
-                tangentX /= tangentLen;
-                tangentY /= tangentLen;
-                tangentZ /= tangentLen;
-                
+
+                float invTangentLen = 1.0f / std::sqrt(tangentX * tangentX + tangentY * tangentY + tangentZ * tangentZ);
+                tangentX *= invTangentLen;
+                tangentY *= invTangentLen;
+                tangentZ *= invTangentLen;
+
                 float bitangentX = mainDirY * tangentZ - mainDirZ * tangentY;
                 float bitangentY = mainDirZ * tangentX - mainDirX * tangentZ;
                 float bitangentZ = mainDirX * tangentY - mainDirY * tangentX;
-                
-                float colorR = 0.0f, colorG = 0.0f, colorB = 0.0f;
-                float totalWeight = 0.0f;
-                
-                // Monte Carlo sampling
+
+                // directions to texel indices first, this loop has no gathers and vectorizes
                 for (int i = 0; i < sampleCount; ++i)
                 {
-                    // Generate random numbers (using simple pseudo-random for now)
-                    float xi1 = static_cast<float>(i) / sampleCount;
-                    float xi2 = static_cast<float>((i * 17 + 13) % sampleCount) / sampleCount;
-                    
-                    // Importance sampling for GGX distribution
-                    float alpha = roughness * roughness;
-                    float alpha2 = alpha * alpha;
-                    
-                    float cosTheta = std::sqrt((1.0f - xi1) / (1.0f + (alpha2 - 1.0f) * xi1));
-                    float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
-                    float phi = 2.0f * M_NEXT_PI * xi2;
-                    
-                    // Local sample direction
-                    float localX = sinTheta * std::cos(phi);
-                    float localY = sinTheta * std::sin(phi);
-                    float localZ = cosTheta;
-                    
-                    // Transform to world space
-                    float worldX = localX * tangentX + localY * bitangentX + localZ * mainDirX;
-                    float worldY = localX * tangentY + localY * bitangentY + localZ * mainDirY;
-                    float worldZ = localX * tangentZ + localY * bitangentZ + localZ * mainDirZ;
-                    
-                    // Sample environment map
-                    float sampleTheta = std::acos(std::clamp(worldY, -1.0f, 1.0f));
-                    float samplePhi = std::atan2(worldZ, worldX);
-                    if (samplePhi < 0) samplePhi += 2.0f * M_NEXT_PI;
-                    
-                    float sampleU = samplePhi / (2.0f * M_NEXT_PI);
-                    float sampleV = sampleTheta / M_NEXT_PI;
-                    
-                    int sampleX = static_cast<int>(sampleU * sourceWidth) % sourceWidth;
-                    int sampleY = static_cast<int>(sampleV * sourceHeight) % sourceHeight;
-                    
-                    int sampleIndex = (sampleY * sourceWidth + sampleX) * 4;
-                    
-                    float weight = 1.0f;
-                    colorR += sourcePixels[sampleIndex + 0] * weight;
-                    colorG += sourcePixels[sampleIndex + 1] * weight;
-                    colorB += sourcePixels[sampleIndex + 2] * weight;
-                    totalWeight += weight;
+                    float worldX = localX[i] * tangentX + localY[i] * bitangentX + localZ[i] * mainDirX;
+                    float worldY = localX[i] * tangentY + localY[i] * bitangentY + localZ[i] * mainDirY;
+                    float worldZ = localX[i] * tangentZ + localY[i] * bitangentZ + localZ[i] * mainDirZ;
+
+                    worldY = std::clamp(worldY, -1.0f, 1.0f);
+                    float sampleTheta = FastAtan2(std::sqrt(1.0f - worldY * worldY), worldY);
+                    float samplePhi = FastAtan2(worldZ, worldX);
+                    samplePhi = samplePhi < 0.0f ? samplePhi + 2.0f * M_NEXT_PI : samplePhi;
+
+                    int sampleX = static_cast<int>(samplePhi * (0.5f / M_NEXT_PI) * sourceWidth);
+                    int sampleY = static_cast<int>(sampleTheta * (1.0f / M_NEXT_PI) * sourceHeight);
+                    sampleX = sampleX >= sourceWidth ? sampleX - sourceWidth : sampleX;
+                    sampleY = std::min(sampleY, sourceHeight - 1);
+                    sampleIndices[i] = (sampleY * sourceWidth + sampleX) * 4;
                 }
-                
-                // Normalize and store result
-                if (totalWeight > 0.0f)
+
+                float colorR = 0.0f, colorG = 0.0f, colorB = 0.0f;
+                for (int i = 0; i < sampleCount; ++i)
                 {
-                    colorR /= totalWeight;
-                    colorG /= totalWeight;
-                    colorB /= totalWeight;
+                    const float* sample = sourcePixels + sampleIndices[i];
+                    colorR += sample[0];
+                    colorG += sample[1];
+                    colorB += sample[2];
                 }
-                
+
                 int targetIndex = (y * targetWidth + x) * 4;
-                targetPixels[targetIndex + 0] = colorR;
-                targetPixels[targetIndex + 1] = colorG;
-                targetPixels[targetIndex + 2] = colorB;
+                targetPixels[targetIndex + 0] = colorR * invSampleCount;
+                targetPixels[targetIndex + 1] = colorG * invSampleCount;
+                targetPixels[targetIndex + 2] = colorB * invSampleCount;
                 targetPixels[targetIndex + 3] = 1.0f;
             }
         }
     }
 
+    void PrefilterEnvironmentMapLevel(const float* sourcePixels, int sourceWidth, int sourceHeight,
+                                    float* targetPixels, int targetWidth, int targetHeight, 
+                                    float roughness)
+    {
+        const FPrefilterSamples samples = BuildPrefilterSamples(roughness);
+
+        std::vector<float> sinPhis(targetWidth);
+        std::vector<float> cosPhis(targetWidth);
+        for (int x = 0; x < targetWidth; ++x)
+        {
+            float phi = (x + 0.5f) / targetWidth * 2.0f * M_NEXT_PI;
+            sinPhis[x] = std::sin(phi);
+            cosPhis[x] = std::cos(phi);
+        }
+
+        // rows are independent, split them over the workers and help until all done
+        const int rowsPerTask = std::max(1, PREFILTER_TEXELS_PER_TASK / targetWidth);
+        auto counter = TaskCoordinator::GetInstance()->CreateCounter();
+        for (int y0 = 0; y0 < targetHeight; y0 += rowsPerTask)
+        {
+            const int y1 = std::min(targetHeight, y0 + rowsPerTask);
+            TaskCoordinator::GetInstance()->AddParralledTask([&, y0, y1](ResTask& task)
+            {
+                PrefilterEnvironmentMapRows(sourcePixels, sourceWidth, sourceHeight, targetPixels, targetWidth, targetHeight,
+                    samples, sinPhis.data(), cosPhis.data(), y0, y1);
+            }, nullptr, {}, counter);
+        }
+        TaskCoordinator::GetInstance()->WaitForCounter(counter);
+    }
+
     void PrefilterHDREnvironmentMap(const float* hdrPixels, int width, int height, 
                              std::vector<std::vector<float>>& mipLevels,
                              std::vector<std::pair<int, int>>& mipDimensions)
@@ -176,82 +227,101 @@ namespace Assets
         }
     }
 
+    // per row sums the SH basis needs, theta is constant along a row so band 1 and 2 only depend on
+    // sin / cos phi: sum(c), sum(c cos), sum(c sin), sum(c cos sin), sum(c (cos^2 - sin^2))
+    struct FSHRowSums
+    {
+        double sum[3][5];
+    };
+
     SphericalHarmonics ProjectHDRToSH(const float* hdrPixels, int width, int height)
     {
         SphericalHarmonics result{};
         
-        // Initialize coefficients to zero
-        for (int i = 0; i < 3; ++i)
-            for (int j = 0; j < 9; ++j)
-                result.coefficients[i][j] = 0.0f;
-        
         // SH basis function evaluation constants
         constexpr float SH_C0 = 0.282095f; // 1/(2*sqrt(π))
         constexpr float SH_C1 = 0.488603f; // sqrt(3)/(2*sqrt(π))
         constexpr float SH_C2 = 1.092548f; // sqrt(15)/(2*sqrt(π))
         constexpr float SH_C3 = 0.315392f; // sqrt(5)/(4*sqrt(π))
         constexpr float SH_C4 = 0.546274f; // sqrt(15)/(4*sqrt(π))
-        
-        float weightSum = 0.0f;
-        
-        // For each pixel in the environment map
+
+        std::vector<float> sinPhis(width);
+        std::vector<float> cosPhis(width);
+        for (int x = 0; x < width; ++x)
+        {
+            float phi = (x + 0.5f) / width * 2.0f * M_NEXT_PI;
+            sinPhis[x] = std::sin(phi);
+            cosPhis[x] = std::cos(phi);
+        }
+
+        // one row per slot, reduced in order afterwards so the result does not depend on scheduling
+        std::vector<FSHRowSums> rowSums(height);
+        const int rowsPerTask = std::max(1, PREFILTER_TEXELS_PER_TASK * 16 / width);
+        auto counter = TaskCoordinator::GetInstance()->CreateCounter();
+        for (int y0 = 0; y0 < height; y0 += rowsPerTask)
+        {
+            const int y1 = std::min(height, y0 + rowsPerTask);
+            TaskCoordinator::GetInstance()->AddParralledTask([&, y0, y1](ResTask& task)
+            {
+                for (int y = y0; y < y1; ++y)
+                {
+                    const float* row = hdrPixels + size_t(y) * width * 4;
+                    FSHRowSums& sums = rowSums[y];
+                    for (int c = 0; c < 3; ++c)
+                    {
+                        float s0 = 0.0f, sc = 0.0f, ss = 0.0f, scs = 0.0f, sd = 0.0f;
+                        for (int x = 0; x < width; ++x)
+                        {
+                            const float value = row[x * 4 + c];
+                            const float cosPhi = cosPhis[x], sinPhi = sinPhis[x];
+                            s0 += value;
+                            sc += value * cosPhi;
+                            ss += value * sinPhi;
+                            scs += value * cosPhi * sinPhi;
+                            sd += value * (cosPhi * cosPhi - sinPhi * sinPhi);
+                        }
+                        sums.sum[c][0] = s0;
+                        sums.sum[c][1] = sc;
+                        sums.sum[c][2] = ss;
+                        sums.sum[c][3] = scs;
+                        sums.sum[c][4] = sd;
+                    }
+                }
+            }, nullptr, {}, counter);
+        }
+        TaskCoordinator::GetInstance()->WaitForCounter(counter);
+
+        double coefficients[3][9] = {};
         for (int y = 0; y < height; ++y)
         {
             // Calculate spherical coordinates
             float v = (y + 0.5f) / height;
             float theta = v * M_NEXT_PI;
-            float sinTheta = std::sin(theta);
-            float cosTheta = std::cos(theta);
+            double sinTheta = std::sin(theta);
+            double cosTheta = std::cos(theta);
             
             // Pixel solid angle weight (important for correct integration)
-            float weight = sinTheta * (M_NEXT_PI / height) * (2.0f * M_NEXT_PI / width);
-            
-            for (int x = 0; x < width; ++x)
+            double weight = sinTheta * (M_NEXT_PI / height) * (2.0f * M_NEXT_PI / width);
+
+            for (int c = 0; c < 3; ++c)
             {
-                float u = (x + 0.5f) / width;
-                float phi = u * 2.0f * M_NEXT_PI;
-                float sinPhi = std::sin(phi);
-                float cosPhi = std::cos(phi);
-                
-                // Convert to direction vector
-                float dx = sinTheta * cosPhi;
-                float dy = cosTheta;
-                float dz = sinTheta * sinPhi;
-                
-                // Evaluate SH basis functions
-                float basis[9];
-                // Band 0 (1 coefficient)
-                basis[0] = SH_C0;
-                
-                // Band 1 (3 coefficients)
-                basis[1] = -SH_C1 * dy;
-                basis[2] = SH_C1 * dz;
-                basis[3] = -SH_C1 * dx;
-                
-                // Band 2 (5 coefficients)
-                basis[4] = SH_C2 * dx * dy;
-                basis[5] = -SH_C2 * dy * dz;
-                basis[6] = SH_C3 * (3.0f * dy * dy - 1.0f);
-                basis[7] = -SH_C2 * dx * dz;
-                basis[8] = SH_C4 * (dx * dx - dz * dz);
-                
-                // Get pixel color (RGBA format, we want RGB)
-                int pixelIndex = (y * width + x) * 4;
-                float r = hdrPixels[pixelIndex + 0];
-                float g = hdrPixels[pixelIndex + 1];
-                float b = hdrPixels[pixelIndex + 2];
-                
-                // Project color onto SH basis functions
-                for (int i = 0; i < 9; ++i)
-                {
-                    result.coefficients[0][i] += r * basis[i] * weight;
-                    result.coefficients[1][i] += g * basis[i] * weight;
-                    result.coefficients[2][i] += b * basis[i] * weight;
-                }
-                
-                weightSum += weight;
+                const double* sums = rowSums[y].sum[c];
+                // dx = sinTheta cosPhi, dy = cosTheta, dz = sinTheta sinPhi
+                coefficients[c][0] += weight * SH_C0 * sums[0];
+                coefficients[c][1] += weight * -SH_C1 * cosTheta * sums[0];
+                coefficients[c][2] += weight * SH_C1 * sinTheta * sums[2];
+                coefficients[c][3] += weight * -SH_C1 * sinTheta * sums[1];
+                coefficients[c][4] += weight * SH_C2 * sinTheta * cosTheta * sums[1];
+                coefficients[c][5] += weight * -SH_C2 * sinTheta * cosTheta * sums[2];
+                coefficients[c][6] += weight * SH_C3 * (3.0 * cosTheta * cosTheta - 1.0) * sums[0];
+                coefficients[c][7] += weight * -SH_C2 * sinTheta * sinTheta * sums[3];
+                coefficients[c][8] += weight * SH_C4 * sinTheta * sinTheta * sums[4];
             }
         }
+
+        for (int c = 0; c < 3; ++c)
+            for (int i = 0; i < 9; ++i)
+                result.coefficients[c][i] = static_cast<float>(coefficients[c][i]);
                 
         return result;
     }
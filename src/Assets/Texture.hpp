@@ -21,6 +21,13 @@ namespace Assets
 {
 	class TextureImage;
 
+	// cpu side hdr environment processing, rows run in parallel on the task workers, the caller waits
+	void PrefilterEnvironmentMapLevel(const float* sourcePixels, int sourceWidth, int sourceHeight,
+									float* targetPixels, int targetWidth, int targetHeight, float roughness);
+	void PrefilterHDREnvironmentMap(const float* hdrPixels, int width, int height,
+							 std::vector<std::vector<float>>& mipLevels, std::vector<std::pair<int, int>>& mipDimensions);
+	SphericalHarmonics ProjectHDRToSH(const float* hdrPixels, int width, int height);
+
 	enum class ETextureStatus : uint8
 	{
 		ETS_Loaded,
@@ -0,0 +1,219 @@
+#include "TransformHierarchy.hpp"
+#include "Model.hpp"
+#include "Runtime/TaskCoordinator.hpp"
+
+#include <algorithm>
+#include <atomic>
+
+namespace Assets
+{
+    // slots per worker task, a clean slot costs one byte compare so levels below this run inline
+    static constexpr uint32_t TRANSFORM_TASK_SIZE = 4096;
+
+    FTransformHierarchy::~FTransformHierarchy()
+    {
+        Clear();
+    }
+
+    void FTransformHierarchy::Clear()
+    {
+        Detach();
+        handles_.clear();
+        parents_.clear();
+        locals_.clear();
+        worlds_.clear();
+        dirty_.clear();
+        levelOffsets_.clear();
+        anyDirty_ = false;
+        structureDirty_ = false;
+    }
+
+    void FTransformHierarchy::Detach()
+    {
+        // flush pending changes so detached nodes keep a valid world transform
+        Update();
+        for (uint32_t slot = 0; slot < handles_.size(); ++slot)
+        {
+            if (Node* node = handles_[slot])
+            {
+                node->transform_ = worlds_[slot];
+                node->hierarchy_ = nullptr;
+                node->transformSlot_ = INVALID_SLOT;
+            }
+        }
+    }
+
+    void FTransformHierarchy::Rebuild(const std::vector<std::shared_ptr<Node>>& nodes)
+    {
+        PERFORMANCEAPI_INSTRUMENT_FUNCTION();
+        Clear();
+
+        const uint32_t count = static_cast<uint32_t>(nodes.size());
+
+        // claim the nodes first, a parent outside of the list makes its child a root
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            nodes[i]->hierarchy_ = this;
+            nodes[i]->transformSlot_ = i;
+        }
+
+        std::vector<uint32_t> depths(count);
+        uint32_t maxDepth = 0;
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            uint32_t depth = 0;
+            for (Node* parent = nodes[i]->parent_.get(); parent && parent->hierarchy_ == this; parent = parent->parent_.get())
+            {
+                depth++;
+            }
+            depths[i] = depth;
+            maxDepth = std::max(maxDepth, depth);
+        }
+
+        // counting sort by depth, stable so siblings stay in load order
+        levelOffsets_.assign(maxDepth + 2, 0);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            levelOffsets_[depths[i] + 1]++;
+        }
+        for (uint32_t level = 1; level < levelOffsets_.size(); ++level)
+        {
+            levelOffsets_[level] += levelOffsets_[level - 1];
+        }
+
+        std::vector<uint32_t> cursors(levelOffsets_.begin(), levelOffsets_.end() - 1);
+        std::vector<uint32_t> slots(count);
+        handles_.resize(count);
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            slots[i] = cursors[depths[i]]++;
+            handles_[slots[i]] = nodes[i].get();
+        }
+
+        parents_.resize(count);
+        locals_.resize(count);
+        worlds_.resize(count);
+        for (uint32_t slot = 0; slot < count; ++slot)
+        {
+            Node* node = handles_[slot];
+            Node* parent = node->parent_.get();
+            parents_[slot] = parent && parent->hierarchy_ == this ? slots[parent->transformSlot_] : INVALID_SLOT;
+            locals_[slot] = node->LocalTransform();
+            worlds_[slot] = node->transform_;
+        }
+
+        // the list index is only valid while sorting, switch to the real slots
+        for (uint32_t slot = 0; slot < count; ++slot)
+        {
+            handles_[slot]->transformSlot_ = slot;
+        }
+
+        // the first update validates everything, unchanged worlds don't bump revisions
+        dirty_.assign(count, 1);
+        anyDirty_ = count > 0;
+    }
+
+    bool FTransformHierarchy::IsStale(const std::vector<std::shared_ptr<Node>>& nodes) const
+    {
+        return structureDirty_ || nodes.size() != handles_.size();
+    }
+
+    void FTransformHierarchy::MarkDirty(uint32_t slot)
+    {
+        dirty_[slot] = 1;
+        anyDirty_ = true;
+    }
+
+    void FTransformHierarchy::Release(uint32_t slot)
+    {
+        // children hold their parent, so nothing below a released slot is still alive
+        handles_[slot] = nullptr;
+        dirty_[slot] = 0;
+        structureDirty_ = true;
+    }
+
+    bool FTransformHierarchy::UpdateRange(uint32_t begin, uint32_t end)
+    {
+        bool changed = false;
+        for (uint32_t slot = begin; slot < end; ++slot)
+        {
+            const uint32_t parent = parents_[slot];
+            const bool parentMoved = parent != INVALID_SLOT && dirty_[parent];
+            Node* node = handles_[slot];
+            if (node == nullptr || (!dirty_[slot] && !parentMoved))
+            {
+                continue;
+            }
+
+            if (dirty_[slot])
+            {
+                locals_[slot] = node->LocalTransform();
+            }
+
+            glm::mat4 world = locals_[slot];
+            if (parent != INVALID_SLOT)
+            {
+                world = worlds_[parent] * world;
+            }
+            else if (node->parent_)
+            {
+                world = node->parent_->WorldTransform() * world;
+            }
+
+            // only a changed world moves the children
+            const bool moved = world != worlds_[slot];
+            dirty_[slot] = moved ? 1 : 0;
+            if (moved)
+            {
+                worlds_[slot] = world;
+                node->BumpRevision();
+                changed = true;
+            }
+        }
+        return changed;
+    }
+
+    bool FTransformHierarchy::Update()
+    {
+        if (!anyDirty_)
+        {
+            return false;
+        }
+
+        PERFORMANCEAPI_INSTRUMENT_FUNCTION();
+        std::atomic<bool> changed = false;
+        for (uint32_t level = 0; level + 1 < levelOffsets_.size(); ++level)
+        {
+            const uint32_t begin = levelOffsets_[level];
+            const uint32_t end = levelOffsets_[level + 1];
+
+            std::shared_ptr<TaskCounter> counter;
+            for (uint32_t i = begin + TRANSFORM_TASK_SIZE; i < end; i += TRANSFORM_TASK_SIZE)
+            {
+                if (!counter)
+                {
+                    counter = TaskCoordinator::GetInstance()->CreateCounter();
+                }
+                const uint32_t chunkEnd = std::min(i + TRANSFORM_TASK_SIZE, end);
+                TaskCoordinator::GetInstance()->AddParralledTask([this, &changed, i, chunkEnd](ResTask& task)
+                {
+                    if (UpdateRange(i, chunkEnd))
+                    {
+                        changed = true;
+                    }
+                }, nullptr, {}, counter);
+            }
+
+            if (UpdateRange(begin, std::min(begin + TRANSFORM_TASK_SIZE, end)))
+            {
+                changed = true;
+            }
+            // the next level reads the worlds and flags of this one
+            TaskCoordinator::GetInstance()->WaitForCounter(counter);
+        }
+
+        std::fill(dirty_.begin(), dirty_.end(), uint8_t(0));
+        anyDirty_ = false;
+        return changed;
+    }
+}
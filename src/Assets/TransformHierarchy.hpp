@@ -0,0 +1,59 @@
+#pragma once
+#include "Common/CoreMinimal.hpp"
+#include <glm/mat4x4.hpp>
+#include <memory>
+#include <vector>
+
+namespace Assets
+{
+    class Node;
+
+    // flat transform store of a scene, attached nodes are thin handles to one slot
+    // slots are sorted by depth: parents always come first and each depth is one contiguous range,
+    // so a level only reads worlds of the previous one and can be split across workers
+    class FTransformHierarchy final
+    {
+    public:
+        static constexpr uint32_t INVALID_SLOT = ~0u;
+
+        FTransformHierarchy() = default;
+        ~FTransformHierarchy();
+
+        FTransformHierarchy(const FTransformHierarchy&) = delete;
+        FTransformHierarchy& operator = (const FTransformHierarchy&) = delete;
+
+        // flatten the node trees, nodes that are no longer in the list get their world transform back
+        void Rebuild(const std::vector<std::shared_ptr<Node>>& nodes);
+        void Clear();
+
+        // nodes were added to or removed from the list since the last rebuild
+        bool IsStale(const std::vector<std::shared_ptr<Node>>& nodes) const;
+
+        void MarkDirty(uint32_t slot);
+        void MarkStructureDirty() { structureDirty_ = true; }
+        // called by a dying node
+        void Release(uint32_t slot);
+
+        // recompute dirty slots and everything below them, returns true if any world transform changed
+        bool Update();
+
+        const glm::mat4& World(uint32_t slot) const { return worlds_[slot]; }
+        uint32_t Size() const { return static_cast<uint32_t>(handles_.size()); }
+
+    private:
+        bool UpdateRange(uint32_t begin, uint32_t end);
+        void Detach();
+
+        std::vector<Node*> handles_;
+        std::vector<uint32_t> parents_;
+        std::vector<glm::mat4> locals_;
+        std::vector<glm::mat4> worlds_;
+        // before a level runs: the local transform changed, after: the world transform changed
+        std::vector<uint8_t> dirty_;
+        // level l is [levelOffsets_[l], levelOffsets_[l + 1])
+        std::vector<uint32_t> levelOffsets_;
+
+        bool anyDirty_{};
+        bool structureDirty_{};
+    };
+}
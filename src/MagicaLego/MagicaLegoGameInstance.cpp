@@ -287,7 +287,7 @@ void MagicaLegoGameInstance::OnSceneLoaded()
             glm::vec3 location = glm::vec3((x - 10.25) * 0.96f, 0.0f, (z - 9.5) * 0.96f);
             auto newNode = Assets::Node::CreateNode(NodeName, location, glm::quat(1,0,0,0), glm::vec3(1), modelId, basementInstanceId_, false);
             newNode->SetMaterial( matId );
-            GetEngine().GetScene().Nodes().push_back(newNode);
+            GetEngine().GetScene().AddNode(newNode);
         }
     }
 
@@ -745,7 +745,7 @@ void BuildBox(std::vector<tinybvh::bvhvec4>& triangles, std::vector<VertExtInfo>
 #endif
 void MagicaLegoGameInstance::RebuildScene(std::unordered_map<uint32_t, FPlacedBlock>& Source, uint32_t newhash)
 {
-    GetEngine().GetScene().Nodes().erase(GetEngine().GetScene().Nodes().begin() + instanceCountBeforeDynamics_, GetEngine().GetScene().Nodes().end());
+    GetEngine().GetScene().TruncateNodes(instanceCountBeforeDynamics_);
 
 #if WITH_CPURAYCAST
     GTriangles.clear();
@@ -781,7 +781,7 @@ void MagicaLegoGameInstance::RebuildScene(std::unordered_map<uint32_t, FPlacedBl
                                                                 instanceId, newhash != Block.first);
                 newNode->SetMaterial( {BasicBlock->matType} );
                 newNode->SetVisible(true);
-                GetEngine().GetScene().Nodes().push_back(newNode);
+                GetEngine().GetScene().AddNode(newNode);
 
 #if WITH_CPURAYCAST
                 // add bounds triangles for bvh
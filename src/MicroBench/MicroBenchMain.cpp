@@ -0,0 +1,368 @@
+#include <iostream>
+#include <cxxopts.hpp>
+#include <fmt/format.h>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <glm/gtc/quaternion.hpp>
+#include "Runtime/Engine.hpp"
+#include "Runtime/TaskCoordinator.hpp"
+#include "Assets/Model.hpp"
+#include "Assets/Texture.hpp"
+
+std::unique_ptr<NextGameInstanceBase> CreateGameInstance(Vulkan::WindowConfig& config, Options& options, NextEngine* engine)
+{
+    return std::make_unique<NextGameInstanceVoid>(config, options, engine);
+}
+
+namespace
+{
+    // the task payload before pooling: two std::function and a 1k context, copied by value through the queues
+    struct LegacyResTask
+    {
+        typedef std::function<void (LegacyResTask& task)> TaskFunc;
+
+        uint32_t task_id;
+        uint8_t priority;
+        TaskFunc task_func;
+        TaskFunc complete_func;
+        uint8_t task_context_1k[1024];
+    };
+
+    template <class T>
+    class LegacyQueue
+    {
+    public:
+        void enqueue(T t)
+        {
+            std::lock_guard<std::mutex> lock(m);
+            q.push(t);
+        }
+
+        bool dequeue(T& result)
+        {
+            std::lock_guard<std::mutex> lock(m);
+            if (q.empty())
+            {
+                return false;
+            }
+            result = q.front();
+            q.pop();
+            return true;
+        }
+
+    private:
+        std::queue<T> q;
+        std::mutex m;
+    };
+
+    using BenchClock = std::chrono::high_resolution_clock;
+
+    double ElapsedMs(BenchClock::time_point start)
+    {
+        return std::chrono::duration<double, std::milli>(BenchClock::now() - start).count();
+    }
+
+    // submit -> run on one worker -> complete on the calling thread, same path as the old TaskThread
+    double BenchLegacyTasks(uint32_t taskCount)
+    {
+        LegacyQueue<LegacyResTask> taskQueue;
+        LegacyQueue<LegacyResTask> completeQueue;
+        std::atomic<uint32_t> executed {0};
+        std::atomic<bool> quit {false};
+
+        std::thread worker([&]() {
+            LegacyResTask task;
+            while (!quit.load())
+            {
+                if (taskQueue.dequeue(task))
+                {
+                    task.task_func(task);
+                    completeQueue.enqueue(task);
+                }
+            }
+        });
+
+        uint32_t completed = 0;
+        const auto start = BenchClock::now();
+        for (uint32_t i = 0; i < taskCount; ++i)
+        {
+            LegacyResTask task;
+            task.task_id = i;
+            task.priority = 3;
+            task.task_func = [&executed](LegacyResTask& task) { executed++; };
+            task.complete_func = [&completed](LegacyResTask& task) { completed++; };
+            taskQueue.enqueue(task);
+        }
+
+        LegacyResTask task;
+        while (completed < taskCount)
+        {
+            if (completeQueue.dequeue(task))
+            {
+                task.complete_func(task);
+            }
+        }
+        double elapsed = ElapsedMs(start);
+
+        quit = true;
+        worker.join();
+        return elapsed;
+    }
+
+    double BenchPooledTasks(uint32_t taskCount)
+    {
+        TaskCoordinator* coordinator = TaskCoordinator::GetInstance();
+        std::atomic<uint32_t> executed {0};
+        uint32_t completed = 0;
+
+        const auto start = BenchClock::now();
+        for (uint32_t i = 0; i < taskCount; ++i)
+        {
+            coordinator->AddParralledTask([&executed](ResTask& task) { executed++; }, [&completed](ResTask& task) { completed++; });
+        }
+
+        while (completed < taskCount)
+        {
+            coordinator->Tick();
+        }
+        return ElapsedMs(start);
+    }
+
+    void BenchTaskCoordinator(uint32_t taskCount, uint32_t rounds)
+    {
+        fmt::print("task submit-to-complete, {} tasks x {} rounds\n", taskCount, rounds);
+
+        // warm up the pools
+        BenchPooledTasks(taskCount);
+
+        double legacy = 0.0;
+        double pooled = 0.0;
+        for (uint32_t r = 0; r < rounds; ++r)
+        {
+            legacy += BenchLegacyTasks(taskCount);
+            pooled += BenchPooledTasks(taskCount);
+        }
+
+        double legacyNs = legacy * 1e6 / (double(taskCount) * rounds);
+        double pooledNs = pooled * 1e6 / (double(taskCount) * rounds);
+        fmt::print("  legacy (std::function + 1k copy): {:8.1f} ns/task\n", legacyNs);
+        fmt::print("  pooled (inline func + handle)   : {:8.1f} ns/task\n", pooledNs);
+        fmt::print("  speedup                         : {:8.2f}x\n", legacyNs / pooledNs);
+    }
+
+    // synthetic sky: bright band near the top and a smooth gradient, only the cost matters here
+    std::vector<float> MakeBenchHDR(int width, int height)
+    {
+        std::vector<float> pixels(size_t(width) * height * 4);
+        for (int y = 0; y < height; ++y)
+        {
+            for (int x = 0; x < width; ++x)
+            {
+                float* pixel = &pixels[(size_t(y) * width + x) * 4];
+                const float sky = y < height / 4 ? 8.0f : 0.5f;
+                pixel[0] = sky * (1.0f + 0.5f * std::sin(x * 0.01f));
+                pixel[1] = sky * (1.0f + 0.5f * std::sin(x * 0.01f + 1.0f));
+                pixel[2] = sky * (1.0f + 0.5f * std::sin(y * 0.02f));
+                pixel[3] = 1.0f;
+            }
+        }
+        return pixels;
+    }
+
+    void BenchHDRPrefilter(int width, uint32_t rounds)
+    {
+        constexpr int MAX_MIP_LEVELS = 8;
+        const int height = width / 2;
+        fmt::print("hdr prefilter, {}x{} x {} rounds\n", width, height, rounds);
+        std::vector<float> pixels = MakeBenchHDR(width, height);
+
+        double shMs = 0.0;
+        for (uint32_t r = 0; r < rounds; ++r)
+        {
+            const auto start = BenchClock::now();
+            Assets::ProjectHDRToSH(pixels.data(), width, height);
+            shMs += ElapsedMs(start);
+        }
+        fmt::print("  sh projection: {:8.2f} ms\n", shMs / rounds);
+
+        // same chain as PrefilterHDREnvironmentMap, timed per mip
+        int mipWidth = width / 2;
+        int mipHeight = height / 2;
+        for (int mipLevel = 1; mipLevel < MAX_MIP_LEVELS && mipWidth >= 4 && mipHeight >= 4; ++mipLevel)
+        {
+            std::vector<float> target(size_t(mipWidth) * mipHeight * 4);
+            const float roughness = static_cast<float>(mipLevel) / (MAX_MIP_LEVELS - 1);
+            double mipMs = 0.0;
+            for (uint32_t r = 0; r < rounds; ++r)
+            {
+                const auto start = BenchClock::now();
+                Assets::PrefilterEnvironmentMapLevel(pixels.data(), width, height, target.data(), mipWidth, mipHeight, roughness);
+                mipMs += ElapsedMs(start);
+            }
+            fmt::print("  mip {} {:5}x{:<5}: {:8.2f} ms\n", mipLevel, mipWidth, mipHeight, mipMs / rounds);
+            mipWidth /= 2;
+            mipHeight /= 2;
+        }
+    }
+
+    // the sampler before cursors: linear search from the first key on every call
+    template <typename T, typename Mix>
+    T LegacySampleChannel(const Assets::AnimationChannel<T>& channel, float time, Mix mix)
+    {
+        for (size_t i = 0; i + 1 < channel.Times.size(); i++)
+        {
+            if (time >= channel.Times[i] && time < channel.Times[i + 1])
+            {
+                float t = (time - channel.Times[i]) / (channel.Times[i + 1] - channel.Times[i]);
+                return mix(channel.Values[i], channel.Values[i + 1], t);
+            }
+            if (i == 0 && time < channel.Times[i])
+            {
+                return channel.Values[i];
+            }
+            if (i + 2 == channel.Times.size())
+            {
+                return channel.Values[i + 1];
+            }
+        }
+        return T{};
+    }
+
+    std::vector<Assets::AnimationTrack> MakeBenchTracks(uint32_t trackCount, uint32_t keyCount)
+    {
+        constexpr float KEY_INTERVAL = 1.0f / 30.0f;
+        std::vector<Assets::AnimationTrack> tracks(trackCount);
+        for (uint32_t t = 0; t < trackCount; ++t)
+        {
+            auto& track = tracks[t];
+            track.Time_ = 0;
+            track.Duration_ = (keyCount - 1) * KEY_INTERVAL;
+            for (uint32_t k = 0; k < keyCount; ++k)
+            {
+                const float time = k * KEY_INTERVAL;
+                const float phase = t * 0.1f + time;
+                track.TranslationChannel.AddKey(time, glm::vec3(std::sin(phase), std::cos(phase), phase));
+                track.RotationChannel.AddKey(time, glm::angleAxis(phase, glm::vec3(0, 1, 0)));
+                track.ScaleChannel.AddKey(time, glm::vec3(1.0f + 0.1f * std::sin(phase)));
+            }
+            track.Play();
+        }
+        return tracks;
+    }
+
+    void BenchAnimationSampling(uint32_t trackCount, uint32_t keyCount, uint32_t frames)
+    {
+        constexpr float FRAME_TIME = 1.0f / 60.0f;
+        fmt::print("animation sampling, {} tracks x {} keys, {} frames\n", trackCount, keyCount, frames);
+        std::vector<Assets::AnimationTrack> tracks = MakeBenchTracks(trackCount, keyCount);
+        std::vector<Assets::AnimationTrack*> playing;
+        for (auto& track : tracks)
+        {
+            playing.push_back(&track);
+        }
+
+        // start mid-clip so the linear search is not flattered by the first keys
+        const float startTime = tracks.empty() ? 0.0f : tracks[0].Duration_ * 0.5f;
+        auto mixVec = [](const glm::vec3& a, const glm::vec3& b, float t) { return glm::mix(a, b, t); };
+        auto mixQuat = [](const glm::quat& a, const glm::quat& b, float t) { return glm::slerp(a, b, t); };
+
+        double legacyMs = 0.0;
+        float checksum = 0.0f;
+        for (uint32_t f = 0; f < frames; ++f)
+        {
+            const float time = startTime + f * FRAME_TIME;
+            const auto start = BenchClock::now();
+            for (auto& track : tracks)
+            {
+                glm::vec3 translation = LegacySampleChannel(track.TranslationChannel, time, mixVec);
+                glm::quat rotation = LegacySampleChannel(track.RotationChannel, time, mixQuat);
+                glm::vec3 scaling = LegacySampleChannel(track.ScaleChannel, time, mixVec);
+                checksum += translation.x + rotation.w + scaling.x;
+            }
+            legacyMs += ElapsedMs(start);
+        }
+
+        double cursorMs = 0.0;
+        for (uint32_t f = 0; f < frames; ++f)
+        {
+            const float time = startTime + f * FRAME_TIME;
+            const auto start = BenchClock::now();
+            for (auto& track : tracks)
+            {
+                track.Sample(time, track.SampledTranslation_, track.SampledRotation_, track.SampledScaling_);
+            }
+            cursorMs += ElapsedMs(start);
+        }
+
+        double batchedMs = 0.0;
+        for (uint32_t f = 0; f < frames; ++f)
+        {
+            for (auto& track : tracks)
+            {
+                track.Time_ = startTime + f * FRAME_TIME;
+            }
+            const auto start = BenchClock::now();
+            Assets::SampleAnimationTracks(playing);
+            batchedMs += ElapsedMs(start);
+        }
+
+        fmt::print("  linear search    : {:8.3f} ms/frame (checksum {:.1f})\n", legacyMs / frames, checksum);
+        fmt::print("  cursor           : {:8.3f} ms/frame\n", cursorMs / frames);
+        fmt::print("  cursor + batched : {:8.3f} ms/frame\n", batchedMs / frames);
+    }
+}
+
+int main(int argc, const char* argv[]) noexcept
+{
+    try
+    {
+        std::string Bench;
+        uint32_t Count;
+        uint32_t Rounds;
+        int HDRWidth;
+        uint32_t Tracks;
+        uint32_t Keys;
+
+        cxxopts::Options options("options", "");
+        options.add_options()
+            ("bench", "which benchmark to run: all, task, prefilter, animation.", cxxopts::value<std::string>(Bench)->default_value("all"))
+            ("count", "work items per round.", cxxopts::value<uint32_t>(Count)->default_value("100000"))
+            ("rounds", "rounds to average.", cxxopts::value<uint32_t>(Rounds)->default_value("5"))
+            ("hdr-width", "width of the synthetic equirect hdr.", cxxopts::value<int>(HDRWidth)->default_value("4096"))
+            ("tracks", "animation tracks to sample.", cxxopts::value<uint32_t>(Tracks)->default_value("10000"))
+            ("keys", "keys per animation channel.", cxxopts::value<uint32_t>(Keys)->default_value("1000"))
+
+            ("h,help", "Print usage");
+
+        auto result = options.parse(argc, argv);
+        if (result.count("help"))
+        {
+            std::cout << options.help() << std::endl;
+            exit(0);
+        }
+
+        if (Bench == "all" || Bench == "task")
+        {
+            BenchTaskCoordinator(Count, Rounds);
+        }
+
+        if (Bench == "all" || Bench == "prefilter")
+        {
+            BenchHDRPrefilter(HDRWidth, Rounds);
+        }
+
+        if (Bench == "all" || Bench == "animation")
+        {
+            BenchAnimationSampling(Tracks, Keys, Rounds * 20);
+        }
+
+        return EXIT_SUCCESS;
+    }
+    catch (const std::exception& e)
+    {
+        std::cerr << e.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_FAILURE;
+}
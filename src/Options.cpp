@@ -13,6 +13,7 @@ Options::Options(const int argc, const char* argv[])
 		("max-bounces", "The maximum bounces per ray.", cxxopts::value<uint32_t>(MaxBounces)->default_value("10"))
 		("temporal", "The number of temporal frames.", cxxopts::value<uint32_t>(Temporal)->default_value("16"))
 		("nodenoiser", "Not Use Denoiser.", cxxopts::value<bool>(NoDenoiser)->default_value("true"))
+		("cpudenoiser", "Run OIDN on the cpu device even if the gpu supports it.", cxxopts::value<bool>(CpuDenoiser)->default_value("false"))
 		("adaptivesample", "use adaptive sample to improve render quality.", cxxopts::value<bool>(AdaptiveSample)->default_value("false"))
 
 		("load-scene", "The scene to load. absolute path or relative path to project root.", cxxopts::value<std::string>(SceneName)->default_value(""))
@@ -24,6 +25,8 @@ Options::Options(const int argc, const char* argv[])
 		("height", "The framebuffer height.", cxxopts::value<uint32_t>(Height)->default_value("1080"))
 		("present-mode", "The present mode (0 = Immediate, 1 = MailBox, 2 = FIFO, 3 = FIFORelaxed).", cxxopts::value<uint32_t>(PresentMode)->default_value("3"))
 		("fullscreen", "Toggle fullscreen vs windowed (default: windowed).", cxxopts::value<bool>(Fullscreen)->default_value("false"))
+		("headless", "Render offscreen without window and swap chain, for batch renders and ci perf runs.", cxxopts::value<bool>(Headless)->default_value("false"))
+		("headless-dump", "Save every Nth headless frame as headless_<frame>.jpg, 0 = keep frames in memory only.", cxxopts::value<uint32_t>(HeadlessDump)->default_value("0"))
 
 		("savefile", "Save screenshot every benchmark finish.", cxxopts::value<bool>(SaveFile)->default_value("false"))
 		("renderdoc", "Attach renderdoc if avaliable.", cxxopts::value<bool>(RenderDoc)->default_value("false"))
@@ -25,6 +25,7 @@ public:
 	bool SaveFile{};
 	bool RenderDoc{};
 	bool NoDenoiser{};
+	bool CpuDenoiser{};
 	bool ForceSDR{};
 	bool ReferenceMode{};
 	uint32_t SuperResolution{};
@@ -53,6 +54,8 @@ public:
 	uint32_t Height{};
 	uint32_t PresentMode{};
 	bool Fullscreen{};
+	bool Headless{};
+	uint32_t HeadlessDump{};
 };
 
 extern ENGINE_API Options* GOption;
\ No newline at end of file
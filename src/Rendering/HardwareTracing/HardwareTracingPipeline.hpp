@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Vulkan/Vulkan.hpp"
+#include "Vulkan/PipelineCache.hpp"
 #include "Vulkan/ImageView.hpp"
 #include <memory>
 #include <vector>
@@ -51,7 +52,7 @@ namespace Vulkan::HybridDeferred
 	private:
 		const SwapChain& swapChain_;
 		
-		VULKAN_HANDLE(VkPipeline, pipeline_)
+		VULKAN_ASYNC_PIPELINE(pipeline_)
 
 		std::unique_ptr<Vulkan::DescriptorSetManager> descriptorSetManager_;
 		std::unique_ptr<Vulkan::PipelineLayout> pipelineLayout_;
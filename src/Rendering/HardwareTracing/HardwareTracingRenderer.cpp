@@ -57,6 +57,13 @@ namespace Vulkan::HybridDeferred
         rtPingPong3.reset();
     }
 
+    bool HardwareTracingRenderer::IsReady() const
+    {
+        return deferredShadingPipeline_ && deferredShadingPipeline_->IsReady() &&
+            accumulatePipeline_->IsReady() && accumulatePipelineSpec_->IsReady() && accumulatePipelineAlbedo_->IsReady() &&
+            composePipeline_->IsReady();
+    }
+
     void HardwareTracingRenderer::Render(VkCommandBuffer commandBuffer, uint32_t imageIndex)
     {
         baseRender_.InitializeBarriers(commandBuffer);
@@ -0,0 +1,240 @@
+#include "OidnDenoiser.hpp"
+
+#if WITH_OIDN
+#include "Options.hpp"
+#include "Vulkan/Buffer.hpp"
+#include "Vulkan/Device.hpp"
+#include "Vulkan/DeviceMemory.hpp"
+#include "Vulkan/Image.hpp"
+#include "Vulkan/RenderImage.hpp"
+#include "Runtime/TaskCoordinator.hpp"
+
+#include <cstring>
+#include <fmt/format.h>
+
+namespace Vulkan::RayTracing
+{
+    namespace
+    {
+#if WIN32 && !defined(__MINGW32__)
+        constexpr oidn::ExternalMemoryTypeFlag EXTERNAL_MEMORY_TYPE = oidn::ExternalMemoryTypeFlag::OpaqueWin32;
+#else
+        constexpr oidn::ExternalMemoryTypeFlag EXTERNAL_MEMORY_TYPE = oidn::ExternalMemoryTypeFlag::OpaqueFD;
+#endif
+        // RGBA16F, oidn reads the first three halves of each pixel
+        constexpr size_t PIXEL_SIZE = 4 * 2;
+
+        VkBufferImageCopy MakeCopyRegion(VkExtent2D extent)
+        {
+            VkBufferImageCopy region{};
+            region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+            region.imageExtent = {extent.width, extent.height, 1};
+            return region;
+        }
+    }
+
+    OidnDenoiser::OidnDenoiser(const Device& device) : device_(device), filterCounter_(std::make_shared<TaskCounter>())
+    {
+        if (!GOption->CpuDenoiser)
+        {
+            // the oidn device running on the same gpu as vulkan
+            VkPhysicalDeviceIDProperties idProperties{};
+            idProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES;
+
+            VkPhysicalDeviceProperties2 properties{};
+            properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+            properties.pNext = &idProperties;
+            vkGetPhysicalDeviceProperties2(device_.PhysicalDevice(), &properties);
+
+            oidn::UUID uuid;
+            std::memcpy(uuid.bytes, idProperties.deviceUUID, sizeof(uuid.bytes));
+
+            oidnDevice_ = oidn::newDevice(uuid);
+            if (oidnDevice_)
+            {
+                oidnDevice_.commit();
+                const bool shareable = static_cast<bool>(EXTERNAL_MEMORY_TYPE & oidnDevice_.get<oidn::ExternalMemoryTypeFlags>("externalMemoryTypes"));
+                if (!CheckError("commit gpu device") || !shareable)
+                {
+                    oidnDevice_ = oidn::DeviceRef();
+                }
+            }
+        }
+
+        gpuDevice_ = static_cast<bool>(oidnDevice_);
+        if (!gpuDevice_)
+        {
+            oidnDevice_ = oidn::newDevice(oidn::DeviceType::CPU);
+            oidnDevice_.commit();
+            CheckError("commit cpu device");
+        }
+        fmt::print("- oidn {} device\n", gpuDevice_ ? "gpu" : "cpu");
+
+        VkEventCreateInfo eventInfo{};
+        eventInfo.sType = VK_STRUCTURE_TYPE_EVENT_CREATE_INFO;
+        Check(vkCreateEvent(device_.Handle(), &eventInfo, nullptr, &copied_), "create oidn event");
+    }
+
+    OidnDenoiser::~OidnDenoiser()
+    {
+        ReleaseResources();
+        vkDestroyEvent(device_.Handle(), copied_, nullptr);
+        oidnDevice_ = oidn::DeviceRef();
+    }
+
+    void OidnDenoiser::CreateResources(VkExtent2D extent)
+    {
+        ReleaseResources();
+        extent_ = extent;
+
+        const size_t size = static_cast<size_t>(extent.width) * extent.height * PIXEL_SIZE;
+        for (uint32_t i = 0; i < EB_Count; ++i)
+        {
+            buffers_[i].reset(new Buffer(device_, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, gpuDevice_));
+            if (gpuDevice_)
+            {
+                memories_[i].reset(new DeviceMemory(buffers_[i]->AllocateMemory(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)));
+                oidnBuffers_[i] = oidnDevice_.newBuffer(EXTERNAL_MEMORY_TYPE, memories_[i]->GetExternalHandle(),
+#if WIN32 && !defined(__MINGW32__)
+                                                        nullptr,
+#endif
+                                                        size);
+            }
+            else
+            {
+                // mapped for the lifetime of the buffers, the cpu device filters in place
+                memories_[i].reset(new DeviceMemory(buffers_[i]->AllocateMemory(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)));
+                oidnBuffers_[i] = oidnDevice_.newBuffer(memories_[i]->Map(0, size), size);
+            }
+        }
+
+        result_.reset(new RenderImage(device_, extent, VK_FORMAT_R16G16B16A16_SFLOAT, VK_IMAGE_TILING_OPTIMAL,
+                                      VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, false, "oidnResult"));
+
+        const size_t rowStride = PIXEL_SIZE * extent.width;
+        filter_ = oidnDevice_.newFilter("RT"); // generic ray tracing filter
+        filter_.setImage("color", oidnBuffers_[EB_Color], oidn::Format::Half3, extent.width, extent.height, 0, PIXEL_SIZE, rowStride); // demodulated diffuse
+        filter_.setImage("albedo", oidnBuffers_[EB_Albedo], oidn::Format::Half3, extent.width, extent.height, 0, PIXEL_SIZE, rowStride); // aux
+        filter_.setImage("normal", oidnBuffers_[EB_Normal], oidn::Format::Half3, extent.width, extent.height, 0, PIXEL_SIZE, rowStride); // aux
+        filter_.setImage("output", oidnBuffers_[EB_Output], oidn::Format::Half3, extent.width, extent.height, 0, PIXEL_SIZE, rowStride);
+        filter_.set("hdr", true);
+        filter_.set("quality", oidn::Quality::Fast);
+        filter_.set("cleanAux", true);
+        filter_.commit();
+        CheckError("commit filter");
+
+        vkResetEvent(device_.Handle(), copied_);
+    }
+
+    void OidnDenoiser::ReleaseResources()
+    {
+        WaitForFilter();
+        state_ = EState::Idle;
+        hasResult_ = false;
+
+        filter_ = oidn::FilterRef();
+        for (uint32_t i = 0; i < EB_Count; ++i)
+        {
+            oidnBuffers_[i] = oidn::BufferRef();
+            if (memories_[i] && !gpuDevice_)
+            {
+                memories_[i]->Unmap();
+            }
+            buffers_[i].reset();
+            memories_[i].reset();
+        }
+        result_.reset();
+    }
+
+    bool OidnDenoiser::Record(VkCommandBuffer commandBuffer, const RenderImage& color, const RenderImage& albedo, const RenderImage& normal, const RenderImage& target)
+    {
+        if (!filter_)
+        {
+            return false;
+        }
+
+        const VkBufferImageCopy region = MakeCopyRegion(extent_);
+
+        // pick up a finished filter, the output buffer is free again once this copy ran
+        if (state_ == EState::Ready)
+        {
+            result_->InsertBarrier(commandBuffer, 0, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
+            vkCmdCopyBufferToImage(commandBuffer, buffers_[EB_Output]->Handle(), result_->GetImage().Handle(), VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+            result_->InsertBarrier(commandBuffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_GENERAL);
+            hasResult_ = true;
+            state_ = EState::Idle;
+        }
+
+        // hand this frame to the worker
+        if (state_ == EState::Idle)
+        {
+            const RenderImage* inputs[] = {&color, &albedo, &normal};
+            for (uint32_t i = 0; i < EB_Output; ++i)
+            {
+                inputs[i]->InsertBarrier(commandBuffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL);
+                vkCmdCopyImageToBuffer(commandBuffer, inputs[i]->GetImage().Handle(), VK_IMAGE_LAYOUT_GENERAL, buffers_[i]->Handle(), 1, &region);
+            }
+
+            VkMemoryBarrier hostBarrier{};
+            hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+            hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT | VK_ACCESS_HOST_WRITE_BIT;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
+            vkCmdSetEvent(commandBuffer, copied_, VK_PIPELINE_STAGE_TRANSFER_BIT);
+
+            state_ = EState::Copying;
+        }
+
+        if (!hasResult_)
+        {
+            return false;
+        }
+
+        target.InsertBarrier(commandBuffer, VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_READ_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL);
+        VkImageCopy copyRegion{};
+        copyRegion.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        copyRegion.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        copyRegion.extent = {extent_.width, extent_.height, 1};
+        vkCmdCopyImage(commandBuffer, result_->GetImage().Handle(), VK_IMAGE_LAYOUT_GENERAL, target.GetImage().Handle(), VK_IMAGE_LAYOUT_GENERAL, 1, &copyRegion);
+        target.InsertBarrier(commandBuffer, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT, VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL);
+        return true;
+    }
+
+    void OidnDenoiser::Tick()
+    {
+        // the frame may still be queued, oidn can't wait on vulkan. check the event set behind the copies here
+        // and look again next frame, the filter task itself never waits on the gpu
+        if (state_ != EState::Copying || vkGetEventStatus(device_.Handle(), copied_) != VK_EVENT_SET)
+        {
+            return;
+        }
+        vkResetEvent(device_.Handle(), copied_);
+
+        state_ = EState::Filtering;
+        TaskCoordinator::GetInstance()->AddParralledTask([this](ResTask&)
+        {
+            filter_.execute();
+            CheckError("execute filter");
+            state_ = EState::Ready;
+        }, nullptr, {}, filterCounter_);
+    }
+
+    void OidnDenoiser::WaitForFilter()
+    {
+        TaskCoordinator::GetInstance()->WaitForCounter(filterCounter_);
+        // resources are released with the gpu idle, copies recorded but not filtered yet have set the event by now
+        vkResetEvent(device_.Handle(), copied_);
+    }
+
+    bool OidnDenoiser::CheckError(const char* operation)
+    {
+        const char* message = nullptr;
+        if (oidnDevice_.getError(message) != oidn::Error::None)
+        {
+            fmt::print(stderr, "oidn failed to {}: {}\n", operation, message ? message : "unknown error");
+            return false;
+        }
+        return true;
+    }
+}
+#endif
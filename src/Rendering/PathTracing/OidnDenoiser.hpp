@@ -0,0 +1,87 @@
+#pragma once
+
+#if WITH_OIDN
+#include "Vulkan/Vulkan.hpp"
+#include <oidn.hpp>
+#include <atomic>
+#include <memory>
+
+class TaskCounter;
+
+namespace Vulkan
+{
+	class Buffer;
+	class Device;
+	class DeviceMemory;
+	class RenderImage;
+}
+
+namespace Vulkan::RayTracing
+{
+	// OIDN off the render thread: a frame copies its accumulated diffuse, albedo and normal into linear buffers,
+	// once the gpu passed those copies a worker filters, and a later frame picks the result up,
+	// so frame N is denoised while frame N+1 renders.
+	// a gpu oidn device shares the buffers through opaque win32 / fd memory, otherwise the cpu device filters host visible copies
+	class OidnDenoiser final
+	{
+	public:
+		VULKAN_NON_COPIABLE(OidnDenoiser)
+
+		explicit OidnDenoiser(const Device& device);
+		~OidnDenoiser();
+
+		void CreateResources(VkExtent2D extent);
+		void ReleaseResources();
+
+		// record this frame's copies and write the latest denoised diffuse into target,
+		// returns false while no result is available yet, target is left untouched then
+		bool Record(VkCommandBuffer commandBuffer, const RenderImage& color, const RenderImage& albedo, const RenderImage& normal, const RenderImage& target);
+
+		// main thread, once per frame. starts the filter when the gpu passed the recorded copies, never waits for it
+		void Tick();
+
+		// drop the current result, the next one is picked up from a fresh frame
+		void Invalidate() { hasResult_ = false; }
+
+		bool IsGpuDevice() const { return gpuDevice_; }
+
+	private:
+		enum class EState : uint8_t
+		{
+			Idle,
+			Copying,
+			Filtering,
+			Ready,
+		};
+
+		enum EBuffer
+		{
+			EB_Color,
+			EB_Albedo,
+			EB_Normal,
+			EB_Output,
+			EB_Count,
+		};
+
+		void WaitForFilter();
+		bool CheckError(const char* operation);
+
+		const Device& device_;
+		oidn::DeviceRef oidnDevice_;
+		oidn::FilterRef filter_;
+		bool gpuDevice_{};
+
+		VkExtent2D extent_{};
+		std::unique_ptr<Buffer> buffers_[EB_Count];
+		std::unique_ptr<DeviceMemory> memories_[EB_Count];
+		oidn::BufferRef oidnBuffers_[EB_Count];
+		std::unique_ptr<RenderImage> result_;
+
+		// set by the gpu behind the input copies, Tick checks it
+		VkEvent copied_{};
+		std::atomic<EState> state_{EState::Idle};
+		std::shared_ptr<TaskCounter> filterCounter_;
+		bool hasResult_{};
+	};
+}
+#endif
@@ -68,28 +68,11 @@ namespace Vulkan::RayTracing
 
         PipelineLayout_.reset(new class PipelineLayout(device, managers, static_cast<uint32_t>(uniformBuffers.size()),
                                                        &pushConstantRange, 1));
-        const ShaderModule denoiseShader(device, "assets/shaders/Core.PathTracing.comp.slang.spv");
-        
-        VkComputePipelineCreateInfo pipelineCreateInfo = {};
-        pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-        pipelineCreateInfo.stage = denoiseShader.CreateShaderStage(VK_SHADER_STAGE_COMPUTE_BIT);
-        pipelineCreateInfo.layout = PipelineLayout_->Handle();
-
-
-        Check(vkCreateComputePipelines(device.Handle(), VK_NULL_HANDLE,
-                                       1, &pipelineCreateInfo,
-                                       NULL, &pipeline_),
-              "create compose pipeline");
+        pipeline_ = device.GetPipelineCache().RequestComputePipeline("assets/shaders/Core.PathTracing.comp.slang.spv", *PipelineLayout_);
     }
 
     PathTracingPipeline::~PathTracingPipeline()
     {
-        if (pipeline_ != nullptr)
-        {
-            vkDestroyPipeline(swapChain_.Device().Handle(), pipeline_, nullptr);
-            pipeline_ = nullptr;
-        }
-
         PipelineLayout_.reset();
         descriptorSetManager_.reset();
     }
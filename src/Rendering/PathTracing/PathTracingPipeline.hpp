@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Vulkan/Vulkan.hpp"
+#include "Vulkan/PipelineCache.hpp"
 #include <memory>
 #include <vector>
 
@@ -45,7 +46,7 @@ namespace Vulkan::RayTracing
 
 		const SwapChain& swapChain_;
 
-		VULKAN_HANDLE(VkPipeline, pipeline_)
+		VULKAN_ASYNC_PIPELINE(pipeline_)
 
 		std::unique_ptr<DescriptorSetManager> descriptorSetManager_;
 		std::unique_ptr<class PipelineLayout> PipelineLayout_;
@@ -3,10 +3,6 @@
 #include "Rendering/PipelineCommon/CommonComputePipeline.hpp"
 #include "Rendering/RayTraceBaseRenderer.hpp"
 
-#if WITH_OIDN
-#include <oidn.hpp>
-#endif
-
 namespace Vulkan
 {
 	namespace PipelineCommon
@@ -27,6 +23,7 @@ namespace Vulkan
 namespace Vulkan::RayTracing
 {
 	class PathTracingPipeline;
+	class OidnDenoiser;
 
 	class PathTracingRenderer final : public Vulkan::LogicRendererBase
 	{
@@ -39,23 +36,19 @@ namespace Vulkan::RayTracing
 		PathTracingRenderer(Vulkan::VulkanBaseRenderer& baseRender);
 		virtual ~PathTracingRenderer();
 
-		void SetPhysicalDeviceImpl(VkPhysicalDevice physicalDevice,
-			std::vector<const char*>& requiredExtensions,
-			VkPhysicalDeviceFeatures& deviceFeatures,
-			void* nextDeviceFeatures);// override;
-		
 		void OnDeviceSet() override;
 		void CreateSwapChain(const VkExtent2D& extent) override;
 		void DeleteSwapChain() override;
 		void Render(VkCommandBuffer commandBuffer, uint32_t imageIndex) override;
 		void BeforeNextFrame() override;
+		bool IsReady() const override;
 	
 	private:
 		void CreateOutputImage(const VkExtent2D& extent);
 
 		// individual textures
 		std::unique_ptr<PathTracingPipeline> rayTracingPipeline_;
-		std::unique_ptr<PipelineCommon::FinalComposePipeline> composePipelineNonDenoiser_;
+		std::unique_ptr<PipelineCommon::FinalComposePipeline> composePipeline_;
 
 		std::unique_ptr<PipelineCommon::AccumulatePipeline> accumulatePipeline_;
 		std::unique_ptr<PipelineCommon::AccumulatePipeline> accumulatePipelineSpec_;
@@ -65,11 +58,7 @@ namespace Vulkan::RayTracing
 		std::unique_ptr<RenderImage> rtPingPong3;
 
 #if WITH_OIDN
-		std::unique_ptr<RenderImage> rtDenoise0_;
-		std::unique_ptr<RenderImage> rtDenoise1_;
-		std::unique_ptr<PipelineCommon::FinalComposePipeline> composePipelineDenoiser_;
-		oidn::DeviceRef device;
-		oidn::FilterRef filter;
+		std::unique_ptr<OidnDenoiser> denoiser_;
 #endif
 	};
 
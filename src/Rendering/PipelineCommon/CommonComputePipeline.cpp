@@ -71,27 +71,11 @@ namespace Vulkan::PipelineCommon
     	pushConstantRange.size = 8;
     	
         pipelineLayout_.reset(new class PipelineLayout(device, managers, static_cast<uint32_t>(uniformBuffers.size()), &pushConstantRange, 1));
-        const ShaderModule denoiseShader(device, "assets/shaders/Process.ReProject.comp.slang.spv");
-
-        VkComputePipelineCreateInfo pipelineCreateInfo = {};
-        pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-        pipelineCreateInfo.stage = denoiseShader.CreateShaderStage(VK_SHADER_STAGE_COMPUTE_BIT);
-        pipelineCreateInfo.layout = pipelineLayout_->Handle();
-
-        Check(vkCreateComputePipelines(device.Handle(), VK_NULL_HANDLE,
-                                       1, &pipelineCreateInfo,
-                                       NULL, &pipeline_),
-              "create deferred shading pipeline");
+        pipeline_ = device.GetPipelineCache().RequestComputePipeline("assets/shaders/Process.ReProject.comp.slang.spv", *pipelineLayout_);
     }
 
     AccumulatePipeline::~AccumulatePipeline()
     {
-        if (pipeline_ != nullptr)
-        {
-            vkDestroyPipeline(swapChain_.Device().Handle(), pipeline_, nullptr);
-            pipeline_ = nullptr;
-        }
-
         pipelineLayout_.reset();
         descriptorSetManager_.reset();
     }
@@ -142,27 +126,11 @@ namespace Vulkan::PipelineCommon
         
         pipelineLayout_.reset(new class PipelineLayout(device, managers, static_cast<uint32_t>(uniformBuffers.size()), &pushConstantRange, 1));
         
-        const ShaderModule denoiseShader(device, "assets/shaders/Process.DenoiseJBF.comp.slang.spv");
-
-        VkComputePipelineCreateInfo pipelineCreateInfo = {};
-        pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-        pipelineCreateInfo.stage = denoiseShader.CreateShaderStage(VK_SHADER_STAGE_COMPUTE_BIT);
-        pipelineCreateInfo.layout = pipelineLayout_->Handle();
-
-        Check(vkCreateComputePipelines(device.Handle(), VK_NULL_HANDLE,
-                                       1, &pipelineCreateInfo,
-                                       NULL, &pipeline_),
-              "create deferred shading pipeline");
+        pipeline_ = device.GetPipelineCache().RequestComputePipeline("assets/shaders/Process.DenoiseJBF.comp.slang.spv", *pipelineLayout_);
     }
 
     FinalComposePipeline::~FinalComposePipeline()
     {
-        if (pipeline_ != nullptr)
-        {
-            vkDestroyPipeline(swapChain_.Device().Handle(), pipeline_, nullptr);
-            pipeline_ = nullptr;
-        }
-
         pipelineLayout_.reset();
         descriptorSetManager_.reset();
     }
@@ -213,27 +181,11 @@ namespace Vulkan::PipelineCommon
         pushConstantRange.size = 16;
         
         pipelineLayout_.reset(new class PipelineLayout(device, {descriptorSetManager_.get()}, static_cast<uint32_t>(swapChain.Images().size()), &pushConstantRange, 1));
-        const ShaderModule denoiseShader(device, "assets/shaders/Process.UpScaleFSR.comp.slang.spv");
-
-        VkComputePipelineCreateInfo pipelineCreateInfo = {};
-        pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-        pipelineCreateInfo.stage = denoiseShader.CreateShaderStage(VK_SHADER_STAGE_COMPUTE_BIT);
-        pipelineCreateInfo.layout = pipelineLayout_->Handle();
-
-        Check(vkCreateComputePipelines(device.Handle(), VK_NULL_HANDLE,
-                                       1, &pipelineCreateInfo,
-                                       NULL, &pipeline_),
-              "create deferred shading pipeline");
+        pipeline_ = device.GetPipelineCache().RequestComputePipeline("assets/shaders/Process.UpScaleFSR.comp.slang.spv", *pipelineLayout_);
     }
 
     SimpleComposePipeline::~SimpleComposePipeline()
     {
-        if (pipeline_ != nullptr)
-        {
-            vkDestroyPipeline(swapChain_.Device().Handle(), pipeline_, nullptr);
-            pipeline_ = nullptr;
-        }
-
         pipelineLayout_.reset();
         descriptorSetManager_.reset();
     }
@@ -267,27 +219,11 @@ namespace Vulkan::PipelineCommon
         }
 
         pipelineLayout_.reset(new class PipelineLayout(device, {descriptorSetManager_.get(), &baseRender.GetRTDescriptorSetManager()}, static_cast<uint32_t>(swapChain.Images().size())));
-        const ShaderModule denoiseShader(device, "assets/shaders/Util.BufferClear.comp.slang.spv");
-
-        VkComputePipelineCreateInfo pipelineCreateInfo = {};
-        pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-        pipelineCreateInfo.stage = denoiseShader.CreateShaderStage(VK_SHADER_STAGE_COMPUTE_BIT);
-        pipelineCreateInfo.layout = pipelineLayout_->Handle();
-
-        Check(vkCreateComputePipelines(device.Handle(), VK_NULL_HANDLE,
-                                       1, &pipelineCreateInfo,
-                                       NULL, &pipeline_),
-              "create buffer clear pipeline");
+        pipeline_ = device.GetPipelineCache().RequestComputePipeline("assets/shaders/Util.BufferClear.comp.slang.spv", *pipelineLayout_);
     }
 
     BufferClearPipeline::~BufferClearPipeline()
     {
-        if (pipeline_ != nullptr)
-        {
-            vkDestroyPipeline(swapChain_.Device().Handle(), pipeline_, nullptr);
-            pipeline_ = nullptr;
-        }
-
         pipelineLayout_.reset();
         descriptorSetManager_.reset();
     }
@@ -322,27 +258,11 @@ namespace Vulkan::PipelineCommon
         }
 
         pipelineLayout_.reset(new class PipelineLayout(device, {descriptorSetManager_.get(), &baseRender.GetRTDescriptorSetManager()},static_cast<uint32_t>(swapChain.Images().size())));
-        const ShaderModule denoiseShader(device, "assets/shaders/Util.VisualDebugger.comp.slang.spv");
-
-        VkComputePipelineCreateInfo pipelineCreateInfo = {};
-        pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-        pipelineCreateInfo.stage = denoiseShader.CreateShaderStage(VK_SHADER_STAGE_COMPUTE_BIT);
-        pipelineCreateInfo.layout = pipelineLayout_->Handle();
-
-        Check(vkCreateComputePipelines(device.Handle(), VK_NULL_HANDLE,
-                                       1, &pipelineCreateInfo,
-                                       NULL, &pipeline_),
-              "create deferred shading pipeline");
+        pipeline_ = device.GetPipelineCache().RequestComputePipeline("assets/shaders/Util.VisualDebugger.comp.slang.spv", *pipelineLayout_);
     }
 
     VisualDebuggerPipeline::~VisualDebuggerPipeline()
     {
-        if (pipeline_ != nullptr)
-        {
-            vkDestroyPipeline(swapChain_.Device().Handle(), pipeline_, nullptr);
-            pipeline_ = nullptr;
-        }
-
         pipelineLayout_.reset();
         descriptorSetManager_.reset();
     }
@@ -463,27 +383,11 @@ namespace Vulkan::PipelineCommon
         pushConstantRange.size = 8;
         
         pipelineLayout_.reset(new class PipelineLayout(device, descriptorSetManager_->DescriptorSetLayout(), &pushConstantRange, 1));
-        const ShaderModule denoiseShader(device, "assets/shaders/Bake.HwAmbientCube.comp.slang.spv");
- 
-        VkComputePipelineCreateInfo pipelineCreateInfo = {};
-        pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-        pipelineCreateInfo.stage = denoiseShader.CreateShaderStage(VK_SHADER_STAGE_COMPUTE_BIT);
-        pipelineCreateInfo.layout = pipelineLayout_->Handle();
-
-        Check(vkCreateComputePipelines(device.Handle(), VK_NULL_HANDLE,
-                                       1, &pipelineCreateInfo,
-                                       NULL, &pipeline_),
-              "create direct lighting gen shading pipeline");
+        pipeline_ = device.GetPipelineCache().RequestComputePipeline("assets/shaders/Bake.HwAmbientCube.comp.slang.spv", *pipelineLayout_);
     }
 
     HardwareGPULightBakePipeline::~HardwareGPULightBakePipeline()
     {
-        if (pipeline_ != nullptr)
-        {
-            vkDestroyPipeline(deviceProcedures_.Device().Handle(), pipeline_, nullptr);
-            pipeline_ = nullptr;
-        }
-
         pipelineLayout_.reset();
         descriptorSetManager_.reset();
     }
@@ -599,27 +503,11 @@ namespace Vulkan::PipelineCommon
         pushConstantRange.size = 8;
         
         pipelineLayout_.reset(new class PipelineLayout(device, descriptorSetManager_->DescriptorSetLayout(), &pushConstantRange, 1));
-        const ShaderModule denoiseShader(device, "assets/shaders/Bake.SwAmbientCube.comp.slang.spv");
- 
-        VkComputePipelineCreateInfo pipelineCreateInfo = {};
-        pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-        pipelineCreateInfo.stage = denoiseShader.CreateShaderStage(VK_SHADER_STAGE_COMPUTE_BIT);
-        pipelineCreateInfo.layout = pipelineLayout_->Handle();
-
-        Check(vkCreateComputePipelines(device.Handle(), VK_NULL_HANDLE,
-                                       1, &pipelineCreateInfo,
-                                       NULL, &pipeline_),
-              "create direct lighting gen shading pipeline");
+        pipeline_ = device.GetPipelineCache().RequestComputePipeline("assets/shaders/Bake.SwAmbientCube.comp.slang.spv", *pipelineLayout_);
     }
 
     SoftwareGPULightBakePipeline::~SoftwareGPULightBakePipeline()
     {
-        if (pipeline_ != nullptr)
-        {
-            vkDestroyPipeline(swapChain_.Device().Handle(), pipeline_, nullptr);
-            pipeline_ = nullptr;
-        }
-
         pipelineLayout_.reset();
         descriptorSetManager_.reset();
     }
@@ -670,27 +558,11 @@ namespace Vulkan::PipelineCommon
         pushConstantRange.size = 8;
         
         pipelineLayout_.reset(new class PipelineLayout(device, {descriptorSetManager_.get(), &scene.GetSceneBufferDescriptorSetManager(), &baseRender.GetRTDescriptorSetManager()}, static_cast<uint32_t>(uniformBuffers.size()), &pushConstantRange, 1));
-        const ShaderModule denoiseShader(device, "assets/shaders/Task.GpuCull.comp.slang.spv");
-
-        VkComputePipelineCreateInfo pipelineCreateInfo = {};
-        pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-        pipelineCreateInfo.stage = denoiseShader.CreateShaderStage(VK_SHADER_STAGE_COMPUTE_BIT);
-        pipelineCreateInfo.layout = pipelineLayout_->Handle();
-
-        Check(vkCreateComputePipelines(device.Handle(), VK_NULL_HANDLE,
-                                       1, &pipelineCreateInfo,
-                                       NULL, &pipeline_),
-              "create deferred shading pipeline");
+        pipeline_ = device.GetPipelineCache().RequestComputePipeline("assets/shaders/Task.GpuCull.comp.slang.spv", *pipelineLayout_);
     }
 
     GPUCullPipeline::~GPUCullPipeline()
     {
-        if (pipeline_ != nullptr)
-        {
-            vkDestroyPipeline(swapChain_.Device().Handle(), pipeline_, nullptr);
-            pipeline_ = nullptr;
-        }
-
         pipelineLayout_.reset();
         descriptorSetManager_.reset();
     }
@@ -874,7 +746,7 @@ namespace Vulkan::PipelineCommon
         pipelineInfo.renderPass = renderPass_->Handle();
         pipelineInfo.subpass = 0;
 
-        Check(vkCreateGraphicsPipelines(device.Handle(), nullptr, 1, &pipelineInfo, nullptr, &pipeline_),
+        Check(vkCreateGraphicsPipelines(device.Handle(), device.PipelineCacheHandle(), 1, &pipelineInfo, nullptr, &pipeline_),
               "create graphics pipeline");
     }
 
@@ -1067,7 +939,7 @@ namespace Vulkan::PipelineCommon
 		pipelineInfo.renderPass = renderPass_->Handle();
 		pipelineInfo.subpass = 0;
 
-		Check(vkCreateGraphicsPipelines(device.Handle(), nullptr, 1, &pipelineInfo, nullptr, &pipeline_),
+		Check(vkCreateGraphicsPipelines(device.Handle(), device.PipelineCacheHandle(), 1, &pipelineInfo, nullptr, &pipeline_),
 			"create graphics pipeline");
 	}
 
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Vulkan/Vulkan.hpp"
+#include "Vulkan/PipelineCache.hpp"
 #include "Vulkan/ImageView.hpp"
 #include <memory>
 #include <vector>
@@ -48,7 +49,7 @@ namespace Vulkan::PipelineCommon
 	private:
 		const SwapChain& swapChain_;
 		
-		VULKAN_HANDLE(VkPipeline, pipeline_)
+		VULKAN_ASYNC_PIPELINE(pipeline_)
 
 		std::unique_ptr<Vulkan::DescriptorSetManager> descriptorSetManager_;
 		std::unique_ptr<Vulkan::PipelineLayout> pipelineLayout_;
@@ -70,7 +71,7 @@ namespace Vulkan::PipelineCommon
 	private:
 		const SwapChain& swapChain_;
 		
-		VULKAN_HANDLE(VkPipeline, pipeline_)
+		VULKAN_ASYNC_PIPELINE(pipeline_)
 
 		std::unique_ptr<Vulkan::DescriptorSetManager> descriptorSetManager_;
 		std::unique_ptr<Vulkan::PipelineLayout> pipelineLayout_;
@@ -92,7 +93,7 @@ namespace Vulkan::PipelineCommon
 	private:
 		const SwapChain& swapChain_;
 		
-		VULKAN_HANDLE(VkPipeline, pipeline_)
+		VULKAN_ASYNC_PIPELINE(pipeline_)
 
 		std::unique_ptr<Vulkan::DescriptorSetManager> descriptorSetManager_;
 		std::unique_ptr<Vulkan::PipelineLayout> pipelineLayout_;
@@ -112,7 +113,7 @@ namespace Vulkan::PipelineCommon
 	private:
 		const SwapChain& swapChain_;
 		
-		VULKAN_HANDLE(VkPipeline, pipeline_)
+		VULKAN_ASYNC_PIPELINE(pipeline_)
 
 		std::unique_ptr<Vulkan::DescriptorSetManager> descriptorSetManager_;
 		std::unique_ptr<Vulkan::PipelineLayout> pipelineLayout_;
@@ -134,7 +135,7 @@ namespace Vulkan::PipelineCommon
 	private:
 		const SwapChain& swapChain_;
 		
-		VULKAN_HANDLE(VkPipeline, pipeline_)
+		VULKAN_ASYNC_PIPELINE(pipeline_)
 
 		std::unique_ptr<Vulkan::DescriptorSetManager> descriptorSetManager_;
 		std::unique_ptr<Vulkan::PipelineLayout> pipelineLayout_;
@@ -158,7 +159,7 @@ namespace Vulkan::PipelineCommon
 	private:
 		const DeviceProcedures& deviceProcedures_;
 		
-		VULKAN_HANDLE(VkPipeline, pipeline_)
+		VULKAN_ASYNC_PIPELINE(pipeline_)
 
 		std::unique_ptr<Vulkan::DescriptorSetManager> descriptorSetManager_;
 		std::unique_ptr<Vulkan::PipelineLayout> pipelineLayout_;
@@ -180,7 +181,7 @@ namespace Vulkan::PipelineCommon
 	private:
 		const SwapChain& swapChain_;
 		
-		VULKAN_HANDLE(VkPipeline, pipeline_)
+		VULKAN_ASYNC_PIPELINE(pipeline_)
 
 		std::unique_ptr<Vulkan::DescriptorSetManager> descriptorSetManager_;
 		std::unique_ptr<Vulkan::PipelineLayout> pipelineLayout_;
@@ -199,7 +200,7 @@ namespace Vulkan::PipelineCommon
 	private:
 		const SwapChain& swapChain_;
 		
-		VULKAN_HANDLE(VkPipeline, pipeline_)
+		VULKAN_ASYNC_PIPELINE(pipeline_)
 
 		std::unique_ptr<Vulkan::DescriptorSetManager> descriptorSetManager_;
 		std::unique_ptr<Vulkan::PipelineLayout> pipelineLayout_;
@@ -81,6 +81,8 @@ namespace Vulkan::RayTracing
         requiredExtensions.push_back(VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME);
 #if WIN32 && !defined(__MINGW32__)
         requiredExtensions.push_back(VK_KHR_EXTERNAL_MEMORY_WIN32_EXTENSION_NAME);
+#elif !ANDROID
+        requiredExtensions.push_back(VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME);
 #endif
 #endif
 
@@ -265,7 +267,7 @@ namespace Vulkan::RayTracing
 
             {
                 SCOPED_GPU_TIMER("hw-lightbake");
-                if (NextEngine::GetInstance()->GetUserSettings().BakeSpeedLevel != 2)
+                if (NextEngine::GetInstance()->GetUserSettings().BakeSpeedLevel != 2 && directLightGenPipeline_->IsReady())
                 {
                     int frame = (int)(frameCount_ % temporalFrames);
                     int groupPerFrame = group / temporalFrames;
@@ -34,6 +34,11 @@ void SoftwareModernRenderer::DeleteSwapChain()
 	deferredShadingPipeline_.reset();
 }
 
+bool SoftwareModernRenderer::IsReady() const
+{
+	return deferredShadingPipeline_ && deferredShadingPipeline_->IsReady();
+}
+
 void SoftwareModernRenderer::Render(VkCommandBuffer commandBuffer, uint32_t imageIndex)
 {
 	baseRender_.InitializeBarriers(commandBuffer);
@@ -76,6 +81,11 @@ void Vulkan::VoxelTracing::VoxelTracingRenderer::DeleteSwapChain()
 	composePipeline_.reset();
 }
 
+bool Vulkan::VoxelTracing::VoxelTracingRenderer::IsReady() const
+{
+	return deferredShadingPipeline_ && deferredShadingPipeline_->IsReady();
+}
+
 void Vulkan::VoxelTracing::VoxelTracingRenderer::Render(VkCommandBuffer commandBuffer, uint32_t imageIndex)
 {
 	baseRender_.InitializeBarriers(commandBuffer);
@@ -36,6 +36,7 @@ namespace Vulkan::LegacyDeferred
 		void CreateSwapChain(const VkExtent2D& extent) override;
 		void DeleteSwapChain() override;
 		void Render(VkCommandBuffer commandBuffer, uint32_t imageIndex) override;
+		bool IsReady() const override;
 
 	private:
 		std::unique_ptr<class ShadingPipeline> deferredShadingPipeline_;
@@ -57,6 +58,7 @@ namespace Vulkan::VoxelTracing
 		void CreateSwapChain(const VkExtent2D& extent) override;
 		void DeleteSwapChain() override;
 		void Render(VkCommandBuffer commandBuffer, uint32_t imageIndex) override;
+		bool IsReady() const override;
 
 	private:
 		// just one computer pass is enough
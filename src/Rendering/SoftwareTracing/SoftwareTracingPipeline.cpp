@@ -57,27 +57,11 @@ namespace Vulkan::ModernDeferred
             &scene.GetSceneBufferDescriptorSetManager()
         };
         pipelineLayout_.reset(new class PipelineLayout(device, managers, static_cast<uint32_t>(uniformBuffers.size())));
-        const ShaderModule denoiseShader(device, "assets/shaders/Core.SwTracing.comp.slang.spv");
-
-        VkComputePipelineCreateInfo pipelineCreateInfo = {};
-        pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
-        pipelineCreateInfo.stage = denoiseShader.CreateShaderStage(VK_SHADER_STAGE_COMPUTE_BIT);
-        pipelineCreateInfo.layout = pipelineLayout_->Handle();
-
-        Check(vkCreateComputePipelines(device.Handle(), VK_NULL_HANDLE,
-                                       1, &pipelineCreateInfo,
-                                       NULL, &pipeline_),
-              "create deferred shading pipeline");
+        pipeline_ = device.GetPipelineCache().RequestComputePipeline("assets/shaders/Core.SwTracing.comp.slang.spv", *pipelineLayout_);
     }
 
     ShadingPipeline::~ShadingPipeline()
     {
-        if (pipeline_ != nullptr)
-        {
-            vkDestroyPipeline(swapChain_.Device().Handle(), pipeline_, nullptr);
-            pipeline_ = nullptr;
-        }
-
         pipelineLayout_.reset();
         descriptorSetManager_.reset();
     }
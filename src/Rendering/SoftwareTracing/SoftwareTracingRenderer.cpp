@@ -58,6 +58,13 @@ void SoftwareTracingRenderer::DeleteSwapChain()
 	rtPingPong3.reset();
 }
 
+bool SoftwareTracingRenderer::IsReady() const
+{
+	return deferredShadingPipeline_ && deferredShadingPipeline_->IsReady() &&
+		accumulatePipeline_->IsReady() && accumulatePipelineSpec_->IsReady() && accumulatePipelineAlbedo_->IsReady() &&
+		composePipeline_->IsReady();
+}
+
 void SoftwareTracingRenderer::Render(VkCommandBuffer commandBuffer, uint32_t imageIndex)
 {
 	baseRender_.InitializeBarriers(commandBuffer);
@@ -37,6 +37,7 @@ namespace Vulkan::ModernDeferred
 		void CreateSwapChain(const VkExtent2D& extent) override;
 		void DeleteSwapChain() override;
 		void Render(VkCommandBuffer commandBuffer, uint32_t imageIndex) override;
+		bool IsReady() const override;
 
 	private:
 		std::unique_ptr<class ShadingPipeline> deferredShadingPipeline_;
@@ -8,6 +8,7 @@
 #include "Vulkan/Fence.hpp"
 #include "Vulkan/FrameBuffer.hpp"
 #include "Vulkan/Instance.hpp"
+#include "Vulkan/PipelineCache.hpp"
 #include "Vulkan/PipelineLayout.hpp"
 #include "Vulkan/RenderPass.hpp"
 #include "Vulkan/Semaphore.hpp"
@@ -253,23 +254,30 @@ namespace Vulkan
         supportRayTracing_ = !GOption->ForceNoRT && SupportRayQuery(*this);
     }
 
-    VulkanGpuTimer::VulkanGpuTimer(const Device& device, uint32_t totalCount, const VkPhysicalDeviceProperties& prop):device_(device)
+    VulkanGpuTimer::VulkanGpuTimer(const Device& device, uint32_t queriesPerFrame, const VkPhysicalDeviceProperties& prop):device_(device)
     {
-        time_stamps.resize(totalCount);
+        queriesPerFrame_ = queriesPerFrame;
+        timeStamps_.resize(queriesPerFrame);
         timeStampPeriod_ = prop.limits.timestampPeriod;
-        // Create the query pool object used to get the GPU time tamps
+        // one query pool per frame of the ring, a pool is only read back once the gpu is done with it
         VkQueryPoolCreateInfo query_pool_info{};
         query_pool_info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
         // We need to specify the query type for this pool, which in our case is for time stamps
         query_pool_info.queryType = VK_QUERY_TYPE_TIMESTAMP;
         // Set the no. of queries in this pool
-        query_pool_info.queryCount = static_cast<uint32_t>(time_stamps.size());
-        Check(vkCreateQueryPool(device_.Handle(), &query_pool_info, nullptr, &query_pool_timestamps), "create timestamp pool");
+        query_pool_info.queryCount = queriesPerFrame;
+        for (FSlot& slot : slots_)
+        {
+            Check(vkCreateQueryPool(device_.Handle(), &query_pool_info, nullptr, &slot.pool), "create timestamp pool");
+        }
     }
 
     VulkanGpuTimer::~VulkanGpuTimer()
     {
-        vkDestroyQueryPool(device_.Handle(), query_pool_timestamps, nullptr);
+        for (FSlot& slot : slots_)
+        {
+            vkDestroyQueryPool(device_.Handle(), slot.pool, nullptr);
+        }
     }
 
     VulkanBaseRenderer::~VulkanBaseRenderer()
@@ -281,6 +289,8 @@ namespace Vulkan
         globalTexturePool_.reset();
         commandPool_.reset();
         commandPool2_.reset();
+        device_->SetPipelineCache(nullptr);
+        pipelineCache_.reset();
         device_.reset();
         surface_.reset();
         debugUtilsMessenger_.reset();
@@ -335,11 +345,17 @@ namespace Vulkan
         // Create swap chain and command buffers.
         CreateSwapChain();
 
+        // reference mode compares every renderer from the first frame on
+        if (GOption->ReferenceMode)
+        {
+            pipelineCache_->WaitForCompiles();
+        }
+
         window_->Show();
 
         uptime = std::chrono::high_resolution_clock::now().time_since_epoch().count() - uptime;
-        fmt::print("\n{} renderer initialized in {:.2f}ms{}\n", CONSOLE_GREEN_COLOR, uptime * 1e-6f,
-                   CONSOLE_DEFAULT_COLOR);
+        fmt::print("\n{} renderer initialized in {:.2f}ms, pipeline cache {}{}\n", CONSOLE_GREEN_COLOR, uptime * 1e-6f,
+                   pipelineCache_->IsWarm() ? "warm" : "cold", CONSOLE_DEFAULT_COLOR);
     }
 
     void VulkanBaseRenderer::Start()
@@ -359,6 +375,9 @@ namespace Vulkan
     void VulkanBaseRenderer::End()
     {
         device_->WaitIdle();
+        DeliverReadback();
+        pipelineCache_->WaitForCompiles();
+        pipelineCache_->Save();
         gpuTimer_.reset();
     }
 
@@ -454,6 +473,8 @@ namespace Vulkan
 
         device_.reset(new class Device(physicalDevice, *surface_, requiredExtensions, deviceFeatures,
                                        &storage16BitFeatures));
+        pipelineCache_.reset(new class PipelineCache(*device_));
+        device_->SetPipelineCache(pipelineCache_.get());
         commandPool_.reset(new class CommandPool(*device_, device_->GraphicsFamilyIndex(), 0, true));
         commandPool2_.reset(new class CommandPool(*device_, device_->TransferFamilyIndex(), 1, true));
         gpuTimer_.reset(new VulkanGpuTimer(*device_, 200, device_->DeviceProperties()));
@@ -488,7 +509,7 @@ namespace Vulkan
         rtAccumlatedDiffuse.reset(new RenderImage(Device(), swapChain_->RenderExtent(),
                                        VK_FORMAT_R16G16B16A16_SFLOAT,
                                        VK_IMAGE_TILING_OPTIMAL,
-                                       VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, false, "output"));
+                                       VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT, false, "output"));
 
         rtAccumlatedSpecular.reset(new RenderImage(Device(), swapChain_->RenderExtent(),
                                        VK_FORMAT_R16G16B16A16_SFLOAT,
@@ -538,9 +559,9 @@ namespace Vulkan
         rtAlbedo_.reset(new RenderImage(Device(), swapChain_->RenderExtent(), VK_FORMAT_R16G16B16A16_SFLOAT,
                                         VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_STORAGE_BIT, false, "albedo"));
         rtAccumlatedAlbedo_.reset(new RenderImage(Device(), swapChain_->RenderExtent(), VK_FORMAT_R16G16B16A16_SFLOAT,
-                                        VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_STORAGE_BIT, false, "accumlatedAlbedo"));
+                                        VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, false, "accumlatedAlbedo"));
         rtNormal_.reset(new RenderImage(Device(), swapChain_->RenderExtent(), VK_FORMAT_R16G16B16A16_SFLOAT,
-                                        VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_STORAGE_BIT, false, "normal"));
+                                        VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, false, "normal"));
 
         rtShaderTimer_.reset(new RenderImage(Device(), swapChain_->RenderExtent(), VK_FORMAT_R8G8B8A8_UNORM,
                                              VK_IMAGE_TILING_LINEAR, VK_IMAGE_USAGE_STORAGE_BIT, false, "shadertimer"));
@@ -638,7 +659,22 @@ namespace Vulkan
         gpuCullPipeline_.reset(new PipelineCommon::GPUCullPipeline(*swapChain_, *this, uniformBuffers_, GetScene()));
         visualDebuggerPipeline_.reset(new PipelineCommon::VisualDebuggerPipeline(*swapChain_, *this, uniformBuffers_));
 
-        // 逻辑Renderer
+        // the pre-render and resolve passes are never skipped. their pipelines are requested again with the
+        // same layouts on every recreation, so only the very first swap chain actually waits here
+        auto basePipelinesReady = [this]() {
+            return gpuCullPipeline_->IsReady() && bufferClearPipeline_->IsReady() && simpleComposePipeline_->IsReady();
+        };
+        if (!basePipelinesReady())
+        {
+            // helps with the compiles, only a failure if they are still not ready once all of them finished
+            pipelineCache_->WaitForCompiles();
+            if (!basePipelinesReady())
+            {
+                Throw(std::runtime_error("failed to compile the base pipelines"));
+            }
+        }
+
+        // 逻辑Renderer, their pipelines keep compiling in background
         for (auto& logicRenderer : logicRenderers_)
         {
             logicRenderer.second->CreateSwapChain(swapChain_->RenderExtent());
@@ -696,6 +732,7 @@ namespace Vulkan
         imageAvailableSemaphores_.clear();
         depthBuffer_.reset();
         swapChain_.reset();
+        readbackImage_ = NO_READBACK;
 
         rtDescriptorSetManager_.reset();
 
@@ -899,17 +936,36 @@ namespace Vulkan
             }
 
             {
-                PERFORMANCEAPI_INSTRUMENT_COLOR("Renderer::QueryWait", PERFORMANCEAPI_MAKE_COLOR(255, 255, 200));
+                PERFORMANCEAPI_INSTRUMENT_COLOR("Renderer::QueryReadback", PERFORMANCEAPI_MAKE_COLOR(255, 255, 200));
                 SCOPED_CPU_TIMER("hwquery");
-                gpuTimer_->FrameEnd((*commandBuffers_)[currentImageIndex_]);
+                gpuTimer_->FrameEnd();
+            }
+
+            if (recreateSwapChainRequested_)
+            {
+                recreateSwapChainRequested_ = false;
+                RecreateSwapChain();
+                return;
             }
 
             // next frame synchronization objects
             const auto imageAvailableSemaphore = imageAvailableSemaphores_[currentFrame_].Handle();
             const auto renderFinishedSemaphore = renderFinishedSemaphores_[currentFrame_].Handle();
+            const bool headless = swapChain_->IsHeadless();
+            // the readback copy is only recorded for the frames the delegate actually takes
+            const bool readback = headless && DelegateHeadlessFrame && (!ShouldReadback || ShouldReadback(static_cast<uint32_t>(frameCount_)));
 
-            auto result = vkAcquireNextImageKHR(device_->Handle(), swapChain_->Handle(), noTimeout,
-                                                imageAvailableSemaphore, nullptr, &currentImageIndex_);
+            VkResult result = VK_SUCCESS;
+            if (headless)
+            {
+                // the offscreen ring has one image per frame in flight, nothing to acquire
+                currentImageIndex_ = static_cast<uint32_t>(currentFrame_);
+            }
+            else
+            {
+                result = vkAcquireNextImageKHR(device_->Handle(), swapChain_->Handle(), noTimeout,
+                                               imageAvailableSemaphore, nullptr, &currentImageIndex_);
+            }
 
             if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR)
             {
@@ -947,6 +1003,11 @@ namespace Vulkan
                         SCOPED_GPU_TIMER("imgui");
                         DelegatePostRender(commandBuffer, currentImageIndex_);
                     }
+                    if (readback)
+                    {
+                        SCOPED_GPU_TIMER("readback");
+                        swapChain_->RecordReadback(commandBuffer, currentImageIndex_);
+                    }
                 }
             }
             commandBuffers_->End(currentFrame_);
@@ -962,7 +1023,9 @@ namespace Vulkan
                 PERFORMANCEAPI_INSTRUMENT_COLOR("Renderer::Fence", PERFORMANCEAPI_MAKE_COLOR(255, 200, 255));
                 SCOPED_CPU_TIMER("fence");
                 currentFence->Wait(noTimeout);
+                gpuTimer_->FrameFenced();
             }
+            DeliverReadback();
 
             if (GetScene().UpdateNodes())
             {
@@ -980,20 +1043,33 @@ namespace Vulkan
             VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
             VkSemaphore signalSemaphores[] = {renderFinishedSemaphore};
             {
-                submitInfo.waitSemaphoreCount = 1;
+                // headless images are never acquired nor presented, the fences alone pace the frames
+                submitInfo.waitSemaphoreCount = headless ? 0 : 1;
                 submitInfo.pWaitSemaphores = waitSemaphores;
                 submitInfo.pWaitDstStageMask = waitStages;
                 submitInfo.commandBufferCount = 1;
                 submitInfo.pCommandBuffers = commandBuffers;
-                submitInfo.signalSemaphoreCount = 1;
+                submitInfo.signalSemaphoreCount = headless ? 0 : 1;
                 submitInfo.pSignalSemaphores = signalSemaphores;
 
                 currentFence->Reset();
 
                 Check(vkQueueSubmit(device_->GraphicsQueue(), 1, &submitInfo, currentFence->Handle()),
                       "submit draw command buffer");
+                gpuTimer_->FrameSubmitted();
+
+                if (readback)
+                {
+                    readbackImage_ = currentImageIndex_;
+                    readbackFrame_ = static_cast<uint32_t>(frameCount_);
+                }
             }
 
+            if (headless)
+            {
+                AfterPresent();
+            }
+            else
             {
                 PERFORMANCEAPI_INSTRUMENT_COLOR("Renderer::Present", PERFORMANCEAPI_MAKE_COLOR(255, 200, 255));
                 SCOPED_CPU_TIMER("present");
@@ -1026,7 +1102,6 @@ namespace Vulkan
             currentFrame_ = (currentFrame_ + 1) % inFlightFences_.size();
             frameCount_++;
         }
-        gpuTimer_->CpuFrameEnd();
     }
 
     void VulkanBaseRenderer::BeforeNextFrame()
@@ -1098,6 +1173,27 @@ namespace Vulkan
         currentLogicRenderer_ = type;
     }
 
+    LogicRendererBase* VulkanBaseRenderer::GetReadyLogicRenderer()
+    {
+        auto current = logicRenderers_.find(currentLogicRenderer_);
+        if (current == logicRenderers_.end())
+        {
+            return nullptr;
+        }
+        if (current->second->IsReady())
+        {
+            return current->second.get();
+        }
+
+        // legacy deferred has the lightest pipelines, it usually finishes first
+        auto fallback = logicRenderers_.find(ERendererType::ERT_LegacyDeferred);
+        if (fallback != logicRenderers_.end() && fallback->second->IsReady())
+        {
+            return fallback->second.get();
+        }
+        return nullptr;
+    }
+
     void VulkanBaseRenderer::Render(VkCommandBuffer commandBuffer, const uint32_t imageIndex)
     {
         glm::uvec4 pushConst = glm::uvec4(SwapChain().OutputOffset().x, SwapChain().OutputOffset().y, SwapChain().OutputExtent().width, SwapChain().OutputExtent().height);
@@ -1138,6 +1234,11 @@ namespace Vulkan
                     break;
                 }
 
+                if (!logicRenderer.second->IsReady())
+                {
+                    continue;
+                }
+
                 {
                     SCOPED_GPU_TIMER_FOLDER(rendererName.c_str(), folderName.c_str());
                     logicRenderer.second->Render(commandBuffer, imageIndex);
@@ -1183,29 +1284,33 @@ namespace Vulkan
         }
         else
         {
-            if (logicRenderers_.find(currentLogicRenderer_) != logicRenderers_.end())
+            // nothing ready yet, keep the cleared swap chain image
+            LogicRendererBase* logicRenderer = GetReadyLogicRenderer();
+            if (logicRenderer)
             {
-                SCOPED_GPU_TIMER("logic renderer");
-                logicRenderers_[currentLogicRenderer_]->Render(commandBuffer, imageIndex);
-            }
+                {
+                    SCOPED_GPU_TIMER("logic renderer");
+                    logicRenderer->Render(commandBuffer, imageIndex);
+                }
 
-            {
-                SCOPED_GPU_TIMER("resolve pass");
+                {
+                    SCOPED_GPU_TIMER("resolve pass");
 
-                SwapChain().InsertBarrierToWrite(commandBuffer, imageIndex);
-                rtDenoised->InsertBarrier(commandBuffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
-                                          VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL);
+                    SwapChain().InsertBarrierToWrite(commandBuffer, imageIndex);
+                    rtDenoised->InsertBarrier(commandBuffer, VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT,
+                                              VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_LAYOUT_GENERAL);
 
-                vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, simpleComposePipeline_->Handle());
-                simpleComposePipeline_->PipelineLayout().BindDescriptorSets(commandBuffer, imageIndex);
-                
-                vkCmdPushConstants(commandBuffer, simpleComposePipeline_->PipelineLayout().Handle(),
-                                   VK_SHADER_STAGE_COMPUTE_BIT,
-                                   0, sizeof(glm::uvec4), &pushConst);
+                    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, simpleComposePipeline_->Handle());
+                    simpleComposePipeline_->PipelineLayout().BindDescriptorSets(commandBuffer, imageIndex);
+                    
+                    vkCmdPushConstants(commandBuffer, simpleComposePipeline_->PipelineLayout().Handle(),
+                                       VK_SHADER_STAGE_COMPUTE_BIT,
+                                       0, sizeof(glm::uvec4), &pushConst);
 
-                vkCmdDispatch(commandBuffer, SwapChain().Extent().width / 8, SwapChain().Extent().height / 8, 1);
+                    vkCmdDispatch(commandBuffer, SwapChain().Extent().width / 8, SwapChain().Extent().height / 8, 1);
 
-                SwapChain().InsertBarrierToPresent(commandBuffer, imageIndex);
+                    SwapChain().InsertBarrierToPresent(commandBuffer, imageIndex);
+                }
             }
         }
     }
@@ -1239,7 +1344,7 @@ namespace Vulkan
                 break;
             }
 
-            if (NextEngine::GetInstance()->GetUserSettings().BakeSpeedLevel != 2)
+            if (NextEngine::GetInstance()->GetUserSettings().BakeSpeedLevel != 2 && softAmbientCubeGenPipeline_->IsReady())
             {
                 SCOPED_GPU_TIMER("sw-lightbake");
                 
@@ -1272,7 +1377,7 @@ namespace Vulkan
             }
         }
 
-        if (VisualDebug())
+        if (VisualDebug() && visualDebuggerPipeline_->IsReady())
         {
             SCOPED_GPU_TIMER("visual debugger");
             SwapChain().InsertBarrierToWrite(commandBuffer, imageIndex);
@@ -1376,10 +1481,25 @@ namespace Vulkan
     void VulkanBaseRenderer::RecreateSwapChain()
     {
         device_->WaitIdle();
+        gpuTimer_->FrameFenced();
+        DeliverReadback();
         DeleteSwapChain();
         CreateSwapChain();
     }
 
+    void VulkanBaseRenderer::DeliverReadback()
+    {
+        if (readbackImage_ == NO_READBACK)
+        {
+            return;
+        }
+        if (DelegateHeadlessFrame)
+        {
+            DelegateHeadlessFrame(swapChain_->ReadbackData(readbackImage_), swapChain_->Extent(), readbackFrame_);
+        }
+        readbackImage_ = NO_READBACK;
+    }
+
     LogicRendererBase::LogicRendererBase(VulkanBaseRenderer& baseRender): baseRender_(baseRender)
     {
     }
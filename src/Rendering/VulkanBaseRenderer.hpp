@@ -71,6 +71,8 @@ namespace Vulkan
 		const class Window& Window() const { return *window_; }
 
 		bool HasSwapChain() const { return swapChain_.operator bool(); }
+		// recreated at the start of the next DrawFrame, the same path as an out of date swapchain
+		void RequestRecreateSwapChain() { recreateSwapChainRequested_ = true; }
 
 		void SetPhysicalDevice(VkPhysicalDevice physicalDevice);
 		
@@ -123,6 +125,9 @@ namespace Vulkan
 		virtual void OnPreLoadScene() {}
 		virtual void OnPostLoadScene() {}
 
+		// vertex layout the scene loader builds, all renderers handle indexed meshes through the provoking vertex reorder
+		virtual Assets::EMeshLayout MeshLayout() const { return Assets::EMeshLayout::EML_Indexed; }
+
 		void InitializeBarriers(VkCommandBuffer commandBuffer);
 		
 		bool VisualDebug() const {return visualDebug_;}
@@ -147,6 +152,11 @@ namespace Vulkan
 		std::function<void()> DelegateBeforeNextTick;
 		std::function<Assets::UniformBufferObject(VkOffset2D, VkExtent2D)> DelegateGetUniformBufferObject;
 		std::function<void(VkCommandBuffer, uint32_t)> DelegatePostRender;
+		// headless only: pixels (b8g8r8a8) of a finished frame, handed over one frame later so the gpu never stalls.
+		// each frame handed over costs one image to buffer copy, leave it empty for perf runs
+		std::function<void(const uint8_t*, VkExtent2D, uint32_t)> DelegateHeadlessFrame;
+		// picks the frames read back for DelegateHeadlessFrame, every frame if empty
+		std::function<bool(uint32_t)> ShouldReadback;
 
 		DeviceMemory* GetScreenShotMemory() const {return screenShotImageMemory_.get();}
 	
@@ -183,6 +193,9 @@ namespace Vulkan
 
 		void UpdateUniformBuffer(uint32_t imageIndex);
 		void RecreateSwapChain();
+		void DeliverReadback();
+		// the current logic renderer, or a cheap ready one while its pipelines are still compiling
+		class LogicRendererBase* GetReadyLogicRenderer();
 
 		const VkPresentModeKHR presentMode_;
 
@@ -194,6 +207,7 @@ namespace Vulkan
 		std::unique_ptr<class DebugUtilsMessenger> debugUtilsMessenger_;
 		std::unique_ptr<class Surface> surface_;
 		std::unique_ptr<class Device> device_;
+		std::unique_ptr<class PipelineCache> pipelineCache_;
 		std::unique_ptr<class SwapChain> swapChain_;
 		
 		std::vector<Assets::UniformBuffer> uniformBuffers_;
@@ -231,6 +245,12 @@ namespace Vulkan
 
 		uint32_t currentImageIndex_{};
 		size_t currentFrame_{};
+
+		// headless readback submitted with the last frame, delivered after its fence
+		static constexpr uint32_t NO_READBACK = ~0u;
+		uint32_t readbackImage_{NO_READBACK};
+		uint32_t readbackFrame_{};
+		bool recreateSwapChainRequested_{};
 		Fence* currentFence;
 
 		uint64_t uptime {};
@@ -247,6 +267,8 @@ namespace Vulkan
 		virtual void DeleteSwapChain() {};
 		virtual void Render(VkCommandBuffer commandBuffer, uint32_t imageIndex) {};
 		virtual void BeforeNextFrame() {};
+		// all pipelines compiled, Render is skipped or replaced by a fallback renderer until then
+		virtual bool IsReady() const { return true; }
 		
 		VulkanBaseRenderer& baseRender_;
 		template<typename T>
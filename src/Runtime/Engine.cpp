@@ -200,6 +200,7 @@ NextEngine::NextEngine(Options& options, void* userdata)
         userdata,
         options.ForceSDR
     };
+    windowConfig.Headless = options.Headless;
     gameInstance_ = CreateGameInstance(windowConfig, options, this);
     userSettings_ = CreateUserSettings(options);
     window_.reset( new Vulkan::Window(windowConfig));
@@ -214,6 +215,15 @@ NextEngine::NextEngine(Options& options, void* userdata)
     renderer_->DelegateBeforeNextTick = [this]()->void{OnRendererBeforeNextFrame();};
     renderer_->DelegateGetUniformBufferObject = [this](VkOffset2D offset, VkExtent2D extend)->Assets::UniformBufferObject{ return GetUniformBufferObject(offset, extend);};
     renderer_->DelegatePostRender = [this](VkCommandBuffer commandBuffer, uint32_t imageIndex)->void{OnRendererPostRender(commandBuffer, imageIndex);};
+    if (options.Headless && options.HeadlessDump > 0)
+    {
+        const uint32_t dumpInterval = options.HeadlessDump;
+        renderer_->ShouldReadback = [dumpInterval](uint32_t frame)->bool{ return frame % dumpInterval == 0; };
+        renderer_->DelegateHeadlessFrame = [](const uint8_t* pixels, VkExtent2D extent, uint32_t frame)->void
+        {
+            ScreenShot::SavePixelsToFile(pixels, extent.width, extent.height, fmt::format("headless_{:05}", frame));
+        };
+    }
 
     // Initialize IO
     window_->OnKey = [this](const int key, const int scancode, const int action, const int mods) { OnKey(key, scancode, action, mods); };
@@ -302,8 +312,11 @@ bool NextEngine::Tick()
     
     // Renderer Tick
 #if !ANDROID
-    glfwPollEvents();
-    window_->PollGamepadInput();
+    if (!window_->IsHeadless())
+    {
+        glfwPollEvents();
+        window_->PollGamepadInput();
+    }
 #endif
     // tick
     if (status_ == NextRenderer::EApplicationStatus::Running)
@@ -363,13 +376,17 @@ bool NextEngine::Tick()
     return false;
 #else
     window_->attemptDragWindow();
-    return glfwWindowShouldClose( window_->Handle() ) != 0;
+    return window_->ShouldClose();
 #endif
 }
 
 void NextEngine::End()
 {
-    TaskCoordinator::GetInstance()->CancelAllParralledTasks();
+    // only the bake is dropped, loads and cooks others wait for have to finish
+    if (scene_)
+    {
+        scene_->GetCPUAccelerationStructure().CancelBake();
+    }
     TaskCoordinator::GetInstance()->WaitForAllParralledTask();
     
     physicsEngine_->Stop();
@@ -540,7 +557,10 @@ glm::dvec2 NextEngine::GetMousePos()
 {
     double x{},y{};
 #if !ANDROID
-    glfwGetCursorPos( window_->Handle(), &x, &y );
+    if (!window_->IsHeadless())
+    {
+        glfwGetCursorPos( window_->Handle(), &x, &y );
+    }
 #endif
     return glm::dvec2(x,y);
 }
@@ -639,7 +659,10 @@ glm::ivec2 NextEngine::GetMonitorSize(int monitorIndex) const
     glm::ivec2 pos{0,0};
     glm::ivec2 size{1920,1080};
 #if !ANDROID
-    glfwGetMonitorWorkarea(glfwGetPrimaryMonitor(), &pos.x, &pos.y, &size.x, &size.y);
+    if (!GOption->Headless)
+    {
+        glfwGetMonitorWorkarea(glfwGetPrimaryMonitor(), &pos.x, &pos.y, &size.x, &size.y);
+    }
 #endif
     return size;
 }
@@ -652,6 +675,34 @@ void NextEngine::RayCastGPU(glm::vec3 rayOrigin, glm::vec3 rayDir,
     callback(result);
 }
 
+std::vector<double> NextEngine::RayCastBatch(const std::vector<float>& rays, float maxDistance, uint32_t rayMask, bool anyHit)
+{
+    const size_t rayCount = rays.size() / 6;
+    std::vector<FRayQuery> queries(rayCount);
+    for (size_t i = 0; i < rayCount; ++i)
+    {
+        const float* ray = &rays[i * 6];
+        queries[i] = { glm::vec3(ray[0], ray[1], ray[2]), glm::vec3(ray[3], ray[4], ray[5]), maxDistance, rayMask };
+    }
+
+    std::vector<Assets::RayCastResult> results(rayCount);
+    scene_->GetCPUAccelerationStructure().RayQuery(queries, results, anyHit ? ERayQueryType::ERQT_AnyHit : ERayQueryType::ERQT_ClosestHit);
+
+    // doubles like the js numbers they become, every uint32_t instance id stays exact
+    std::vector<double> packed(rayCount * RAYCAST_BATCH_STRIDE);
+    for (size_t i = 0; i < rayCount; ++i)
+    {
+        const Assets::RayCastResult& result = results[i];
+        double* out = &packed[i * RAYCAST_BATCH_STRIDE];
+        out[0] = result.Hitted ? result.T : -1.0;
+        out[1] = result.Hitted ? double(result.InstanceId) : -1.0;
+        out[2] = result.Normal.x;
+        out[3] = result.Normal.y;
+        out[4] = result.Normal.z;
+    }
+    return packed;
+}
+
 void NextEngine::SetProgressiveRendering(bool enable)
 {
     progressiveRendering_ = enable;
@@ -757,6 +808,13 @@ Assets::UniformBufferObject NextEngine::GetUniformBufferObject(const VkOffset2D
     ubo.BFSigmaLum = userSettings_.DenoiseSigmaLum;
     ubo.BFSigmaNormal = userSettings_.DenoiseSigmaNormal;
     ubo.BFSize = userSettings_.Denoiser ? userSettings_.DenoiseSize : 0;
+#if WITH_OIDN
+    // the path tracer composes the OIDN result, a JBF on top would only blur it
+    if (renderer_->CurrentLogicRendererType() == Vulkan::ERT_PathTracing)
+    {
+        ubo.BFSize = 0;
+    }
+#endif
     
     ubo.ShowEdge = userSettings_.ShowEdge;
 
@@ -830,6 +888,10 @@ void NextEngine::OnRendererDeleteSwapChain()
     {
         userInterface_->OnDestroySurface();
     }
+    if (scene_)
+    {
+        scene_->OnSwapChainDeleted(renderer_->CommandPool());
+    }
 }
 
 void NextEngine::OnRendererPostRender(VkCommandBuffer commandBuffer, uint32_t imageIndex)
@@ -1005,8 +1067,11 @@ void NextEngine::RequestLoadScene(std::string sceneFileName)
 
 void NextEngine::LoadScene(std::string sceneFileName)
 {
-    // wait all task finish
-    TaskCoordinator::GetInstance()->CancelAllParralledTasks();
+    // wait all task finish, the bake of the old scene is dropped
+    if (scene_)
+    {
+        scene_->GetCPUAccelerationStructure().CancelBake();
+    }
     TaskCoordinator::GetInstance()->WaitForAllParralledTask();
     
     status_ = NextRenderer::EApplicationStatus::Loading;
@@ -1020,6 +1085,7 @@ void NextEngine::LoadScene(std::string sceneFileName)
 
     physicsEngine_->OnSceneDestroyed();
     Assets::GlobalTexturePool::GetInstance()->FreeNonSystemTextures();
+    Assets::Model::SetMeshLayout(renderer_->MeshLayout());
     
     // dispatch in thread task and reset in main thread
     TaskCoordinator::GetInstance()->AddTask( [cameraState, sceneFileName, models, nodes, materials, lights, tracks](ResTask& task)
@@ -1113,7 +1179,8 @@ void NextEngine::InitJSEngine() {
                 .fun<&NextEngine::GetTotalFrames>("GetTotalFrames")
                 .fun<&NextEngine::GetTestNumber>("GetTestNumber")
                 .fun<&NextEngine::RegisterJSCallback>("RegisterJSCallback")
-                .fun<&NextEngine::GetScenePtr>("GetScenePtr");
+                .fun<&NextEngine::GetScenePtr>("GetScenePtr")
+                .fun<&NextEngine::RayCastBatch>("RayCastBatch");
         module.class_<Assets::Scene>("Scene")
                 .fun<&Assets::Scene::GetIndicesCount>("GetIndicesCount");
         module.class_<NextComponent>("NextComponent")
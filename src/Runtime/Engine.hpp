@@ -191,6 +191,11 @@ public:
 	// gpu raycast
 	void RayCastGPU(glm::vec3 rayOrigin, glm::vec3 rayDir, std::function<bool (Assets::RayCastResult rayResult)> callback );
 
+	// batched cpu raycasts for scripts, rays are packed as origin xyz + direction xyz. each ray
+	// returns t (negative on miss), instance id and world normal xyz, RAYCAST_BATCH_STRIDE numbers
+	static constexpr uint32_t RAYCAST_BATCH_STRIDE = 5;
+	std::vector<double> RayCastBatch(const std::vector<float>& rays, float maxDistance, uint32_t rayMask, bool anyHit);
+
 	void SetProgressiveRendering(bool enable);
 	bool IsProgressiveRendering() const { return progressiveRendering_; }
 
@@ -8,20 +8,38 @@
 #include <Jolt/RegisterTypes.h>
 #include <Jolt/Core/Factory.h>
 #include <Jolt/Core/TempAllocator.h>
-#include <Jolt/Core/JobSystemThreadPool.h>
+#include <Jolt/Core/JobSystemWithBarrier.h>
+#include <Jolt/Core/FixedSizeFreeList.h>
 #include <Jolt/Physics/PhysicsSettings.h>
 #include <Jolt/Physics/PhysicsSystem.h>
 #include <Jolt/Physics/Collision/Shape/BoxShape.h>
 #include <Jolt/Physics/Collision/Shape/SphereShape.h>
+#include <Jolt/Physics/Collision/Shape/ConvexHullShape.h>
+#include <Jolt/Physics/Collision/Shape/MeshShape.h>
+#include <Jolt/Physics/Collision/Shape/HeightFieldShape.h>
+#include <Jolt/Physics/Collision/Shape/ScaledShape.h>
+#include <Jolt/Core/StreamWrapper.h>
+#include <Jolt/Physics/Body/Body.h>
 #include <Jolt/Physics/Body/BodyCreationSettings.h>
 #include <Jolt/Physics/Body/BodyActivationListener.h>
 
 // STL includes
 #include <iostream>
 #include <cstdarg>
+#include <cfloat>
+#include <algorithm>
+#include <chrono>
 #include <thread>
+#include <mutex>
+#include <filesystem>
+#include <fstream>
+#include <xxhash.h>
 
 #include "Engine.hpp"
+#include "Assets/Model.hpp"
+#include "Assets/Scene.hpp"
+#include "TaskCoordinator.hpp"
+#include "Utilities/FileHelper.hpp"
 
 // Disable common warnings triggered by Jolt, you can use JPH_SUPPRESS_WARNING_PUSH / JPH_SUPPRESS_WARNING_POP to store and restore the warning state
 JPH_SUPPRESS_WARNINGS
@@ -192,26 +210,108 @@ public:
 	}
 };
 
-// An example activation listener
+// collects the bodies going to sleep during a step, their last transform still has to be synced.
+// called from physics jobs
 class MyBodyActivationListener : public BodyActivationListener
 {
 public:
 	virtual void		OnBodyActivated(const BodyID &inBodyID, uint64 inBodyUserData) override
 	{
-		//cout << "A body got activated" << endl;
 	}
 
 	virtual void		OnBodyDeactivated(const BodyID &inBodyID, uint64 inBodyUserData) override
 	{
-		//cout << "A body went to sleep" << endl;
+		std::lock_guard<std::mutex> lock(mutex);
+		deactivatedBodies.push_back(inBodyID);
 	}
+
+	std::mutex mutex;
+	BodyIDVector deactivatedBodies;
+};
+
+// Jolt jobs run on the engine worker pool, physics, bakes and texture decoding share one set of threads.
+// same job bookkeeping as JobSystemThreadPool, only the queue is replaced
+class FNextJobSystem final : public JobSystemWithBarrier
+{
+public:
+	FNextJobSystem(uint inMaxJobs, uint inMaxBarriers) : JobSystemWithBarrier(inMaxBarriers)
+	{
+		jobs_.Init(inMaxJobs, inMaxJobs);
+	}
+
+	virtual int GetMaxConcurrency() const override
+	{
+		// the thread waiting on the barrier executes jobs as well
+		return static_cast<int>(TaskCoordinator::GetInstance()->GetWorkerCount()) + 1;
+	}
+
+	virtual JobHandle CreateJob(const char *inName, ColorArg inColor, const JobFunction &inJobFunction, uint32 inNumDependencies = 0) override
+	{
+		uint32 index;
+		for (;;)
+		{
+			index = jobs_.ConstructObject(inName, inColor, this, inJobFunction, inNumDependencies);
+			if (index != AvailableJobs::cInvalidObjectIndex)
+				break;
+			JPH_ASSERT(false, "No jobs available!");
+			std::this_thread::sleep_for(std::chrono::microseconds(100));
+		}
+		Job *job = &jobs_.Get(index);
+
+		// the handle keeps a reference, the job may complete right after it is queued
+		JobHandle handle(job);
+		if (inNumDependencies == 0)
+			QueueJob(job);
+		return handle;
+	}
+
+protected:
+	virtual void QueueJob(Job *inJob) override
+	{
+		// released by the task, Execute is a no-op if the barrier already ran the job
+		inJob->AddRef();
+		TaskCoordinator::GetInstance()->AddDetachedTask([inJob](ResTask& task)
+		{
+			inJob->Execute();
+			inJob->Release();
+		});
+	}
+
+	virtual void QueueJobs(Job **inJobs, uint inNumJobs) override
+	{
+		for (uint i = 0; i < inNumJobs; ++i)
+			QueueJob(inJobs[i]);
+	}
+
+	virtual void FreeJob(Job *inJob) override
+	{
+		jobs_.DestroyObject(inJob);
+	}
+
+private:
+	using AvailableJobs = FixedSizeFreeList<Job>;
+	AvailableJobs jobs_;
+};
+
+// a shape cooked from model data, filled by the cook task
+struct FNextCookedShape
+{
+	ENextBodyShape type;
+	uint32_t taskId;
+	ShapeRefC shape;
+	// set when the cook ran, a finished task without it was canceled before running
+	bool cooked = false;
+	// cook input, kept until the cook ran so a canceled one can be dispatched again
+	uint64_t hash;
+	std::vector<Float3> positions;
+	std::vector<uint32_t> indices;
 };
 
 struct FNextPhysicsContext
 {
 	FNextPhysicsContext():
 		temp_allocator(10 * 1024 * 1024),
-		job_system(cMaxPhysicsJobs, cMaxPhysicsBarriers, thread::hardware_concurrency() - 1)
+		job_system(cMaxPhysicsJobs, cMaxPhysicsBarriers)
 	{
 		// This is the max amount of rigid bodies that you can add to the physics system. If you try to add more you'll get an error.
 		// Note: This value is low because this is a simple test. For a real project use something in the order of 65536.
@@ -249,10 +349,8 @@ struct FNextPhysicsContext
 	// malloc / free.
 	TempAllocatorImpl temp_allocator;
 
-	// We need a job system that will execute physics jobs on multiple threads. Typically
-	// you would implement the JobSystem interface yourself and let Jolt Physics run on top
-	// of your own job scheduler. JobSystemThreadPool is an example implementation.
-	JobSystemThreadPool job_system;
+	// physics jobs are executed by the TaskCoordinator workers, no extra threads
+	FNextJobSystem job_system;
 
 	// Create mapping table from object layer to broadphase layer
 	// Note: As this is an interface, PhysicsSystem will take a reference to this so this instance needs to stay alive!
@@ -280,8 +378,146 @@ struct FNextPhysicsContext
 	// Note that this is called from a job so whatever you do here needs to be thread safe.
 	// Registering one is entirely optional.
 	MyContactListener contact_listener;
+
+	// slots are never moved, cook tasks write into them
+	std::vector<std::unique_ptr<FNextCookedShape>> cooked_shapes;
+	std::unordered_map<uint64_t, uint32_t> cooked_shape_by_hash;
 };
 
+// bump when the cooking changes, old cache files are simply never hit again
+static constexpr uint64_t SHAPE_COOK_VERSION = 1;
+// samples per side of a heightfield cooked from a mesh
+static constexpr uint32_t HEIGHTFIELD_SAMPLE_COUNT = 128;
+
+static ShapeRefC CookConvexHull(const std::vector<Float3>& positions)
+{
+	Array<Vec3> points;
+	points.reserve(positions.size());
+	for (const Float3& position : positions)
+	{
+		points.push_back(Vec3(position));
+	}
+	ConvexHullShapeSettings settings(points);
+	ShapeSettings::ShapeResult result = settings.Create();
+	return result.IsValid() ? result.Get() : nullptr;
+}
+
+static ShapeRefC CookMesh(const std::vector<Float3>& positions, const std::vector<uint32_t>& indices)
+{
+	VertexList vertices;
+	vertices.reserve(positions.size());
+	for (const Float3& position : positions)
+	{
+		vertices.push_back(position);
+	}
+	IndexedTriangleList triangles;
+	triangles.reserve(indices.size() / 3);
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		triangles.push_back(IndexedTriangle(indices[i], indices[i + 1], indices[i + 2]));
+	}
+	// degenerate triangles are dropped by Sanitize in the constructor
+	MeshShapeSettings settings(std::move(vertices), std::move(triangles));
+	ShapeSettings::ShapeResult result = settings.Create();
+	return result.IsValid() ? result.Get() : nullptr;
+}
+
+// the top surface of the mesh rasterized onto a square grid over its xz bounds, for terrain meshes
+static ShapeRefC CookHeightField(const std::vector<Float3>& positions, const std::vector<uint32_t>& indices)
+{
+	if (positions.empty())
+	{
+		return nullptr;
+	}
+
+	Vec3 boundsMin = Vec3::sReplicate(FLT_MAX);
+	Vec3 boundsMax = Vec3::sReplicate(-FLT_MAX);
+	for (const Float3& position : positions)
+	{
+		boundsMin = Vec3::sMin(boundsMin, Vec3(position));
+		boundsMax = Vec3::sMax(boundsMax, Vec3(position));
+	}
+
+	const uint32_t n = HEIGHTFIELD_SAMPLE_COUNT;
+	const float cellX = std::max((boundsMax.GetX() - boundsMin.GetX()) / (n - 1), 1e-4f);
+	const float cellZ = std::max((boundsMax.GetZ() - boundsMin.GetZ()) / (n - 1), 1e-4f);
+	std::vector<float> samples(size_t(n) * n, -FLT_MAX);
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		const Float3& a = positions[indices[i]];
+		const Float3& b = positions[indices[i + 1]];
+		const Float3& c = positions[indices[i + 2]];
+		const float area = (b.x - a.x) * (c.z - a.z) - (c.x - a.x) * (b.z - a.z);
+		if (std::abs(area) < 1e-12f)
+		{
+			// vertical or degenerate, nothing to see from above
+			continue;
+		}
+
+		const int x0 = std::max(0, static_cast<int>(std::ceil((std::min({a.x, b.x, c.x}) - boundsMin.GetX()) / cellX)));
+		const int x1 = std::min(int(n) - 1, static_cast<int>(std::floor((std::max({a.x, b.x, c.x}) - boundsMin.GetX()) / cellX)));
+		const int z0 = std::max(0, static_cast<int>(std::ceil((std::min({a.z, b.z, c.z}) - boundsMin.GetZ()) / cellZ)));
+		const int z1 = std::min(int(n) - 1, static_cast<int>(std::floor((std::max({a.z, b.z, c.z}) - boundsMin.GetZ()) / cellZ)));
+		for (int z = z0; z <= z1; ++z)
+		{
+			const float pz = boundsMin.GetZ() + z * cellZ;
+			for (int x = x0; x <= x1; ++x)
+			{
+				const float px = boundsMin.GetX() + x * cellX;
+				const float wa = ((b.x - px) * (c.z - pz) - (c.x - px) * (b.z - pz)) / area;
+				const float wb = ((c.x - px) * (a.z - pz) - (a.x - px) * (c.z - pz)) / area;
+				const float wc = 1.0f - wa - wb;
+				if (wa < -1e-5f || wb < -1e-5f || wc < -1e-5f)
+				{
+					continue;
+				}
+				float& sample = samples[size_t(z) * n + x];
+				sample = std::max(sample, wa * a.y + wb * b.y + wc * c.y);
+			}
+		}
+	}
+
+	// holes where no triangle covers the grid
+	for (float& sample : samples)
+	{
+		if (sample == -FLT_MAX)
+		{
+			sample = HeightFieldShapeConstants::cNoCollisionValue;
+		}
+	}
+
+	HeightFieldShapeSettings settings(samples.data(), Vec3(boundsMin.GetX(), 0.0f, boundsMin.GetZ()), Vec3(cellX, 1.0f, cellZ), n);
+	ShapeSettings::ShapeResult result = settings.Create();
+	return result.IsValid() ? result.Get() : nullptr;
+}
+
+static void SaveShapeCache(const std::string& cacheFileName, const Shape& shape)
+{
+	// a crash never leaves a half written cache behind, two workers may cook the same mesh
+	Utilities::FileHelper::WriteFileAtomically(cacheFileName, [&shape](std::ostream& file)
+	{
+		StreamOutWrapper stream(file);
+		Shape::ShapeToIDMap shapeMap;
+		Shape::MaterialToIDMap materialMap;
+		shape.SaveWithChildren(stream, shapeMap, materialMap);
+		return !stream.IsFailed();
+	});
+}
+
+static ShapeRefC LoadShapeCache(const std::string& cacheFileName)
+{
+	std::ifstream file(cacheFileName, std::ios::binary);
+	if (!file.is_open())
+	{
+		return nullptr;
+	}
+	StreamInWrapper stream(file);
+	Shape::IDToShapeMap shapeMap;
+	Shape::IDToMaterialMap materialMap;
+	Shape::ShapeResult result = Shape::sRestoreWithChildren(stream, shapeMap, materialMap);
+	return result.IsValid() ? result.Get() : nullptr;
+}
+
 NextPhysics::NextPhysics()
 {
     
@@ -339,6 +575,9 @@ void NextPhysics::Tick(double DeltaSeconds)
 
 	float shouldTick = TimeOffset / cDeltaTime;
 
+	// consumers read it right after the step, don't replay it on frames without one
+	movedBodies_.clear();
+
 	if (shouldTick < 1.0f)
 	{
 		return;
@@ -349,26 +588,91 @@ void NextPhysics::Tick(double DeltaSeconds)
 
 	TimeSimulated += cDeltaTime * cCollisionSteps;
 
-	// Update bodies
-	BodyInterface &body_interface = context_->physics_system.GetBodyInterface();
-	
-	for (auto& body : bodies_)
+	// once per batch of added bodies, it's expensive
+	if (broadPhaseDirty_)
 	{
-		RVec3 pos = body_interface.GetPosition(body.first);
-		RVec3 vel = body_interface.GetLinearVelocity(body.first);
-		body.second.position = glm::vec3(pos.GetX(), pos.GetY(), pos.GetZ());
-		body.second.velocity = glm::vec3(vel.GetX(), vel.GetY(), vel.GetZ());
-
-		NextEngine::GetInstance()->GetScene().MarkDirty();
+		context_->physics_system.OptimizeBroadPhase();
+		broadPhaseDirty_ = false;
 	}
 
-	// Step the world
+	// Step the world, background tasks already running go on, idle workers only take physics jobs meanwhile
+	TaskCoordinator::GetInstance()->BeginCriticalSection();
 	context_->physics_system.Update(cDeltaTime, cCollisionSteps, &context_->temp_allocator, &context_->job_system);
+	TaskCoordinator::GetInstance()->EndCriticalSection();
+
+	SyncActiveBodies();
+}
+
+void NextPhysics::SyncActiveBodies()
+{
+	// sleeping and static bodies never show up here
+	BodyIDVector activeBodies;
+	context_->physics_system.GetActiveBodies(EBodyType::RigidBody, activeBodies);
+	{
+		std::lock_guard<std::mutex> lock(context_->body_activation_listener.mutex);
+		BodyIDVector& deactivated = context_->body_activation_listener.deactivatedBodies;
+		activeBodies.insert(activeBodies.end(), deactivated.begin(), deactivated.end());
+		deactivated.clear();
+	}
+
+	// the step is over, no need to lock
+	const BodyInterface &body_interface = context_->physics_system.GetBodyInterfaceNoLock();
+	for (const BodyID& bodyId : activeBodies)
+	{
+		auto it = bodies_.find(bodyId);
+		if (it == bodies_.end())
+		{
+			continue;
+		}
+
+		RVec3 pos;
+		Quat rot;
+		body_interface.GetPositionAndRotation(bodyId, pos, rot);
+		Vec3 vel = body_interface.GetLinearVelocity(bodyId);
+
+		FNextPhysicsBody& body = it->second;
+		const glm::vec3 position(pos.GetX(), pos.GetY(), pos.GetZ());
+		const glm::quat rotation(rot.GetW(), rot.GetX(), rot.GetY(), rot.GetZ());
+		body.velocity = glm::vec3(vel.GetX(), vel.GetY(), vel.GetZ());
+		if (position == body.position && rotation == body.rotation)
+		{
+			continue;
+		}
+		body.position = position;
+		body.rotation = rotation;
+		movedBodies_.push_back({ bodyId, body.nodeInstanceId, position, rotation });
+	}
+
+	if (movedBodies_.empty())
+	{
+		return;
+	}
+
+	Assets::Scene& scene = NextEngine::GetInstance()->GetScene();
+	for (const FNextPhysicsTransform& moved : movedBodies_)
+	{
+		Assets::Node* node = moved.nodeInstanceId != ~0u ? scene.GetNodeByInstanceId(moved.nodeInstanceId) : nullptr;
+		if (node != nullptr)
+		{
+			node->SetTranslation(moved.position);
+			node->SetRotation(moved.rotation);
+			node->RecalcTransform(true);
+		}
+	}
+
+	// one notification per step, not per body
+	scene.MarkDirty();
 }
 
 void NextPhysics::Stop()
 {
 	// OnSceneDestroyed();
+
+	// cook tasks still use the factory and write into the shape slots
+	for (auto& cooked : context_->cooked_shapes)
+	{
+		TaskCoordinator::GetInstance()->WaitForTask(cooked->taskId);
+	}
 	
 	// Unregisters all types with the factory and cleans up the default material
 	UnregisterTypes();
@@ -380,55 +684,228 @@ void NextPhysics::Stop()
 	context_.reset();
 }
 
-JPH::BodyID NextPhysics::AddBodyInternal(FNextPhysicsBody& body)
+JPH::BodyID NextPhysics::CreateSphereBody(glm::vec3 position, float radius, JPH::EMotionType motionType)
 {
-	bodies_[body.bodyID] = body;
-	context_->physics_system.OptimizeBroadPhase();
-	return body.bodyID;
+	const FNextBodyDesc desc { ENextBodyShape::Sphere, position, glm::vec3(radius), motionType };
+	std::vector<BodyID> bodyIds;
+	CreateBodies(std::span(&desc, 1), bodyIds);
+	return bodyIds[0];
 }
 
-JPH::BodyID NextPhysics::CreateSphereBody(glm::vec3 position, float radius, JPH::EMotionType motionType)
+JPH::BodyID NextPhysics::CreatePlaneBody(glm::vec3 position, glm::vec3 extent, JPH::EMotionType motionType)
+{
+	const FNextBodyDesc desc { ENextBodyShape::Box, position, extent, motionType };
+	std::vector<BodyID> bodyIds;
+	CreateBodies(std::span(&desc, 1), bodyIds);
+	return bodyIds[0];
+}
+
+void NextPhysics::CreateBodies(std::span<const FNextBodyDesc> descs, std::vector<JPH::BodyID>& outBodyIds)
 {
 	BodyInterface &body_interface = context_->physics_system.GetBodyInterface();
-	BodyID body_id(-1);
-
-	// Now create a dynamic body to bounce on the floor
-	// Note that this uses the shorthand version of creating and adding a body to the world
-	BodyCreationSettings sphere_settings(new SphereShape(radius), RVec3(position.x, position.y, position.z), Quat::sIdentity(), EMotionType::Dynamic, Layers::MOVING);
-	sphere_settings.mFriction = 0.25f;
-	body_id = body_interface.CreateAndAddBody(sphere_settings, EActivation::Activate);
-
-	// Now you can interact with the dynamic body, in this case we're going to give it a velocity.
-	// (note that if we had used CreateBody then we could have set the velocity straight on the body before adding it to the physics system)
-	//body_interface.SetLinearVelocity(body_id, Vec3(0.0f, -5.0f, 0.0f));
-	FNextPhysicsBody body { position, glm::vec3(0.0f, 0.0f, 0.0f), ENextBodyShape::Sphere, body_id };
-	return AddBodyInternal(body);
+
+	outBodyIds.clear();
+	outBodyIds.reserve(descs.size());
+	bodies_.reserve(bodies_.size() + descs.size());
+
+	// spheres of the same radius share one shape
+	std::unordered_map<float, ShapeRefC> sphereShapes;
+	// added in two batches, Prepare may reorder them so they are kept apart from outBodyIds
+	std::vector<BodyID> activeBodies;
+	std::vector<BodyID> inactiveBodies;
+	for (const FNextBodyDesc& desc : descs)
+	{
+		ShapeRefC shape;
+		if (desc.shape == ENextBodyShape::Sphere)
+		{
+			ShapeRefC& sphere = sphereShapes[desc.extent.x];
+			if (sphere == nullptr)
+			{
+				sphere = new SphereShape(desc.extent.x);
+			}
+			shape = sphere;
+		}
+		else
+		{
+			JPH_ASSERT(desc.shape == ENextBodyShape::Box, "only spheres and boxes for now");
+			shape = new BoxShape(Vec3(desc.extent.x, desc.extent.y, desc.extent.z));
+		}
+
+		const bool isStatic = desc.motionType == EMotionType::Static;
+		BodyCreationSettings settings(shape, RVec3(desc.position.x, desc.position.y, desc.position.z), Quat::sIdentity(), desc.motionType, isStatic ? Layers::NON_MOVING : Layers::MOVING);
+		settings.mFriction = 0.25f;
+		if (isStatic)
+		{
+			settings.mRestitution = 0.5f;
+		}
+
+		// null when out of bodies, the caller gets an invalid id
+		Body* body = body_interface.CreateBody(settings);
+		const BodyID bodyId = body != nullptr ? body->GetID() : BodyID();
+		outBodyIds.push_back(bodyId);
+		if (bodyId.IsInvalid())
+		{
+			continue;
+		}
+
+		(isStatic ? inactiveBodies : activeBodies).push_back(bodyId);
+		bodies_[bodyId] = FNextPhysicsBody { desc.position, glm::vec3(0.0f, 0.0f, 0.0f), desc.shape, bodyId };
+	}
+
+	auto addBatch = [&body_interface](std::vector<BodyID>& bodyIds, EActivation activation)
+	{
+		if (bodyIds.empty())
+		{
+			return;
+		}
+		BodyInterface::AddState state = body_interface.AddBodiesPrepare(bodyIds.data(), static_cast<int>(bodyIds.size()));
+		body_interface.AddBodiesFinalize(bodyIds.data(), static_cast<int>(bodyIds.size()), state, activation);
+	};
+	addBatch(activeBodies, EActivation::Activate);
+	addBatch(inactiveBodies, EActivation::DontActivate);
+
+	broadPhaseDirty_ = true;
 }
 
-JPH::BodyID NextPhysics::CreatePlaneBody(glm::vec3 position, glm::vec3 extent, JPH::EMotionType motionType)
+uint32_t NextPhysics::RequestModelShape(const Assets::Model& model, ENextBodyShape shape)
+{
+	JPH_ASSERT(shape == ENextBodyShape::ConvexHull || shape == ENextBodyShape::Mesh || shape == ENextBodyShape::HeightField, "only model based shapes are cooked");
+
+	// positions only, normals and uvs don't change the collision
+	const std::vector<Assets::Vertex>& vertices = model.CPUVertices();
+	std::vector<Float3> positions(vertices.size());
+	for (size_t v = 0; v < vertices.size(); ++v)
+	{
+		positions[v] = Float3(vertices[v].Position.x, vertices[v].Position.y, vertices[v].Position.z);
+	}
+	std::vector<uint32_t> indices = model.CPUIndices();
+
+	XXH64_hash_t hash = XXH64(positions.data(), positions.size() * sizeof(Float3), SHAPE_COOK_VERSION);
+	hash = XXH64(indices.data(), indices.size() * sizeof(uint32_t), hash);
+	hash = XXH64(&shape, sizeof(shape), hash);
+
+	auto found = context_->cooked_shape_by_hash.find(hash);
+	if (found != context_->cooked_shape_by_hash.end())
+	{
+		RedispatchShapeCook(*context_->cooked_shapes[found->second]);
+		return found->second;
+	}
+
+	const uint32_t shapeHandle = static_cast<uint32_t>(context_->cooked_shapes.size());
+	context_->cooked_shapes.push_back(std::make_unique<FNextCookedShape>());
+	context_->cooked_shape_by_hash[hash] = shapeHandle;
+
+	FNextCookedShape* cooked = context_->cooked_shapes.back().get();
+	cooked->type = shape;
+	cooked->hash = hash;
+	cooked->positions = std::move(positions);
+	cooked->indices = std::move(indices);
+	DispatchShapeCook(*cooked);
+	return shapeHandle;
+}
+
+void NextPhysics::DispatchShapeCook(FNextCookedShape& cooked)
 {
+	FNextCookedShape* target = &cooked;
+	cooked.taskId = TaskCoordinator::GetInstance()->AddParralledTask(
+		[target](ResTask& task)
+		{
+			FNextCookedShape& cooked = *target;
+			const char* cookType = cooked.type == ENextBodyShape::ConvexHull ? "physhull" : cooked.type == ENextBodyShape::Mesh ? "physmesh" : "physhf";
+			const std::string cacheFileName = Utilities::CookHelper::GetCookedFileName(fmt::format("{:016x}", cooked.hash), cookType);
+			cooked.shape = LoadShapeCache(cacheFileName);
+			if (cooked.shape == nullptr)
+			{
+				switch (cooked.type)
+				{
+				case ENextBodyShape::ConvexHull:
+					cooked.shape = CookConvexHull(cooked.positions);
+					break;
+				case ENextBodyShape::Mesh:
+					cooked.shape = CookMesh(cooked.positions, cooked.indices);
+					break;
+				default:
+					cooked.shape = CookHeightField(cooked.positions, cooked.indices);
+					break;
+				}
+
+				if (cooked.shape != nullptr)
+				{
+					SaveShapeCache(cacheFileName, *cooked.shape);
+				}
+			}
+
+			// a failed cook stays null, it is not retried
+			cooked.positions = {};
+			cooked.indices = {};
+			cooked.cooked = true;
+		}, nullptr);
+}
+
+bool NextPhysics::RedispatchShapeCook(FNextCookedShape& cooked)
+{
+	// task first, cooked is only set before the task finishes
+	if (!TaskCoordinator::GetInstance()->IsTaskFinished(cooked.taskId) || cooked.cooked)
+	{
+		return false;
+	}
+	DispatchShapeCook(cooked);
+	return true;
+}
+
+bool NextPhysics::IsShapeReady(uint32_t shapeHandle) const
+{
+	if (shapeHandle >= context_->cooked_shapes.size())
+	{
+		return false;
+	}
+	FNextCookedShape& cooked = *context_->cooked_shapes[shapeHandle];
+	return TaskCoordinator::GetInstance()->IsTaskFinished(cooked.taskId) && !RedispatchShapeCook(cooked);
+}
+
+JPH::BodyID NextPhysics::CreateModelBody(uint32_t shapeHandle, glm::vec3 position, glm::quat rotation, glm::vec3 scale, JPH::EMotionType motionType)
+{
+	if (shapeHandle >= context_->cooked_shapes.size())
+	{
+		return BodyID();
+	}
+
+	FNextCookedShape& cooked = *context_->cooked_shapes[shapeHandle];
+	do
+	{
+		TaskCoordinator::GetInstance()->WaitForTask(cooked.taskId);
+	} while (RedispatchShapeCook(cooked));
+	if (cooked.shape == nullptr)
+	{
+		return BodyID();
+	}
+
+	// meshes and heightfields have no volume, they can't be simulated
+	if (cooked.type != ENextBodyShape::ConvexHull)
+	{
+		motionType = EMotionType::Static;
+	}
+
+	ShapeRefC shape = cooked.shape;
+	if (scale != glm::vec3(1.0f))
+	{
+		shape = new ScaledShape(shape, Vec3(scale.x, scale.y, scale.z));
+	}
+
+	const bool isStatic = motionType == EMotionType::Static;
+	BodyCreationSettings settings(shape, RVec3(position.x, position.y, position.z), Quat(rotation.x, rotation.y, rotation.z, rotation.w), motionType, isStatic ? Layers::NON_MOVING : Layers::MOVING);
+	settings.mFriction = 0.25f;
+
 	BodyInterface &body_interface = context_->physics_system.GetBodyInterface();
-	BodyID body_id(-1);
-	
-	// Next we can create a rigid body to serve as the floor, we make a large box
-	// Create the settings for the collision volume (the shape).
-	// Note that for simple shapes (like boxes) you can also directly construct a BoxShape.
-	BoxShapeSettings floor_shape_settings(Vec3(extent.x, extent.y, extent.z));
-	floor_shape_settings.SetEmbedded(); // A ref counted object on the stack (base class RefTarget) should be marked as such to prevent it from being freed when its reference count goes to 0.
-
-	// Create the shape
-	ShapeSettings::ShapeResult floor_shape_result = floor_shape_settings.Create();
-	ShapeRefC floor_shape = floor_shape_result.Get(); // We don't expect an error here, but you can check floor_shape_result for HasError() / GetError()
-
-	// Create the settings for the body itself. Note that here you can also set other properties like the restitution / friction.
-	BodyCreationSettings floor_settings(floor_shape, RVec3(position.x, position.y, position.z), Quat::sIdentity(), EMotionType::Static, Layers::NON_MOVING);
-	floor_settings.mRestitution = 0.5f;
-	floor_settings.mFriction = 0.25f;
-	// Create the actual rigid body
-	body_id = body_interface.CreateAndAddBody(floor_settings, EActivation::DontActivate);
-
-	FNextPhysicsBody body { position, glm::vec3(0.0f, 0.0f, 0.0f), ENextBodyShape::Box, body_id };
-	return AddBodyInternal(body);
+	const BodyID bodyId = body_interface.CreateAndAddBody(settings, isStatic ? EActivation::DontActivate : EActivation::Activate);
+	if (bodyId.IsInvalid())
+	{
+		return bodyId;
+	}
+
+	bodies_[bodyId] = FNextPhysicsBody { position, glm::vec3(0.0f, 0.0f, 0.0f), cooked.type, bodyId, rotation };
+	broadPhaseDirty_ = true;
+	return bodyId;
 }
 
 FNextPhysicsBody* NextPhysics::GetBody(JPH::BodyID bodyID)
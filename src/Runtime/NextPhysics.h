@@ -1,7 +1,10 @@
 ﻿#pragma once
 
 #include <memory>
+#include <span>
+#include <vector>
 #include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
 
 #include <Jolt/Jolt.h>
 #include <Jolt/Physics/Body/BodyID.h>
@@ -10,6 +13,12 @@
 #include "Vulkan/Vulkan.hpp"
 
 struct FNextPhysicsContext;
+struct FNextCookedShape;
+
+namespace Assets
+{
+    class Model;
+}
 
 enum class ENextBodyShape
 {
@@ -31,6 +40,27 @@ struct FNextPhysicsBody
     glm::vec3 velocity;
     ENextBodyShape shape;
     JPH::BodyID bodyID;
+    glm::quat rotation {1.0f, 0.0f, 0.0f, 0.0f};
+    // the node driven by this body, see Node::BindPhysicsBody
+    uint32_t nodeInstanceId {~0u};
+};
+
+// a body that moved in the last step
+struct FNextPhysicsTransform
+{
+    JPH::BodyID bodyID;
+    uint32_t nodeInstanceId;
+    glm::vec3 position;
+    glm::quat rotation;
+};
+
+// one body of a batch, spheres use extent.x as radius, boxes use extent as half extent
+struct FNextBodyDesc
+{
+    ENextBodyShape shape;
+    glm::vec3 position;
+    glm::vec3 extent;
+    JPH::EMotionType motionType;
 };
 
 class NextPhysics final
@@ -48,16 +78,38 @@ public:
     JPH::BodyID CreateSphereBody(glm::vec3 position, float radius, JPH::EMotionType motionType);
     JPH::BodyID CreatePlaneBody(glm::vec3 position, glm::vec3 extent, JPH::EMotionType motionType);
 
+    // creates the bodies and adds them to the broadphase as one batch, ids are in the order of descs.
+    // the broadphase is optimized once before the next step, no matter how many bodies were added
+    void CreateBodies(std::span<const FNextBodyDesc> descs, std::vector<JPH::BodyID>& outBodyIds);
+
+    // ConvexHull, Mesh or HeightField shape of the model cpu data, cooked on a worker and cached in the cooked folder
+    // by mesh hash. returns a shape handle right away, the same mesh and shape share one handle
+    uint32_t RequestModelShape(const Assets::Model& model, ENextBodyShape shape);
+    bool IsShapeReady(uint32_t shapeHandle) const;
+    // waits for the cook if not done yet, invalid id if cooking failed. Mesh and HeightField bodies are always static
+    JPH::BodyID CreateModelBody(uint32_t shapeHandle, glm::vec3 position, glm::quat rotation, glm::vec3 scale, JPH::EMotionType motionType);
+
     FNextPhysicsBody* GetBody(JPH::BodyID bodyID);
 
+    // bodies that moved in the last step, dense, only active bodies and the ones just gone to sleep
+    const std::vector<FNextPhysicsTransform>& GetMovedBodies() const { return movedBodies_; }
+
     void OnSceneStarted();
     void OnSceneDestroyed();
 private:
+    // read back the active bodies after a step and write the moved ones to their nodes
+    void SyncActiveBodies();
+    static void DispatchShapeCook(FNextCookedShape& cooked);
+    // the cook task was canceled before it ran, the shape stays null while the task counts as finished.
+    // cooks it again under the same handle, returns true if it did
+    static bool RedispatchShapeCook(FNextCookedShape& cooked);
 
-    JPH::BodyID AddBodyInternal(FNextPhysicsBody& body);
     
     std::unique_ptr<FNextPhysicsContext> context_;
     std::unordered_map<JPH::BodyID, FNextPhysicsBody> bodies_;
+    std::vector<FNextPhysicsTransform> movedBodies_;
+
+    bool broadPhaseDirty_ {};
 
     double TimeElapsed {};
     double TimeSimulated {};
@@ -38,6 +38,10 @@ namespace
     {
         models.push_back(Model::CreateSphere(vec3(0,0,0), 0.2f));
         uint32_t meshIdx = static_cast<uint32_t>(models.size() - 1);
+
+        // bodies are created in one batch after the loop
+        std::vector<FNextBodyDesc> bodyDescs;
+        std::vector<size_t> bodyNodes;
         for (int i = -22; i < 22; ++i)
         {
             for (int j = -22; j < 22; ++j)
@@ -66,7 +70,7 @@ namespace
                 
                 if (length(center - vec3(4, 0.2f, 0)) > 0.9f)
                 {
-                    auto id = NextEngine::GetInstance()->GetPhysicsEngine()->CreateSphereBody(center, 0.2f, JPH::EMotionType::Dynamic);
+                    bodyDescs.push_back({ ENextBodyShape::Sphere, center, vec3(0.2f), JPH::EMotionType::Dynamic });
                     
                     if (chooseMat < 0.7f) // Diffuse
                     {
@@ -115,10 +119,17 @@ namespace
                         nodes.back()->SetVisible(true);
                         nodes.back()->SetMaterial({matId});
                     }
-                    nodes.back()->BindPhysicsBody(id);
+                    bodyNodes.push_back(nodes.size() - 1);
                 }
             }
         }
+
+        std::vector<JPH::BodyID> bodyIds;
+        NextEngine::GetInstance()->GetPhysicsEngine()->CreateBodies(bodyDescs, bodyIds);
+        for (size_t i = 0; i < bodyIds.size(); ++i)
+        {
+            nodes[bodyNodes[i]]->BindPhysicsBody(bodyIds[i]);
+        }
     }
 
     void RayTracingInOneWeekend(Assets::EnvironmentSetting& cameraInit, std::vector<std::shared_ptr<Assets::Node>>& nodes,
@@ -229,6 +240,10 @@ namespace
         nodes.back()->SetMaterial({prev_mat_id + 4});
         nodes.back()->SetVisible(true);
 
+        // the box collides as a hull cooked from its mesh, cached in the cooked folder after the first run
+        uint32_t boxShape = NextEngine::GetInstance()->GetPhysicsEngine()->RequestModelShape(box0, ENextBodyShape::ConvexHull);
+        NextEngine::GetInstance()->GetPhysicsEngine()->CreateModelBody(boxShape, boxPos, quat(vec3(0, 0.25f, 0)), vec3(1, 2, 1), JPH::EMotionType::Static);
+
         // create physical scene, later it will change to node components later
         NextEngine::GetInstance()->GetPhysicsEngine()->CreatePlaneBody(vec3(0, -1, 0), vec3(8, 1, 8), JPH::EMotionType::Static);
         
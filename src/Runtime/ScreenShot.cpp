@@ -16,6 +16,36 @@
 
 namespace ScreenShot
 {
+    namespace
+    {
+        constexpr uint32_t kJpgCompCnt = 3;
+
+        // crops the b8g8r8a8 rows of srcWidth pixels to extent at (inX, inY), packed r8g8b8 out
+        void SwizzleBGRAToRGB(const uint8_t* src, uint32_t srcWidth, int inX, int inY, VkExtent2D extent, uint8_t* dst)
+        {
+            for (uint32_t y = 0; y < extent.height; y++)
+            {
+                const uint8_t* srcRow = src + ((inY + y) * srcWidth + inX) * 4;
+                uint8_t* dstRow = dst + y * extent.width * kJpgCompCnt;
+                for (uint32_t x = 0; x < extent.width; x++)
+                {
+                    dstRow[x * kJpgCompCnt] = srcRow[x * 4 + 2];
+                    dstRow[x * kJpgCompCnt + 1] = srcRow[x * 4 + 1];
+                    dstRow[x * kJpgCompCnt + 2] = srcRow[x * 4];
+                }
+            }
+        }
+
+        void SaveBGRAToJpg(const uint8_t* src, uint32_t srcWidth, int inX, int inY, VkExtent2D extent, const std::string& filePathWithoutExtension)
+        {
+            uint8_t* dataview = (uint8_t*)malloc(extent.width * extent.height * kJpgCompCnt);
+            SwizzleBGRAToRGB(src, srcWidth, inX, inY, extent, dataview);
+            std::string filename = filePathWithoutExtension + ".jpg";
+            stbi_write_jpg(filename.c_str(), extent.width, extent.height, kJpgCompCnt, dataview, 91);
+            free(dataview);
+        }
+    }
+
     void SaveSwapChainToFileFast(Vulkan::VulkanBaseRenderer* renderer_, const std::string& filePathWithoutExtension, int inX, int inY, int inWidth, int inHeight)
     {
         // screenshot stuffs
@@ -32,12 +62,7 @@ namespace ScreenShot
         // capture and export
         renderer_->CaptureScreenShot();
     
-        uint32_t dataBytes = 0;
-        uint32_t rowBytes = 0;
-        constexpr uint32_t kCompCnt = 3;
-        dataBytes = extent.width * extent.height * kCompCnt;
         uint32_t rawDataBytes = extent.width * extent.height * 4;
-        rowBytes = extent.width * 3 * sizeof(uint8_t);
     
         Vulkan::DeviceMemory* vkMemory = renderer_->GetScreenShotMemory();
         uint8_t* mappedGPUData = (uint8_t*)vkMemory->Map(0, VK_WHOLE_SIZE);
@@ -46,41 +71,7 @@ namespace ScreenShot
         vkMemory->Unmap();
         TaskCoordinator::GetInstance()->AddTask([=](ResTask& task)->void
         {
-            uint8_t* dataview = (uint8_t*)malloc(dataBytes);
-            {
-                uint32_t yDelta = extent.width * kCompCnt;
-                uint32_t xDelta = kCompCnt;
-                uint32_t srcYDelta = orgExtent.width * 4;
-                uint32_t srcXDelta = 4;
-            
-                uint32_t yy = 0;
-                uint32_t xx = 0;
-                uint32_t srcY = inY * srcYDelta;
-                uint32_t srcX = inX * srcXDelta;
-            
-                for (uint32_t y = 0; y < extent.height; y++)
-                {
-                    xx = 0;
-                    srcX = inX * srcXDelta;
-                    for (uint32_t x = 0; x < extent.width; x++)
-                    {
-                        uint32_t* pInPixel = (uint32_t*)&mappedData[srcY + srcX];
-                        uint32_t uInPixel = *pInPixel;
-                        dataview[yy + xx] = (uInPixel & (0b11111111 << 16)) >> 16;
-                        dataview[yy + xx + 1] = (uInPixel & (0b11111111 << 8)) >> 8;
-                        dataview[yy + xx + 2] = (uInPixel & (0b11111111 << 0)) >> 0;
-        
-                        srcX += srcXDelta;
-                        xx += xDelta;
-                    }
-                    srcY += srcYDelta;
-                    yy += yDelta;
-                }
-            }
-            std::string filename = filePathWithoutExtension + ".jpg";
-            stbi_write_jpg(filename.c_str(), extent.width, extent.height, kCompCnt, dataview, 91);
-        
-            free(dataview);
+            SaveBGRAToJpg(mappedData, orgExtent.width, inX, inY, extent, filePathWithoutExtension);
             free(mappedData);
         },
         [](ResTask& task)
@@ -89,6 +80,22 @@ namespace ScreenShot
         },1);
     }
 
+    void SavePixelsToFile(const uint8_t* pixels, uint32_t width, uint32_t height, const std::string& filePathWithoutExtension)
+    {
+        const uint32_t pixelCount = width * height;
+        uint8_t* rawData = (uint8_t*)malloc(pixelCount * 4);
+        memcpy(rawData, pixels, pixelCount * 4);
+        TaskCoordinator::GetInstance()->AddTask([=](ResTask& task)->void
+        {
+            SaveBGRAToJpg(rawData, width, 0, 0, {width, height}, filePathWithoutExtension);
+            free(rawData);
+        },
+        [](ResTask& task)
+        {
+
+        },1);
+    }
+
     void SaveSwapChainToFile(Vulkan::VulkanBaseRenderer* renderer_, const std::string& filePathWithoutExtension, int inX, int inY, int inWidth, int inHeight)
     {
         // screenshot stuffs
@@ -162,38 +169,10 @@ namespace ScreenShot
             rowBytes = extent.width * 3 * sizeof(uint8_t);
             data = malloc(dataBytes);
             
-            uint8_t* dataview = (uint8_t*)data;
             {
                 Vulkan::DeviceMemory* vkMemory = renderer_->GetScreenShotMemory();
-                uint8_t* mappedData = (uint8_t*)vkMemory->Map(0, VK_WHOLE_SIZE);
-                uint32_t yDelta = extent.width * kCompCnt;
-                uint32_t xDelta = kCompCnt;
-                uint32_t srcYDelta = orgExtent.width * 4;
-                uint32_t srcXDelta = 4;
-            
-                uint32_t yy = 0;
-                uint32_t xx = 0;
-                uint32_t srcY = inY * srcYDelta;
-                uint32_t srcX = inX * srcXDelta;
-            
-                for (uint32_t y = 0; y < extent.height; y++)
-                {
-                    xx = 0;
-                    srcX = inX * srcXDelta;
-                    for (uint32_t x = 0; x < extent.width; x++)
-                    {
-                        uint32_t* pInPixel = (uint32_t*)&mappedData[srcY + srcX];
-                        uint32_t uInPixel = *pInPixel;
-                        dataview[yy + xx] = (uInPixel & (0b11111111 << 16)) >> 16;
-                        dataview[yy + xx + 1] = (uInPixel & (0b11111111 << 8)) >> 8;
-                        dataview[yy + xx + 2] = (uInPixel & (0b11111111 << 0)) >> 0;
-
-                        srcX += srcXDelta;
-                        xx += xDelta;
-                    }
-                    srcY += srcYDelta;
-                    yy += yDelta;
-                }
+                const uint8_t* mappedData = (const uint8_t*)vkMemory->Map(0, VK_WHOLE_SIZE);
+                SwizzleBGRAToRGB(mappedData, orgExtent.width, inX, inY, extent, (uint8_t*)data);
                 vkMemory->Unmap();
             }
         }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 
 namespace Vulkan
@@ -11,4 +12,6 @@ namespace ScreenShot
 {
 	void SaveSwapChainToFileFast(Vulkan::VulkanBaseRenderer* renderer_, const std::string& filePathWithoutExtension, int x, int y, int width, int height);
 	void SaveSwapChainToFile(Vulkan::VulkanBaseRenderer* renderer_, const std::string& filePathWithoutExtension, int x, int y, int width, int height);
+	// b8g8r8a8 pixels already on the host, e.g. a headless readback. copied before returning, encoded on a worker
+	void SavePixelsToFile(const uint8_t* pixels, uint32_t width, uint32_t height, const std::string& filePathWithoutExtension);
 };
\ No newline at end of file
@@ -1,36 +1,36 @@
 #include "TaskCoordinator.hpp"
+#include "Utilities/Exception.hpp"
 
 #include <chrono>
 
 TaskThread::TaskThread(TaskCoordinator* coordinator)
 {
-    complete_.reset(new event_signal());
-    terminate_.reset(new event_signal());
-    thread_.reset(new std::thread([this] {
-        while (true)
+    thread_.reset(new std::thread([this, coordinator] {
+        ResTaskPtr task;
+        // block until a task arrives, quit when closed and drained
+        while (taskQueue_.dequeue(task, true))
         {
-            if(terminate_->is_set())
-            {
-                break;
-            }
-
-            ResTask task;
-            if (taskQueue_.dequeue(task, false))
-            {
-                task.task_func(task);
+            task->task_func(*task);
+            coordinator->FinishTask(task->task_id);
 
-                // sync add to mainthread complete queue
-                TaskCoordinator::GetInstance()->MarkTaskComplete(task);
-            }
-            else
-            {
-                complete_->set();
-                std::this_thread::sleep_for(std::chrono::milliseconds(1));
-            }
+            // sync add to mainthread complete queue
+            coordinator->MarkTaskComplete(task);
         }
     }));
 }
 
+TaskWorker::TaskWorker(TaskCoordinator* coordinator, int32_t workerIdx)
+{
+    thread_.reset(new std::thread([coordinator, workerIdx] {
+        coordinator->WorkerLoop(workerIdx);
+    }));
+}
+
+TaskWorker::~TaskWorker()
+{
+    thread_->join();
+}
+
 void TaskCoordinator::TestCase()
 {
     TaskCoordinator taskCoordinator;
@@ -38,49 +38,358 @@ void TaskCoordinator::TestCase()
 
 uint32_t TaskCoordinator::AddTask( ResTask::TaskFunc task_func, ResTask::TaskFunc complete_func, uint8_t priority)
 {
-    static uint32_t task_id = 0;
-    ResTask task;
-    task.task_id = task_id++;
-    task.priority = priority;
-    task.task_func = std::move(task_func);
-    task.complete_func = std::move(complete_func);
+    ResTaskPtr task = AcquireResTask();
+    task->task_id = nextTaskId_++;
+    task->priority = priority;
+    task->task_func = std::move(task_func);
+    task->complete_func = std::move(complete_func);
+    uint32_t taskId = task->task_id;
+    RegisterTask(task, {}, nullptr);
 #if __APPLE__
-    mainthreadTaskQueue_.enqueue(task);
-    return task.task_id;
+    mainthreadTaskQueue_.enqueue(std::move(task));
+    return taskId;
 #endif
-    threads_[priority]->taskQueue_.enqueue(task);
-    return task.task_id;
+    threads_[priority]->taskQueue_.enqueue(std::move(task));
+    return taskId;
 }
 
 uint32_t TaskCoordinator::AddParralledTask(ResTask::TaskFunc task_func, ResTask::TaskFunc complete_func)
 {
-    static uint32_t task_id = 0;
-    ResTask task;
-    task.task_id = task_id++;
-    task.priority = 3;
-    task.task_func = std::move(task_func);
-    task.complete_func = std::move(complete_func);
+    return AddParralledTask(std::move(task_func), std::move(complete_func), {}, nullptr);
+}
+
+uint32_t TaskCoordinator::AddParralledTask(ResTask::TaskFunc task_func, ResTask::TaskFunc complete_func,
+    const std::vector<uint32_t>& dependencies, std::shared_ptr<TaskCounter> counter)
+{
+    ResTaskPtr task = AcquireResTask();
+    task->task_id = nextTaskId_++;
+    task->priority = 3;
+    task->task_func = std::move(task_func);
+    task->complete_func = std::move(complete_func);
+    uint32_t taskId = task->task_id;
+
+    // parked tasks count as pending, WaitForAllParralledTask waits for them too
+    pendingParralledTasks_++;
+    if (RegisterTask(task, dependencies, std::move(counter)))
+    {
+        EnqueueParralledTask(std::move(task));
+    }
+
+    return taskId;
+}
+
+void TaskCoordinator::AddDetachedTask(ResTask::TaskFunc task_func)
+{
+    ResTaskPtr task = AcquireResTask();
+    task->task_id = 0;
+    task->priority = 3;
+    task->detached = true;
+    task->task_func = std::move(task_func);
+
+    pendingParralledTasks_++;
+    queuedDetachedTasks_++;
+    detachedTaskQueue_.enqueue(std::move(task));
+
+    {
+        std::lock_guard<std::mutex> lock(workerMutex_);
+    }
+    workerSignal_.notify_one();
+}
+
+void TaskCoordinator::BeginCriticalSection()
+{
+    criticalSections_++;
+}
 
-    parralledTaskQueue_.enqueue(task);
+void TaskCoordinator::EndCriticalSection()
+{
+    if (--criticalSections_ == 0 && queuedParralledTasks_.load() > 0)
+    {
+        // workers skipped the queued tasks meanwhile, wake them up
+        {
+            std::lock_guard<std::mutex> lock(workerMutex_);
+        }
+        workerSignal_.notify_all();
+    }
+}
 
-    return task.task_id;
+uint32_t TaskCoordinator::AddFence(const std::vector<uint32_t>& dependencies, ResTask::TaskFunc complete_func, std::shared_ptr<TaskCounter> counter)
+{
+    return AddParralledTask([](ResTask& task) {}, std::move(complete_func), dependencies, std::move(counter));
+}
+
+bool TaskCoordinator::RegisterTask(ResTaskPtr& task, const std::vector<uint32_t>& dependencies, std::shared_ptr<TaskCounter> counter)
+{
+    if (counter)
+    {
+        counter->count_++;
+    }
+
+    task->owner = counter.get();
+    std::lock_guard<std::mutex> lock(graphMutex_);
+    unfinishedTasks_[task->task_id].counter = std::move(counter);
+    unendedTaskIds_.insert(task->task_id);
+
+    uint32_t remainDependencies = 0;
+    for (uint32_t dependency : dependencies)
+    {
+        auto it = unfinishedTasks_.find(dependency);
+        if (it != unfinishedTasks_.end() && dependency != task->task_id)
+        {
+            it->second.successors.push_back(task->task_id);
+            remainDependencies++;
+        }
+    }
+
+    if (remainDependencies > 0)
+    {
+        uint32_t taskId = task->task_id;
+        parkedTasks_[taskId] = { std::move(task), remainDependencies };
+        return false;
+    }
+    return true;
+}
+
+void TaskCoordinator::FinishTask(uint32_t task_id)
+{
+    std::vector<ResTaskPtr> readyTasks;
+    std::shared_ptr<TaskCounter> counter;
+    {
+        std::lock_guard<std::mutex> lock(graphMutex_);
+        auto it = unfinishedTasks_.find(task_id);
+        if (it == unfinishedTasks_.end())
+        {
+            return;
+        }
+
+        counter = std::move(it->second.counter);
+        for (uint32_t successor : it->second.successors)
+        {
+            auto parked = parkedTasks_.find(successor);
+            if (parked != parkedTasks_.end() && --parked->second.remainDependencies == 0)
+            {
+                readyTasks.push_back(std::move(parked->second.task));
+                parkedTasks_.erase(parked);
+            }
+        }
+        unfinishedTasks_.erase(it);
+    }
+
+    // continuations go straight to the pool
+    for (auto& readyTask : readyTasks)
+    {
+        EnqueueParralledTask(std::move(readyTask));
+    }
+
+    if (counter)
+    {
+        counter->count_--;
+    }
+
+    if (finishWaiters_.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(workerMutex_);
+        finishSignal_.notify_all();
+    }
+}
+
+void TaskCoordinator::EnqueueParralledTask(ResTaskPtr task)
+{
+    queuedParralledTasks_++;
+
+    // submitted from a worker, keep it local, others will steal it if they starve
+    int32_t workerIdx = currentWorkerIdx_;
+    if (workerIdx < 0 || workerIdx >= int32_t(workers_.size()))
+    {
+        workerIdx = int32_t(nextWorkerIdx_++ % workers_.size());
+    }
+    workers_[workerIdx]->taskDeque_.push(std::move(task));
+
+    {
+        std::lock_guard<std::mutex> lock(workerMutex_);
+    }
+    workerSignal_.notify_one();
+}
+
+bool TaskCoordinator::AcquireParralledTask(int32_t workerIdx, ResTaskPtr& task, bool takeDetached)
+{
+    if (takeDetached && queuedDetachedTasks_.load() > 0 && detachedTaskQueue_.dequeue(task, false))
+    {
+        queuedDetachedTasks_--;
+        return true;
+    }
+    if (criticalSections_.load() > 0)
+    {
+        return false;
+    }
+
+    const int32_t workerCount = int32_t(workers_.size());
+    if (workerIdx >= 0 && workerIdx < workerCount && workers_[workerIdx]->taskDeque_.pop(task))
+    {
+        queuedParralledTasks_--;
+        return true;
+    }
+
+    int32_t start = workerIdx >= 0 ? workerIdx : int32_t(nextWorkerIdx_.load() % workerCount);
+    for (int32_t i = 1; i <= workerCount; ++i)
+    {
+        int32_t victim = (start + i) % workerCount;
+        if (workers_[victim]->taskDeque_.steal(task))
+        {
+            queuedParralledTasks_--;
+            return true;
+        }
+    }
+    return false;
+}
+
+void TaskCoordinator::RunParralledTask(ResTaskPtr& task)
+{
+    runningParralledTasks_++;
+    task->task_func(*task);
+    runningParralledTasks_--;
+    if (!task->detached)
+    {
+        FinishTask(task->task_id);
+
+        // sync add to mainthread complete queue
+        MarkTaskComplete(task);
+    }
+    task.reset();
+
+    if (--pendingParralledTasks_ <= 0)
+    {
+        std::lock_guard<std::mutex> lock(workerMutex_);
+        finishSignal_.notify_all();
+    }
+}
+
+void TaskCoordinator::WorkerLoop(int32_t workerIdx)
+{
+    currentWorkerIdx_ = workerIdx;
+    while (true)
+    {
+        ResTaskPtr task;
+        if (AcquireParralledTask(workerIdx, task, true))
+        {
+            RunParralledTask(task);
+            continue;
+        }
+
+        // nothing to run or steal, sleep until new task submitted
+        std::unique_lock<std::mutex> lock(workerMutex_);
+        workerSignal_.wait(lock, [this]() {
+            return shutdown_ || queuedDetachedTasks_.load() > 0 || (criticalSections_.load() == 0 && queuedParralledTasks_.load() > 0);
+        });
+        if (shutdown_)
+        {
+            break;
+        }
+    }
+}
+
+template <typename Pred>
+void TaskCoordinator::HelpUntil(Pred pred)
+{
+    finishWaiters_++;
+    while( !pred() )
+    {
+        // help the pool instead of idle waiting, this also make it safe to wait inside a task.
+        // detached tasks are left to the idle workers, the waiter may be the main thread mid frame,
+        // a detached job waiting on something this thread still has to do would never return.
+        // the jolt barrier wait runs its own jobs and does not come through here
+        ResTaskPtr task;
+        if (AcquireParralledTask(currentWorkerIdx_, task, false))
+        {
+            RunParralledTask(task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(workerMutex_);
+        finishSignal_.wait_for(lock, std::chrono::milliseconds(1), pred);
+    }
+    finishWaiters_--;
 }
 
 void TaskCoordinator::WaitForAllParralledTask()
 {
-    while( parralledTaskQueue_.size() > 0 )
+    // a task waiting for all tasks waits for itself, and two of them wait for each other. wait for a counter instead
+    if (runningParralledTasks_ > 0)
+    {
+        Throw(std::logic_error("WaitForAllParralledTask called inside a parralled task, use WaitForCounter"));
+    }
+    HelpUntil([this]() { return pendingParralledTasks_.load() <= 0; });
+}
+
+bool TaskCoordinator::IsTaskFinished(uint32_t task_id)
+{
+    std::lock_guard<std::mutex> lock(graphMutex_);
+    return !unfinishedTasks_.contains(task_id);
+}
+
+void TaskCoordinator::WaitForTask(uint32_t task_id)
+{
+    HelpUntil([this, task_id]() { return IsTaskFinished(task_id); });
+}
+
+void TaskCoordinator::WaitForCounter(const std::shared_ptr<TaskCounter>& counter)
+{
+    if (counter)
     {
-        Tick();
-        std::this_thread::sleep_for(std::chrono::milliseconds(0));
+        HelpUntil([&counter]() { return counter->IsZero(); });
     }
-    
-    // wait for all idle
-    while( !IsAllParralledTaskComplete() )
+}
+
+void TaskCoordinator::CancelTasks(const std::shared_ptr<TaskCounter>& counter)
+{
+    if (counter)
     {
-        std::this_thread::sleep_for(std::chrono::milliseconds(0));
+        CancelParralledTasks(counter.get());
     }
 }
 
+void TaskCoordinator::CancelParralledTasks(const TaskCounter* owner)
+{
+    auto owned = [owner](const ResTaskPtr& task) { return owner == nullptr || task->owner == owner; };
+
+    std::vector<ResTaskPtr> canceledTasks;
+    for ( auto& worker : workers_ )
+    {
+        worker->taskDeque_.drain_if(owned, canceledTasks);
+    }
+    queuedParralledTasks_ -= int32_t(canceledTasks.size());
+
+    {
+        std::lock_guard<std::mutex> lock(graphMutex_);
+        for (auto it = parkedTasks_.begin(); it != parkedTasks_.end(); )
+        {
+            if (owned(it->second.task))
+            {
+                canceledTasks.push_back(std::move(it->second.task));
+                it = parkedTasks_.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    // canceled tasks never run, drop them from the graph. successors of other owners are released
+    // as if the task had finished, so nobody else waits forever
+    for (auto& task : canceledTasks)
+    {
+        FinishTask(task->task_id);
+        MarkTaskEnd(*task);
+    }
+
+    if (!canceledTasks.empty())
+    {
+        pendingParralledTasks_ -= int32_t(canceledTasks.size());
+        std::lock_guard<std::mutex> lock(workerMutex_);
+        finishSignal_.notify_all();
+    }
+}
 
 uint32_t TaskCoordinator::GetMainTaskCount()
 {
@@ -98,9 +407,10 @@ uint32_t TaskCoordinator::GetMainTaskCount()
 
 bool TaskCoordinator::IsAllTaskComplete(std::vector<uint32_t>& tasks)
 {
+    std::lock_guard<std::mutex> lock(graphMutex_);
     for (uint32_t task_id : tasks)
     {
-        if ( !completedTaskIds_.contains(task_id) )
+        if ( unendedTaskIds_.contains(task_id) )
         {
             return false;
         }
@@ -110,16 +420,14 @@ bool TaskCoordinator::IsAllTaskComplete(std::vector<uint32_t>& tasks)
 
 void TaskCoordinator::Tick()
 {
-    ResTask task;
+    ResTaskPtr task;
     if( mainthreadTaskQueue_.dequeue(task, false))
     {
-        task.task_func(task);
-        if(task.complete_func != nullptr)
-        {
-            MarkTaskComplete(task);
-        }
+        task->task_func(*task);
+        FinishTask(task->task_id);
+        MarkTaskComplete(task);
     }
-    
+
     auto startTime = std::chrono::high_resolution_clock::now();
     while (completeTaskQueue_.size() > 0)
     {
@@ -133,26 +441,15 @@ void TaskCoordinator::Tick()
 
         if (completeTaskQueue_.dequeue(task, false))
         {
-            if (task.complete_func != nullptr)
-            {
-                task.complete_func(task);
-            }
-            MarkTaskEnd(task);
-        }
-    }
-
-    // if low threads has idle one, peak a task from parralled queue
-    for ( auto& thread : lowThreads_ )
-    {
-        if( thread->IsIdle() )
-        {
-            if( parralledTaskQueue_.dequeue(task, false) )
+            if (task->complete_func != nullptr)
             {
-                thread->complete_->reset();
-                thread->taskQueue_.enqueue(task);
+                task->complete_func(*task);
             }
+            MarkTaskEnd(*task);
         }
     }
 }
 
-std::unique_ptr<TaskCoordinator> TaskCoordinator::instance_;
\ No newline at end of file
+std::unique_ptr<TaskCoordinator> TaskCoordinator::instance_;
+thread_local int32_t TaskCoordinator::currentWorkerIdx_ = -1;
+thread_local int32_t TaskCoordinator::runningParralledTasks_ = 0;
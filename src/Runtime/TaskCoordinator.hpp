@@ -3,11 +3,16 @@
 #include <mutex>
 #include <condition_variable>
 #include <queue>
+#include <deque>
 #include <thread>
 #include <atomic>
 #include <fmt/format.h>
 #include <cstring>
+#include <memory>
+#include <new>
+#include <type_traits>
 #include <unordered_set>
+#include <unordered_map>
 
 namespace details
 {
@@ -163,7 +168,7 @@ public:
     void enqueue(T t)
     {
         std::lock_guard<std::mutex> lock(m);
-        q.push(t);
+        q.push(std::move(t));
         c.notify_one();
     }
     
@@ -174,62 +179,362 @@ public:
     }
     
     // Get the front element.
-    // If the queue is empty, wait till a element is avaiable.
+    // If the queue is empty, wait till a element is avaiable, or the queue is closed.
     bool dequeue(T& result, bool wait)
     {
         std::unique_lock<std::mutex> lock(m);
         if(wait)
         {
-            while (q.empty())
+            while (q.empty() && !closed)
             {
                 // release lock as long as the wait and reaquire it afterwards.
                 c.wait(lock);
             }     
         }
-        else
+
+        if( q.empty() )
         {
-            if( q.empty() )
-            {
-                return false;
-            }
+            return false;
         }
 
-        result = q.front();
+        result = std::move(q.front());
         q.pop();
         return true;
     }
 
+    // wake up all waiters, remain elements can still be dequeued
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(m);
+        closed = true;
+        c.notify_all();
+    }
+
 private:
     std::queue<T> q;
     mutable std::mutex m;
     std::condition_variable c;
+    bool closed = false;
+};
+
+// per-worker deque for work stealing.
+// the owner pushes and pops at the back (lifo, cache warm), thieves steal from the front (fifo).
+template <class T>
+class tsdeque
+{
+public:
+    void push(T t)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        q.push_back(std::move(t));
+    }
+
+    bool pop(T& result)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        if( q.empty() )
+        {
+            return false;
+        }
+        result = std::move(q.back());
+        q.pop_back();
+        return true;
+    }
+
+    bool steal(T& result)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        if( q.empty() )
+        {
+            return false;
+        }
+        result = std::move(q.front());
+        q.pop_front();
+        return true;
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(m);
+        return q.size();
+    }
+
+    // move the elements matching pred out, the others keep their order
+    template <typename Pred>
+    void drain_if(Pred pred, std::vector<T>& result)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        std::deque<T> kept;
+        for (auto& t : q)
+        {
+            if (pred(t))
+            {
+                result.push_back(std::move(t));
+            }
+            else
+            {
+                kept.push_back(std::move(t));
+            }
+        }
+        q.swap(kept);
+    }
+
+private:
+    std::deque<T> q;
+    mutable std::mutex m;
+};
+
+// thread safe free list, objects are recycled instead of freed
+template <class T>
+class tspool
+{
+public:
+    T* acquire()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            if( !free.empty() )
+            {
+                T* t = free.back();
+                free.pop_back();
+                return t;
+            }
+        }
+        return new T();
+    }
+
+    void recycle(T* t)
+    {
+        std::lock_guard<std::mutex> lock(m);
+        free.push_back(t);
+    }
+
+    // never destroyed, tasks may still be recycled during static destruction
+    static tspool& Get()
+    {
+        static tspool* pool = new tspool();
+        return *pool;
+    }
+
+private:
+    std::vector<T*> free;
+    std::mutex m;
+};
+
+struct ResTask;
+class TaskCounter;
+
+// move only callable with inline storage, small captures never touch the heap
+class TaskFunction
+{
+public:
+    static constexpr size_t kInlineSize = 192;
+
+    TaskFunction() noexcept = default;
+    TaskFunction(std::nullptr_t) noexcept {}
+
+    template <typename F, typename = std::enable_if_t<!std::is_same_v<std::decay_t<F>, TaskFunction> && !std::is_same_v<std::decay_t<F>, std::nullptr_t>>>
+    TaskFunction(F&& func)
+    {
+        using Fn = std::decay_t<F>;
+        if constexpr (sizeof(Fn) <= kInlineSize && alignof(Fn) <= alignof(std::max_align_t) && std::is_nothrow_move_constructible_v<Fn>)
+        {
+            new (storage_) Fn(std::forward<F>(func));
+            ops_ = &InlineOps<Fn>;
+        }
+        else
+        {
+            *reinterpret_cast<Fn**>(storage_) = new Fn(std::forward<F>(func));
+            ops_ = &HeapOps<Fn>;
+        }
+    }
+
+    TaskFunction(TaskFunction&& other) noexcept
+    {
+        MoveFrom(other);
+    }
+
+    TaskFunction& operator=(TaskFunction&& other) noexcept
+    {
+        if (this != &other)
+        {
+            Reset();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    TaskFunction& operator=(std::nullptr_t) noexcept
+    {
+        Reset();
+        return *this;
+    }
+
+    TaskFunction(const TaskFunction&) = delete;
+    TaskFunction& operator=(const TaskFunction&) = delete;
+
+    ~TaskFunction()
+    {
+        Reset();
+    }
+
+    void operator()(ResTask& task)
+    {
+        ops_->invoke(storage_, task);
+    }
+
+    explicit operator bool() const noexcept { return ops_ != nullptr; }
+    bool operator==(std::nullptr_t) const noexcept { return ops_ == nullptr; }
+
+    void Reset() noexcept
+    {
+        if (ops_)
+        {
+            ops_->destroy(storage_);
+            ops_ = nullptr;
+        }
+    }
+
+private:
+    struct Ops
+    {
+        void (*invoke)(void* storage, ResTask& task);
+        void (*move)(void* dst, void* src) noexcept;
+        void (*destroy)(void* storage) noexcept;
+    };
+
+    template <typename Fn>
+    static constexpr Ops InlineOps = {
+        [](void* storage, ResTask& task) { (*static_cast<Fn*>(storage))(task); },
+        [](void* dst, void* src) noexcept { new (dst) Fn(std::move(*static_cast<Fn*>(src))); static_cast<Fn*>(src)->~Fn(); },
+        [](void* storage) noexcept { static_cast<Fn*>(storage)->~Fn(); },
+    };
+
+    template <typename Fn>
+    static constexpr Ops HeapOps = {
+        [](void* storage, ResTask& task) { (**static_cast<Fn**>(storage))(task); },
+        [](void* dst, void* src) noexcept { *static_cast<Fn**>(dst) = *static_cast<Fn**>(src); },
+        [](void* storage) noexcept { delete *static_cast<Fn**>(storage); },
+    };
+
+    void MoveFrom(TaskFunction& other) noexcept
+    {
+        if (other.ops_)
+        {
+            other.ops_->move(storage_, other.storage_);
+            ops_ = other.ops_;
+            other.ops_ = nullptr;
+        }
+    }
+
+    alignas(std::max_align_t) unsigned char storage_[kInlineSize];
+    const Ops* ops_ = nullptr;
 };
 
+// task context lives in a pooled block, only tasks that use a context allocate one
+struct TaskContextBlock
+{
+    static constexpr size_t kSize = 1024;
+    alignas(std::max_align_t) uint8_t data[kSize];
+};
+
+// pooled and never copied, queues only move the handle around
 struct ResTask
 {
-    typedef std::function<void (ResTask& task)> TaskFunc;
+    typedef TaskFunction TaskFunc;
     
     uint32_t task_id;
     uint8_t priority;
+    // run and dropped, see TaskCoordinator::AddDetachedTask
+    bool detached = false;
+    // the counter the task is attached to, only its owner can cancel the task
+    const TaskCounter* owner = nullptr;
     TaskFunc task_func;
     TaskFunc complete_func;
-    uint8_t task_context_1k[1024];
+
+    ResTask() = default;
+    ResTask(const ResTask&) = delete;
+    ResTask& operator=(const ResTask&) = delete;
+
+    ~ResTask()
+    {
+        Reset();
+    }
 
     template<typename T>
     void SetContext(T& context)
     {
-        std::memcpy( task_context_1k, &context, sizeof(T) );
+        static_assert(std::is_trivially_copyable_v<T> && sizeof(T) <= TaskContextBlock::kSize, "task context must be trivially copyable and fit in a context block");
+        std::memcpy( AcquireContext(), &context, sizeof(T) );
     }
     template<typename T>
     void GetContext(T& context)
     {
-        std::memcpy( &context, task_context_1k,  sizeof(T) );
+        static_assert(std::is_trivially_copyable_v<T> && sizeof(T) <= TaskContextBlock::kSize, "task context must be trivially copyable and fit in a context block");
+        if (context_)
+        {
+            std::memcpy( &context, context_->data, sizeof(T) );
+        }
+    }
+
+    // typed context constructed in place, read it with Context<T>() in complete_func
+    template<typename T, typename... Args>
+    T& EmplaceContext(Args&&... args)
+    {
+        static_assert(std::is_trivially_destructible_v<T> && sizeof(T) <= TaskContextBlock::kSize, "task context must be trivially destructible and fit in a context block");
+        return *new (AcquireContext()) T(std::forward<Args>(args)...);
     }
-    
+    template<typename T>
+    T& Context()
+    {
+        return *std::launder(reinterpret_cast<T*>(AcquireContext()));
+    }
+
+    void Reset()
+    {
+        detached = false;
+        owner = nullptr;
+        task_func = nullptr;
+        complete_func = nullptr;
+        if (context_)
+        {
+            tspool<TaskContextBlock>::Get().recycle(context_);
+            context_ = nullptr;
+        }
+    }
+
+private:
+    uint8_t* AcquireContext()
+    {
+        if (!context_)
+        {
+            context_ = tspool<TaskContextBlock>::Get().acquire();
+        }
+        return context_->data;
+    }
+
+    TaskContextBlock* context_ = nullptr;
 };
 
+struct ResTaskRecycler
+{
+    void operator()(ResTask* task) const
+    {
+        task->Reset();
+        tspool<ResTask>::Get().recycle(task);
+    }
+};
+
+typedef std::unique_ptr<ResTask, ResTaskRecycler> ResTaskPtr;
+
+inline ResTaskPtr AcquireResTask()
+{
+    return ResTaskPtr(tspool<ResTask>::Get().acquire());
+}
+
 class TaskCoordinator;
 
+// dedicated serial thread, tasks are executed in submit order
 class TaskThread
 {
 public:
@@ -237,21 +542,43 @@ public:
    
     ~TaskThread()
     {
-        complete_->wait();
-        terminate_->set();
-        thread_->detach();
-        //thread_->join();
+        // finish the remain tasks, then quit
+        taskQueue_.close();
+        thread_->join();
+    }
+
+    std::unique_ptr<std::thread> thread_;
+    tsqueue<ResTaskPtr> taskQueue_;
+};
+
+// worker of the parralled pool, owns a deque and steals from others when empty
+class TaskWorker
+{
+public:
+    TaskWorker(TaskCoordinator* coordinator, int32_t workerIdx);
+    ~TaskWorker();
+
+    std::unique_ptr<std::thread> thread_;
+    tsdeque<ResTaskPtr> taskDeque_;
+};
+
+// counts the unfinished tasks attached to it, like a bake pass or a scene load
+class TaskCounter
+{
+public:
+    int32_t Value() const
+    {
+        return count_.load();
     }
 
-    bool IsIdle()
+    bool IsZero() const
     {
-        return complete_->is_set();
+        return count_.load() <= 0;
     }
 
-    std::unique_ptr<event_signal> terminate_;
-    std::unique_ptr<event_signal> complete_;
-    std::unique_ptr<std::thread> thread_;
-    tsqueue<ResTask> taskQueue_;
+private:
+    friend class TaskCoordinator;
+    std::atomic<int32_t> count_ {0};
 };
 
 class TaskCoordinator
@@ -261,20 +588,19 @@ public:
     {
         for (int i = 0; i < 4; i++)
         {
-            threads_.push_back(std::make_unique<TaskThread>());
+            threads_.push_back(std::make_unique<TaskThread>(this));
         }
 
-        // Get the number of CPU cores (use half of available cores for low-priority threads)
+        // Get the number of CPU cores, the parralled pool use all of them
         unsigned int numCores = std::thread::hardware_concurrency();
-        unsigned int lowThreadCount = std::max(1u, numCores / 1);
+        unsigned int workerCount = std::max(1u, numCores / 1);
 
-        // Create low-priority threads based on CPU cores
-        for (unsigned int i = 0; i < lowThreadCount; i++)
+        for (unsigned int i = 0; i < workerCount; i++)
         {
-            lowThreads_.push_back(std::make_unique<TaskThread>());
+            workers_.push_back(std::make_unique<TaskWorker>(this, int32_t(i)));
         }
 
-        fmt::print("low parrallel thread count: {}\n", lowThreadCount);
+        fmt::print("low parrallel thread count: {}\n", workerCount);
     }
 
     ~TaskCoordinator()
@@ -284,54 +610,91 @@ public:
         {
             thread.reset();
         }
+
+        CancelParralledTasks(nullptr);
+        {
+            std::lock_guard<std::mutex> lock(workerMutex_);
+            shutdown_ = true;
+        }
+        workerSignal_.notify_all();
+        for (auto& worker : workers_)
+        {
+            worker.reset();
+        }
         puts("TaskCoordinator shut down.");
     }
 
-    void MarkTaskComplete(const ResTask& task)
+    void MarkTaskComplete(ResTaskPtr& task)
     {
-        completeTaskQueue_.enqueue(task);
+        completeTaskQueue_.enqueue(std::move(task));
     }
 
     void MarkTaskEnd(const ResTask& task)
     {
-        completedTaskIds_.insert(task.task_id);
+        std::lock_guard<std::mutex> lock(graphMutex_);
+        unendedTaskIds_.erase(task.task_id);
     }
     
+    // thread safe, can be called from any thread, including inside a running task
     uint32_t AddTask( ResTask::TaskFunc task_func, ResTask::TaskFunc complete_func, uint8_t priority = 0);
     uint32_t AddParralledTask( ResTask::TaskFunc task_func, ResTask::TaskFunc complete_func );
 
-    void WaitForTask(uint32_t task_id)
+    // the task starts right after all dependencies finished their task_func, without waiting for a main thread tick.
+    // complete_func still runs on main thread, in finish order.
+    uint32_t AddParralledTask( ResTask::TaskFunc task_func, ResTask::TaskFunc complete_func,
+        const std::vector<uint32_t>& dependencies, std::shared_ptr<TaskCounter> counter = nullptr );
+
+    // empty task finishes when all dependencies finished, chain other tasks after it
+    uint32_t AddFence( const std::vector<uint32_t>& dependencies, ResTask::TaskFunc complete_func = nullptr, std::shared_ptr<TaskCounter> counter = nullptr );
+
+    // no id, no graph and no complete_func, for the jobs of other schedulers that track completion themselves,
+    // like the physics job system. they go ahead of the normal parralled tasks and are never canceled.
+    // they also skip critical sections, so keep them short and never block in them: no sleeping, no waiting
+    // on gpu or on other tasks. only idle workers run them, HelpUntil waiters don't
+    void AddDetachedTask( ResTask::TaskFunc task_func );
+
+    // while a critical section is open idle workers only pick detached tasks, a frame critical step like
+    // physics is not starved by background bakes. tasks already running are not interrupted
+    void BeginCriticalSection();
+    void EndCriticalSection();
+
+    uint32_t GetWorkerCount() const
     {
-        // wait for specific task to complete, like sync load.
-        // if task_id not found, it has been down, return immediately.
+        return uint32_t(workers_.size());
     }
 
+    std::shared_ptr<TaskCounter> CreateCounter()
+    {
+        return std::make_shared<TaskCounter>();
+    }
+
+    // task_func of the task has finished, unknown task_id treated as finished
+    bool IsTaskFinished(uint32_t task_id);
+
+    // wait for specific task to finish, like sync load. the calling thread helps the pool meanwhile.
+    // if task_id not found, it has been done, return immediately.
+    void WaitForTask(uint32_t task_id);
+
+    // wait for all tasks attached to the counter to finish
+    void WaitForCounter(const std::shared_ptr<TaskCounter>& counter);
+
+    // block until all parralled tasks finished, the calling thread helps executing them.
+    // not allowed inside a parralled task, throws std::logic_error
     void WaitForAllParralledTask();
     
     bool IsAllParralledTaskComplete()
     {
-        for ( auto& thread : lowThreads_ )
-        {
-            if( !thread->IsIdle() )
-            {
-                return false;
-            }
-        }
-        return true;
+        return pendingParralledTasks_.load() <= 0;
     }
 
-    void CancelAllParralledTasks()
-    {
-        while(parralledTaskQueue_.size() > 0)
-        {
-            ResTask task;
-            parralledTaskQueue_.dequeue(task, true);
-        }
-    }
+    // drop the queued and parked tasks attached to the counter, they never run and their complete_func is skipped.
+    // running ones finish normally, WaitForCounter after it to be sure none is left.
+    // tasks without a counter are never canceled, their waiters would take them as done
+    void CancelTasks(const std::shared_ptr<TaskCounter>& counter);
 
     uint32_t GetParralledTaskCount()
     {
-        return uint32_t(parralledTaskQueue_.size());
+        return uint32_t(std::max(0, queuedParralledTasks_.load()));
     }
 
     uint32_t GetMainTaskCount();
@@ -341,6 +704,7 @@ public:
         return uint32_t(completeTaskQueue_.size());
     }
 
+    // complete_func of all tasks has been called on main thread
     bool IsAllTaskComplete(std::vector<uint32_t>& tasks);
 
     void Tick();
@@ -355,16 +719,69 @@ public:
     }
 
 private:
-    std::vector< std::unique_ptr<TaskThread> > threads_;
-    // low-level thread, use for parrallel task
-    std::vector< std::unique_ptr<TaskThread> > lowThreads_;
-    tsqueue<ResTask> mainthreadTaskQueue_;
-    tsqueue<ResTask> completeTaskQueue_;
-    tsqueue<ResTask> parralledTaskQueue_;
+    friend class TaskThread;
+    friend class TaskWorker;
+
+    // detached queue first if takeDetached, then pop from own deque, then steal from the others
+    bool AcquireParralledTask(int32_t workerIdx, ResTaskPtr& task, bool takeDetached);
+    void RunParralledTask(ResTaskPtr& task);
+    void WorkerLoop(int32_t workerIdx);
+    // helps the pool until pred is true
+    template <typename Pred>
+    void HelpUntil(Pred pred);
+
+    // register the task to the graph, return false if it has to wait for dependencies
+    bool RegisterTask(ResTaskPtr& task, const std::vector<uint32_t>& dependencies, std::shared_ptr<TaskCounter> counter);
+    // called after task_func, release the successors
+    void FinishTask(uint32_t task_id);
+    void EnqueueParralledTask(ResTaskPtr task);
+    // owner nullptr drops every task, only at shutdown
+    void CancelParralledTasks(const TaskCounter* owner);
+
+    struct FTaskGraphNode
+    {
+        std::vector<uint32_t> successors;
+        std::shared_ptr<TaskCounter> counter;
+    };
+
+    struct FParkedTask
+    {
+        ResTaskPtr task;
+        uint32_t remainDependencies;
+    };
 
-    std::unordered_set<uint32_t> completedTaskIds_;
+    std::vector< std::unique_ptr<TaskThread> > threads_;
+    // work stealing pool, use for parrallel task
+    std::vector< std::unique_ptr<TaskWorker> > workers_;
+    tsqueue<ResTaskPtr> mainthreadTaskQueue_;
+    tsqueue<ResTaskPtr> completeTaskQueue_;
+    // shared by all workers, polled before the own deque
+    tsqueue<ResTaskPtr> detachedTaskQueue_;
+
+    std::mutex workerMutex_;
+    std::condition_variable workerSignal_;
+    std::condition_variable finishSignal_;
+    std::atomic<int32_t> finishWaiters_ {0};
+    // submitted but not picked up yet
+    std::atomic<int32_t> queuedParralledTasks_ {0};
+    std::atomic<int32_t> queuedDetachedTasks_ {0};
+    std::atomic<int32_t> criticalSections_ {0};
+    // submitted but not finished yet
+    std::atomic<int32_t> pendingParralledTasks_ {0};
+    std::atomic<uint32_t> nextWorkerIdx_ {0};
+    std::atomic<uint32_t> nextTaskId_ {0};
+    bool shutdown_ = false;
+
+    // task graph, only holds tasks in flight so it won't grow in long sessions
+    std::mutex graphMutex_;
+    std::unordered_map<uint32_t, FTaskGraphNode> unfinishedTasks_;
+    std::unordered_map<uint32_t, FParkedTask> parkedTasks_;
+    std::unordered_set<uint32_t> unendedTaskIds_;
 private:
     static std::unique_ptr<TaskCoordinator> instance_;
+    // worker index of the calling thread, -1 if not a pool worker
+    static thread_local int32_t currentWorkerIdx_;
+    // parralled tasks executing on the calling thread, nested when helping inside a task
+    static thread_local int32_t runningParralledTasks_;
     static void TestCase();
 };
-
@@ -54,6 +54,7 @@ UserInterface::UserInterface(
 {
 	const auto& device = swapChain.Device();
 	const auto& window = device.Surface().Instance().Window();
+	headless_ = window.IsHeadless();
 
 	// Initialise descriptor pool and render pass for ImGui.
 	const std::vector<Vulkan::DescriptorBinding> descriptorBindings =
@@ -78,7 +79,7 @@ UserInterface::UserInterface(
 	
 	// Initialise ImGui GLFW adapter
 #if !ANDROID
-	if (!ImGui_ImplGlfw_InitForVulkan(window.Handle(), true))
+	if (!headless_ && !ImGui_ImplGlfw_InitForVulkan(window.Handle(), true))
 	{
 		Throw(std::runtime_error("failed to initialise ImGui GLFW adapter"));
 	}
@@ -93,7 +94,7 @@ UserInterface::UserInterface(
 	vulkanInit.Device = device.Handle();
 	vulkanInit.QueueFamily = device.GraphicsFamilyIndex();
 	vulkanInit.Queue = device.GraphicsQueue();
-	vulkanInit.PipelineCache = nullptr;
+	vulkanInit.PipelineCache = device.PipelineCacheHandle();
 	vulkanInit.DescriptorPool = descriptorPool_->Handle();
 	vulkanInit.MinImageCount = swapChain.MinImageCount();
 	vulkanInit.ImageCount = static_cast<uint32_t>(swapChain.Images().size());
@@ -178,7 +179,10 @@ UserInterface::~UserInterface()
 	
 	ImGui_ImplVulkan_Shutdown();
 #if !ANDROID
-	ImGui_ImplGlfw_Shutdown();
+	if (!headless_)
+	{
+		ImGui_ImplGlfw_Shutdown();
+	}
 #else
 	ImGui_ImplAndroid_Shutdown();
 #endif
@@ -194,6 +198,11 @@ void UserInterface::OnCreateSurface(const Vulkan::SwapChain& swapChain, const Vu
 	{
 		uiFrameBuffers_.emplace_back(swapChain.Extent(), *imageView, *renderPass_, false);
 	}
+
+	if (headless_)
+	{
+		ImGui::GetIO().DisplaySize = ImVec2(static_cast<float>(swapChain.Extent().width), static_cast<float>(swapChain.Extent().height));
+	}
 }
 
 void UserInterface::OnDestroySurface()
@@ -306,7 +315,10 @@ void UserInterface::PreRender()
 {
 	ImGui_ImplVulkan_NewFrame();
 #if !ANDROID
-	ImGui_ImplGlfw_NewFrame();
+	if (!headless_)
+	{
+		ImGui_ImplGlfw_NewFrame();
+	}
 #else
 	ImGui_ImplAndroid_NewFrame();
 #endif
@@ -420,15 +432,20 @@ void UserInterface::DrawOverlay(const Statistics& statistics, Vulkan::VulkanGpuT
 		uint32_t completeTasks = TaskCoordinator::GetInstance()->GetComleteTaskQueueCount();
 		ImGui::Text("Tasks: %d / %d / %d", mainTasks, lowTasks, completeTasks);
 
+		uint32_t bakedGroups, bakeGroups, bakeRegions;
+		NextEngine::GetInstance()->GetScene().GetCPUAccelerationStructure().GetBakeProgress(bakedGroups, bakeGroups, bakeRegions);
+		ImGui::Text("Probe Bake: %d / %d (%d regions, last %.1fms)", bakedGroups, bakeGroups, bakeRegions,
+			NextEngine::GetInstance()->GetScene().GetCPUAccelerationStructure().GetLastRegionBakeTime());
+
 		ImGui::Separator();
 		
 		ImGui::Text("frametime: %.2fms", statistics.FrameTime);
 		
-		// auto fetch timer & display
+		// auto fetch timer & display, avg (min - max) over the rolling window
 		auto times = gpuTimer->FetchAllTimes(4);
-		for(auto& time : times)
+		for(auto& [name, avg, min, max] : times)
 		{
-			ImGui::Text("%s: %.2fms", std::get<0>(time).c_str(), std::get<1>(time));
+			ImGui::Text("%s: %.2fms (%.2f - %.2f)", name.c_str(), avg, min, max);
 		}
 
 		ImGui::Text("drawframe: %.2fms", gpuTimer->GetCpuTime("draw-frame"));
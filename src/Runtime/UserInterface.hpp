@@ -102,4 +102,6 @@ private:
 	std::vector< std::function<void ()> > auxDrawRequest_;
 
 	NextEngine* engine_;
+	// no glfw window to feed imgui, the display size follows the offscreen ring
+	bool headless_{};
 };
\ No newline at end of file
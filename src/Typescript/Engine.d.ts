@@ -3,6 +3,8 @@ export class NextEngine {
     GetTestNumber(): number;
     RegisterJSCallback(callback: (param: number) => void): void;
     GetScenePtr(): Scene;
+    // rays packed as [ox, oy, oz, dx, dy, dz, ...], returns [t, instanceId, nx, ny, nz, ...], t < 0 on miss
+    RayCastBatch(rays: number[], maxDistance: number, rayMask: number, anyHit: boolean): number[];
 }
 
 export class NextComponent {
@@ -1,7 +1,122 @@
 #include "FileHelper.hpp"
 
+#include <thread>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 namespace Utilities
 {
+    namespace FileHelper
+    {
+#ifdef _WIN32
+        FMappedFile::FMappedFile(const std::string& filename)
+        {
+            HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file == INVALID_HANDLE_VALUE)
+            {
+                return;
+            }
+            file_ = file;
+
+            LARGE_INTEGER fileSize;
+            if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0)
+            {
+                return;
+            }
+
+            mapping_ = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping_ == nullptr)
+            {
+                return;
+            }
+
+            data_ = static_cast<const uint8_t*>(MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+            size_ = data_ != nullptr ? static_cast<size_t>(fileSize.QuadPart) : 0;
+        }
+
+        FMappedFile::~FMappedFile()
+        {
+            if (data_ != nullptr)
+            {
+                UnmapViewOfFile(data_);
+            }
+            if (mapping_ != nullptr)
+            {
+                CloseHandle(mapping_);
+            }
+            if (file_ != nullptr)
+            {
+                CloseHandle(file_);
+            }
+        }
+#else
+        FMappedFile::FMappedFile(const std::string& filename)
+        {
+            int fd = open(filename.c_str(), O_RDONLY);
+            if (fd < 0)
+            {
+                return;
+            }
+
+            struct stat fileStat;
+            if (fstat(fd, &fileStat) == 0 && fileStat.st_size > 0)
+            {
+                void* data = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+                if (data != MAP_FAILED)
+                {
+                    data_ = static_cast<const uint8_t*>(data);
+                    size_ = static_cast<size_t>(fileStat.st_size);
+                }
+            }
+            // the mapping keeps the file alive
+            close(fd);
+        }
+
+        FMappedFile::~FMappedFile()
+        {
+            if (data_ != nullptr)
+            {
+                munmap(const_cast<uint8_t*>(data_), size_);
+            }
+        }
+#endif
+
+        bool WriteFileAtomically(const std::string& filename, const std::function<bool(std::ostream&)>& write)
+        {
+            const std::string tempFileName = fmt::format("{}.{}.tmp", filename, std::hash<std::thread::id>{}(std::this_thread::get_id()));
+            bool failed;
+            {
+                std::ofstream file(tempFileName, std::ios::binary | std::ios::trunc);
+                failed = !file.is_open() || !write(file) || !file.flush();
+            }
+
+            std::error_code ec;
+            if (!failed)
+            {
+                std::filesystem::rename(tempFileName, filename, ec);
+                failed = bool(ec);
+            }
+            if (failed)
+            {
+                std::filesystem::remove(tempFileName, ec);
+            }
+            return !failed;
+        }
+    }
+
     namespace Package
     {
         FPackageFileSystem* FPackageFileSystem::instance_ = nullptr;
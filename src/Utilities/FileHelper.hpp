@@ -8,6 +8,8 @@
 #include "ThirdParty/lzav/lzav.h"
 #include <assert.h>
 #include <regex>
+#include <functional>
+#include <ostream>
 
 namespace Utilities
 {
@@ -55,6 +57,36 @@ namespace Utilities
         }
     }
 
+    namespace FileHelper
+    {
+        // read only view of a whole file, the os pages it in on demand instead of a stream read
+        class FMappedFile
+        {
+        public:
+            explicit FMappedFile(const std::string& filename);
+            ~FMappedFile();
+
+            FMappedFile(const FMappedFile&) = delete;
+            FMappedFile& operator=(const FMappedFile&) = delete;
+
+            bool IsValid() const { return data_ != nullptr; }
+            const uint8_t* Data() const { return data_; }
+            size_t Size() const { return size_; }
+
+        private:
+            const uint8_t* data_ = nullptr;
+            size_t size_ = 0;
+#ifdef _WIN32
+            void* file_ = nullptr;
+            void* mapping_ = nullptr;
+#endif
+        };
+
+        // write returns false on failure. the file is written under a per thread temp name and renamed in place,
+        // readers never see a half written file and threads writing the same file don't clash
+        bool WriteFileAtomically(const std::string& filename, const std::function<bool(std::ostream&)>& write);
+    }
+
     namespace NameHelper
     {
         static std::string RandomName(size_t length)
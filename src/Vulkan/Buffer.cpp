@@ -3,8 +3,9 @@
 
 namespace Vulkan {
 
-Buffer::Buffer(const class Device& device, const size_t size, const VkBufferUsageFlags usage) :
-	device_(device)
+Buffer::Buffer(const class Device& device, const size_t size, const VkBufferUsageFlags usage, bool external) :
+	device_(device),
+	external_(external)
 {
 	VkBufferCreateInfo bufferInfo = {};
 	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
@@ -12,6 +13,18 @@ Buffer::Buffer(const class Device& device, const size_t size, const VkBufferUsag
 	bufferInfo.usage = usage;
 	bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
 
+	VkExternalMemoryBufferCreateInfo externalMemoryBufferInfo{};
+	externalMemoryBufferInfo.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO;
+#if WIN32 && !defined(__MINGW32__)
+	externalMemoryBufferInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_WIN32_BIT;
+#else
+	externalMemoryBufferInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT;
+#endif
+	if (external_)
+	{
+		bufferInfo.pNext = &externalMemoryBufferInfo;
+	}
+
 	Check(vkCreateBuffer(device.Handle(), &bufferInfo, nullptr, &buffer_),
 		"create buffer");
 }
@@ -31,9 +44,14 @@ DeviceMemory Buffer::AllocateMemory(const VkMemoryPropertyFlags propertyFlags)
 }
 
 DeviceMemory Buffer::AllocateMemory(const VkMemoryAllocateFlags allocateFlags, const VkMemoryPropertyFlags propertyFlags)
+{
+	return AllocateMemory(allocateFlags, propertyFlags, external_);
+}
+
+DeviceMemory Buffer::AllocateMemory(const VkMemoryAllocateFlags allocateFlags, const VkMemoryPropertyFlags propertyFlags, bool external)
 {
 	const auto requirements = GetMemoryRequirements();
-	DeviceMemory memory(device_, requirements.size, requirements.memoryTypeBits, allocateFlags, propertyFlags);
+	DeviceMemory memory(device_, requirements.size, requirements.memoryTypeBits, allocateFlags, propertyFlags, external);
 
 	Check(vkBindBufferMemory(device_.Handle(), buffer_, memory.Handle(), 0),
 		"bind buffer memory");
@@ -15,13 +15,14 @@ namespace Vulkan
 
 		VULKAN_NON_COPIABLE(Buffer)
 
-		Buffer(const Device& device, size_t size, VkBufferUsageFlags usage);
+		Buffer(const Device& device, size_t size, VkBufferUsageFlags usage, bool external = false);
 		~Buffer();
 
 		const class Device& Device() const { return device_; }
 
 		DeviceMemory AllocateMemory(VkMemoryPropertyFlags propertyFlags);
 		DeviceMemory AllocateMemory(VkMemoryAllocateFlags allocateFlags, VkMemoryPropertyFlags propertyFlags);
+		DeviceMemory AllocateMemory(VkMemoryAllocateFlags allocateFlags, VkMemoryPropertyFlags propertyFlags, bool external);
 		VkMemoryRequirements GetMemoryRequirements() const;
 		VkDeviceAddress GetDeviceAddress() const;
 
@@ -31,6 +32,7 @@ namespace Vulkan
 	private:
 
 		const class Device& device_;
+		bool external_;
 
 		VULKAN_HANDLE(VkBuffer, buffer_)
 	};
@@ -1,5 +1,6 @@
 #include "DescriptorSetLayout.hpp"
 #include "Device.hpp"
+#include <xxhash.h>
 
 namespace Vulkan {
 
@@ -19,6 +20,8 @@ DescriptorSetLayout::DescriptorSetLayout(const Device& device, const std::vector
 		layoutBindings.push_back(b);
 	}
 
+	signature_ = XXH64(layoutBindings.data(), layoutBindings.size() * sizeof(VkDescriptorSetLayoutBinding), bindless ? 1 : 0);
+
 	VkDescriptorSetLayoutCreateInfo layoutInfo = {};
 	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
 	layoutInfo.bindingCount = static_cast<uint32_t>(layoutBindings.size());
@@ -16,9 +16,13 @@ namespace Vulkan
 		DescriptorSetLayout(const Device& device, const std::vector<DescriptorBinding>& descriptorBindings, bool bindless = false);
 		~DescriptorSetLayout();
 
+		// equal for identically defined layouts, pipelines built against one are compatible with the other
+		uint64_t Signature() const { return signature_; }
+
 	private:
 
 		const Device& device_;
+		uint64_t signature_{};
 
 		VULKAN_HANDLE(VkDescriptorSetLayout, layout_)
 	};
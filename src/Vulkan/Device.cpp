@@ -1,6 +1,7 @@
 #include "Device.hpp"
 #include "Enumerate.hpp"
 #include "Instance.hpp"
+#include "PipelineCache.hpp"
 #include "Surface.hpp"
 #include "Utilities/Exception.hpp"
 #include "Vulkan/RayTracing/DeviceProcedures.hpp"
@@ -76,7 +77,8 @@ Device::Device(
 	//const auto computeFamily = FindQueue(queueFamilies, "compute", VK_QUEUE_COMPUTE_BIT, VK_QUEUE_GRAPHICS_BIT);
 	
 	// Find the presentation queue (usually the same as graphics queue).
-	const auto presentFamily = std::find_if(queueFamilies.begin(), queueFamilies.end(), [&](const VkQueueFamilyProperties& queueFamily)
+	// without a surface nothing is presented, the graphics queue stands in
+	const auto presentFamily = surface.Handle() == nullptr ? graphicsFamily : std::find_if(queueFamilies.begin(), queueFamilies.end(), [&](const VkQueueFamilyProperties& queueFamily)
 	{
 		VkBool32 presentSupport = false;
 		const uint32_t i = static_cast<uint32_t>(&*queueFamilies.cbegin() - &queueFamily);
@@ -166,6 +168,11 @@ void Device::WaitIdle() const
 		"wait for device idle");
 }
 
+VkPipelineCache Device::PipelineCacheHandle() const
+{
+	return pipelineCache_ ? pipelineCache_->Handle() : nullptr;
+}
+
 void Device::CheckRequiredExtensions(VkPhysicalDevice physicalDevice, const std::vector<const char*>& requiredExtensions) const
 {
 	const auto availableExtensions = GetEnumerateVector(physicalDevice, static_cast<const char*>(nullptr), vkEnumerateDeviceExtensionProperties);
@@ -10,6 +10,7 @@ namespace Vulkan
 {
 	class Surface;
 	class DeviceProcedures;
+	class PipelineCache;
 
 	class Device final
 	{
@@ -47,6 +48,11 @@ namespace Vulkan
 
 		const DeviceProcedures& GetDeviceProcedures() const { return *deviceProcedures_; }
 
+		// owned by the renderer, every vkCreate*Pipelines goes through it
+		class PipelineCache& GetPipelineCache() const { return *pipelineCache_; }
+		VkPipelineCache PipelineCacheHandle() const;
+		void SetPipelineCache(class PipelineCache* pipelineCache) { pipelineCache_ = pipelineCache; }
+
 	private:
 
 		void CheckRequiredExtensions(VkPhysicalDevice physicalDevice, const std::vector<const char*>& requiredExtensions) const;
@@ -70,6 +76,7 @@ namespace Vulkan
 				
 		std::unique_ptr<DeviceProcedures> deviceProcedures_;
 		VkPhysicalDeviceProperties deviceProp_;
+		class PipelineCache* pipelineCache_{};
 	};
 
 }
@@ -1,6 +1,7 @@
 #include "DeviceMemory.hpp"
 #include "Device.hpp"
 #include "Utilities/Exception.hpp"
+#include "Vulkan/RayTracing/DeviceProcedures.hpp"
 
 #ifdef VK_USE_PLATFORM_WIN32_KHR
 #	include <aclapi.h>
@@ -157,6 +158,25 @@ void DeviceMemory::Unmap()
 	vkUnmapMemory(device_.Handle(), memory_);
 }
 
+ExtHandle DeviceMemory::GetExternalHandle() const
+{
+	ExtHandle handle{};
+#if WIN32 && !defined(__MINGW32__)
+	VkMemoryGetWin32HandleInfoKHR handleInfo = { VK_STRUCTURE_TYPE_MEMORY_GET_WIN32_HANDLE_INFO_KHR };
+	handleInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_WIN32_BIT;
+	handleInfo.memory = memory_;
+	Check(device_.GetDeviceProcedures().vkGetMemoryWin32HandleKHR(device_.Handle(), &handleInfo, &handle),
+		"get memory win32 handle");
+#elif !ANDROID
+	VkMemoryGetFdInfoKHR handleInfo = { VK_STRUCTURE_TYPE_MEMORY_GET_FD_INFO_KHR };
+	handleInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_OPAQUE_FD_BIT;
+	handleInfo.memory = memory_;
+	Check(device_.GetDeviceProcedures().vkGetMemoryFdKHR(device_.Handle(), &handleInfo, &handle),
+		"get memory fd");
+#endif
+	return handle;
+}
+
 uint32_t DeviceMemory::FindMemoryType(const uint32_t typeFilter, const VkMemoryPropertyFlags propertyFlags) const
 {
 	VkPhysicalDeviceMemoryProperties memProperties;
@@ -2,6 +2,12 @@
 
 #include "Vulkan.hpp"
 
+#if WIN32 && !defined(__MINGW32__)
+#define ExtHandle HANDLE
+#else
+#define ExtHandle int
+#endif
+
 namespace Vulkan
 {
 	class Device;
@@ -23,6 +29,9 @@ namespace Vulkan
 		void* Map(size_t offset, size_t size);
 		void Unmap();
 
+		// exported handle of memory allocated with external, an fd is owned by whoever imports it
+		ExtHandle GetExternalHandle() const;
+
 	private:
 
 		uint32_t FindMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) const;
@@ -0,0 +1,212 @@
+#include "PipelineCache.hpp"
+#include "Device.hpp"
+#include "PipelineLayout.hpp"
+#include "ShaderModule.hpp"
+#include "Runtime/TaskCoordinator.hpp"
+#include "Utilities/FileHelper.hpp"
+#include <chrono>
+#include <cstddef>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+#include <fmt/format.h>
+#include <xxhash.h>
+
+namespace Vulkan {
+
+namespace
+{
+	constexpr uint32_t PIPELINE_CACHE_MAGIC = 0x43505047; // "GPPC"
+	constexpr uint32_t PIPELINE_CACHE_VERSION = 1;
+
+	// written in front of the driver blob, the blob itself is opaque
+	struct FPipelineCacheHeader
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint32_t vendorID;
+		uint32_t deviceID;
+		uint32_t driverVersion;
+		uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+		uint64_t dataSize;
+		uint64_t dataHash;
+	};
+
+	FPipelineCacheHeader MakeHeader(const VkPhysicalDeviceProperties& prop)
+	{
+		FPipelineCacheHeader header{};
+		header.magic = PIPELINE_CACHE_MAGIC;
+		header.version = PIPELINE_CACHE_VERSION;
+		header.vendorID = prop.vendorID;
+		header.deviceID = prop.deviceID;
+		header.driverVersion = prop.driverVersion;
+		std::memcpy(header.pipelineCacheUUID, prop.pipelineCacheUUID, VK_UUID_SIZE);
+		return header;
+	}
+
+	bool IsCompatible(const FPipelineCacheHeader& a, const FPipelineCacheHeader& b)
+	{
+		return a.magic == b.magic && a.version == b.version &&
+			a.vendorID == b.vendorID && a.deviceID == b.deviceID && a.driverVersion == b.driverVersion &&
+			std::memcmp(a.pipelineCacheUUID, b.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+	}
+}
+
+PipelineCache::PipelineCache(const class Device& device) :
+	device_(device),
+	compileCounter_(std::make_shared<TaskCounter>())
+{
+	const auto startTime = std::chrono::high_resolution_clock::now();
+	const VkPhysicalDeviceProperties prop = device.DeviceProperties();
+	const FPipelineCacheHeader expected = MakeHeader(prop);
+
+	// a driver update gets a new file instead of overwriting the old one, so switching back stays warm
+	const uint64_t key = XXH64(&expected, offsetof(FPipelineCacheHeader, dataSize), 0);
+	fileName_ = Utilities::CookHelper::GetCookedFileName(fmt::format("{:016x}", key), "pipeline");
+
+	std::vector<uint8_t> blob;
+	std::ifstream file(fileName_, std::ios::binary);
+	if (file.is_open())
+	{
+		FPipelineCacheHeader header{};
+		file.read(reinterpret_cast<char*>(&header), sizeof(header));
+		if (file && IsCompatible(header, expected) && header.dataSize > 0)
+		{
+			blob.resize(header.dataSize);
+			file.read(reinterpret_cast<char*>(blob.data()), blob.size());
+			if (!file || XXH64(blob.data(), blob.size(), 0) != header.dataHash)
+			{
+				blob.clear();
+			}
+		}
+	}
+
+	VkPipelineCacheCreateInfo createInfo = {};
+	createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	createInfo.initialDataSize = blob.size();
+	createInfo.pInitialData = blob.empty() ? nullptr : blob.data();
+
+	Check(vkCreatePipelineCache(device.Handle(), &createInfo, nullptr, &pipelineCache_),
+		"create pipeline cache");
+
+	warm_ = !blob.empty();
+	loadedSize_ = blob.size();
+
+	const double elapsed = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - startTime).count();
+	fmt::print("- pipeline cache {} ({} KB) in {:.2f}ms\n", warm_ ? "warm" : "cold", loadedSize_ / 1024, elapsed);
+}
+
+PipelineCache::~PipelineCache()
+{
+	WaitForCompiles();
+	for (auto& [key, pipeline] : pipelines_)
+	{
+		if (pipeline->pipeline_ != nullptr)
+		{
+			vkDestroyPipeline(device_.Handle(), pipeline->pipeline_, nullptr);
+		}
+		vkDestroyPipelineLayout(device_.Handle(), pipeline->layout_, nullptr);
+	}
+	pipelines_.clear();
+
+	if (pipelineCache_ != nullptr)
+	{
+		vkDestroyPipelineCache(device_.Handle(), pipelineCache_, nullptr);
+		pipelineCache_ = nullptr;
+	}
+}
+
+void PipelineCache::Save() const
+{
+	size_t dataSize = 0;
+	if (vkGetPipelineCacheData(device_.Handle(), pipelineCache_, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0)
+	{
+		return;
+	}
+
+	std::vector<uint8_t> blob(dataSize);
+	if (vkGetPipelineCacheData(device_.Handle(), pipelineCache_, &dataSize, blob.data()) != VK_SUCCESS)
+	{
+		return;
+	}
+	blob.resize(dataSize);
+
+	FPipelineCacheHeader header = MakeHeader(device_.DeviceProperties());
+	header.dataSize = blob.size();
+	header.dataHash = XXH64(blob.data(), blob.size(), 0);
+
+	// a crash halfway leaves the previous cache intact
+	Utilities::FileHelper::WriteFileAtomically(fileName_, [&](std::ostream& file)
+	{
+		file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+		file.write(reinterpret_cast<const char*>(blob.data()), blob.size());
+		return bool(file);
+	});
+}
+
+std::shared_ptr<const AsyncPipeline> PipelineCache::RequestComputePipeline(const std::string& shaderPath, const PipelineLayout& layout)
+{
+	const uint64_t keys[2] = { XXH64(shaderPath.data(), shaderPath.size(), 0), layout.Signature() };
+	const uint64_t key = XXH64(keys, sizeof(keys), 0);
+
+	std::shared_ptr<AsyncPipeline> pipeline;
+	{
+		std::lock_guard<std::mutex> lock(pipelinesMutex_);
+		auto& entry = pipelines_[key];
+		if (entry)
+		{
+			return entry;
+		}
+		entry = std::make_shared<AsyncPipeline>();
+		pipeline = entry;
+	}
+
+	// set layouts are only read during this call, the requester may destroy its own ones on the next resize
+	VkPipelineLayoutCreateInfo layoutInfo = {};
+	layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	layoutInfo.setLayoutCount = static_cast<uint32_t>(layout.SetLayouts().size());
+	layoutInfo.pSetLayouts = layout.SetLayouts().data();
+	layoutInfo.pushConstantRangeCount = static_cast<uint32_t>(layout.PushConstantRanges().size());
+	layoutInfo.pPushConstantRanges = layout.PushConstantRanges().data();
+
+	Check(vkCreatePipelineLayout(device_.Handle(), &layoutInfo, nullptr, &pipeline->layout_),
+		"create pipeline layout");
+
+	// an ordinary parralled task, a compile takes milliseconds and has no business in the detached fast lane
+	TaskCoordinator::GetInstance()->AddParralledTask([this, pipeline, shaderPath](ResTask&)
+	{
+		try
+		{
+			const ShaderModule shader(device_, shaderPath);
+
+			VkComputePipelineCreateInfo pipelineCreateInfo = {};
+			pipelineCreateInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+			pipelineCreateInfo.stage = shader.CreateShaderStage(VK_SHADER_STAGE_COMPUTE_BIT);
+			pipelineCreateInfo.layout = pipeline->layout_;
+
+			Check(vkCreateComputePipelines(device_.Handle(), pipelineCache_, 1, &pipelineCreateInfo, nullptr, &pipeline->pipeline_),
+				"create compute pipeline");
+			pipeline->ready_.store(true, std::memory_order_release);
+		}
+		catch (const std::exception& exception)
+		{
+			// the passes using it stay skipped
+			fmt::print(stderr, "failed to compile {}: {}\n", shaderPath, exception.what());
+		}
+	}, nullptr, {}, compileCounter_);
+
+	return pipeline;
+}
+
+uint32_t PipelineCache::PendingCompiles() const
+{
+	return static_cast<uint32_t>(compileCounter_->Value());
+}
+
+void PipelineCache::WaitForCompiles() const
+{
+	TaskCoordinator::GetInstance()->WaitForCounter(compileCounter_);
+}
+
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "Vulkan.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class TaskCounter;
+
+// a compute pipeline object that compiles in the background, passes check IsReady() and skip meanwhile
+#define VULKAN_ASYNC_PIPELINE(name) \
+public: \
+	VkPipeline Handle() const { return name->Handle(); } \
+	bool IsReady() const { return name->IsReady(); } \
+private: \
+	std::shared_ptr<const Vulkan::AsyncPipeline> name;
+
+namespace Vulkan
+{
+	class Device;
+	class PipelineLayout;
+
+	// compute pipeline compiled on a worker, shared by every pipeline object built from the same shader and layout.
+	// it owns a layout identical to the requester's, so it outlives the swap chain objects and is reused on recreation
+	class AsyncPipeline final
+	{
+	public:
+
+		VULKAN_NON_COPIABLE(AsyncPipeline)
+
+		AsyncPipeline() = default;
+
+		bool IsReady() const { return ready_.load(std::memory_order_acquire); }
+		// null until compiled
+		VkPipeline Handle() const { return IsReady() ? pipeline_ : nullptr; }
+
+	private:
+
+		friend class PipelineCache;
+
+		VkPipeline pipeline_{};
+		VkPipelineLayout layout_{};
+		std::atomic<bool> ready_{};
+	};
+
+	// driver pipeline cache shared by every pipeline of a device, persisted in the cooked directory
+	// the file is keyed by pipelineCacheUUID and driverVersion, a blob from another driver is never handed to vulkan
+	class PipelineCache final
+	{
+	public:
+
+		VULKAN_NON_COPIABLE(PipelineCache)
+
+		explicit PipelineCache(const Device& device);
+		~PipelineCache();
+
+		const class Device& Device() const { return device_; }
+
+		// write the current cache content back, done on shutdown
+		void Save() const;
+
+		// a valid blob was loaded from disk
+		bool IsWarm() const { return warm_; }
+		size_t LoadedSize() const { return loadedSize_; }
+
+		// never blocks, the first request of a shader and layout signature starts a compile on a worker,
+		// later ones (swap chain recreation, renderer switch) get the same pipeline back
+		std::shared_ptr<const AsyncPipeline> RequestComputePipeline(const std::string& shaderPath, const PipelineLayout& layout);
+
+		uint32_t PendingCompiles() const;
+		// only used before the first frame and on shutdown, helps the pool with the compiles meanwhile
+		void WaitForCompiles() const;
+
+	private:
+
+		const class Device& device_;
+		std::string fileName_;
+		bool warm_{};
+		size_t loadedSize_{};
+
+		std::mutex pipelinesMutex_;
+		std::unordered_map<uint64_t, std::shared_ptr<AsyncPipeline>> pipelines_;
+		std::shared_ptr<TaskCounter> compileCounter_;
+
+		VULKAN_HANDLE(VkPipelineCache, pipelineCache_)
+	};
+
+}
@@ -2,16 +2,30 @@
 #include "DescriptorSetLayout.hpp"
 #include "Device.hpp"
 #include "Assets/Texture.hpp"
+#include <xxhash.h>
 
 namespace Vulkan {
+
+namespace
+{
+	uint64_t HashLayout(const std::vector<uint64_t>& setSignatures, const std::vector<VkPushConstantRange>& pushConstantRanges)
+	{
+		const uint64_t seed = XXH64(setSignatures.data(), setSignatures.size() * sizeof(uint64_t), 0);
+		return XXH64(pushConstantRanges.data(), pushConstantRanges.size() * sizeof(VkPushConstantRange), seed);
+	}
+}
 	
 PipelineLayout::PipelineLayout(const Device& device, const std::vector<DescriptorSetManager*> managers, uint32_t maxSets, const VkPushConstantRange* pushConstantRanges,
 	uint32_t pushConstantRangeCount) : device_(device)
 {
+	std::vector<uint64_t> setSignatures;
 	for ( DescriptorSetManager* manager : managers )
 	{
 		cachedDescriptorSetLayouts_.push_back(manager->DescriptorSetLayout().Handle());
+		setSignatures.push_back(manager->DescriptorSetLayout().Signature());
 	}
+	pushConstantRanges_.assign(pushConstantRanges, pushConstantRanges + pushConstantRangeCount);
+	signature_ = HashLayout(setSignatures, pushConstantRanges_);
 
 	cachedDescriptorSets_.resize(maxSets);
 	for( uint32_t i = 0; i < maxSets; ++i )
@@ -38,6 +52,9 @@ PipelineLayout::PipelineLayout(const Device & device, const DescriptorSetLayout&
 	// add the global texture set with set = 1, currently an ugly impl
 	Assets::GlobalTexturePool* GPool = Assets::GlobalTexturePool::GetInstance();
 	cachedDescriptorSetLayouts_ = { descriptorSetLayout.Handle(), GPool->Layout() };
+	// the global layout lives as long as the device, its handle identifies it
+	pushConstantRanges_.assign(pushConstantRanges, pushConstantRanges + pushConstantRangeCount);
+	signature_ = HashLayout({ descriptorSetLayout.Signature(), reinterpret_cast<uint64_t>(GPool->Layout()) }, pushConstantRanges_);
 
 	VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
 	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
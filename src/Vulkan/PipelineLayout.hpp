@@ -20,9 +20,16 @@ namespace Vulkan
 		~PipelineLayout();
 
 		void BindDescriptorSets(VkCommandBuffer commandBuffer, uint32_t idx) const;
+
+		const std::vector<VkDescriptorSetLayout>& SetLayouts() const { return cachedDescriptorSetLayouts_; }
+		const std::vector<VkPushConstantRange>& PushConstantRanges() const { return pushConstantRanges_; }
+		// set layout signatures and push constants, equal for compatible layouts
+		uint64_t Signature() const { return signature_; }
 	private:
 
 		const Device& device_;
+		std::vector<VkPushConstantRange> pushConstantRanges_;
+		uint64_t signature_{};
 
 		VULKAN_HANDLE(VkPipelineLayout, pipelineLayout_)
 
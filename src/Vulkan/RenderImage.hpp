@@ -6,11 +6,6 @@
 #include "DeviceMemory.hpp"
 #include "Sampler.hpp"
 
-#if WIN32 && !defined(__MINGW32__)
-#define ExtHandle HANDLE
-#else
-#define ExtHandle int
-#endif
 namespace Vulkan
 {
 	class ImageView;
@@ -8,6 +8,11 @@ Surface::Surface(const class Instance& instance) :
 	instance_(instance)
 {
 #if !ANDROID
+	// headless: no surface, the device presents nothing and the swap chain becomes an offscreen ring
+	if (instance.Window().IsHeadless())
+	{
+		return;
+	}
 	Check(glfwCreateWindowSurface(instance.Handle(), instance.Window().Handle(), nullptr, &surface_),
 		"create window surface");
 #else
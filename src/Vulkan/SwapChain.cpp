@@ -1,6 +1,9 @@
 #include "SwapChain.hpp"
+#include "Buffer.hpp"
 #include "Device.hpp"
+#include "DeviceMemory.hpp"
 #include "Enumerate.hpp"
+#include "Image.hpp"
 #include "ImageView.hpp"
 #include "Instance.hpp"
 #include "Surface.hpp"
@@ -21,6 +24,12 @@ SwapChain::SwapChain(const class Device& device, const VkPresentModeKHR presentM
 	physicalDevice_(device.PhysicalDevice()),
 	device_(device)
 {
+	if (device.Surface().Handle() == nullptr)
+	{
+		CreateOffscreenRing(device.Surface().Instance().Window());
+		return;
+	}
+
 	const auto details = QuerySwapChainSupport(device.PhysicalDevice(), device.Surface().Handle());
 	if (details.Formats.empty() || details.PresentModes.empty())
 	{
@@ -101,6 +110,10 @@ SwapChain::SwapChain(const class Device& device, const VkPresentModeKHR presentM
 SwapChain::~SwapChain()
 {
 	imageViews_.clear();
+	offscreenImages_.clear();
+	offscreenMemories_.clear();
+	readbackBuffers_.clear();
+	readbackMemories_.clear();
 
 	if (swapChain_ != nullptr)
 	{
@@ -269,6 +282,58 @@ uint32_t SwapChain::ChooseImageCount(const VkSurfaceCapabilitiesKHR& capabilitie
 	return imageCount;
 }
 
+void SwapChain::CreateOffscreenRing(const Window& window)
+{
+	// b8g8r8a8 like the sdr swap chain, the screenshot code reads the pixels in that order
+	minImageCount_ = 2;
+	presentMode_ = VK_PRESENT_MODE_IMMEDIATE_KHR;
+	format_ = VK_FORMAT_B8G8R8A8_UNORM;
+	extent_ = window.FramebufferSize();
+	renderExtent_ = extent_;
+	renderOffset_ = {0,0};
+	hdr_ = false;
+
+	const auto& debugUtils = device_.DebugUtils();
+	const VkDeviceSize readbackSize = static_cast<VkDeviceSize>(extent_.width) * extent_.height * 4;
+
+	for (uint32_t i = 0; i != OFFSCREEN_IMAGE_COUNT; ++i)
+	{
+		offscreenImages_.emplace_back(new Image(device_, extent_, 1, format_, VK_IMAGE_TILING_OPTIMAL,
+			VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_STORAGE_BIT));
+		offscreenMemories_.emplace_back(new DeviceMemory(offscreenImages_.back()->AllocateMemory(VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT)));
+		images_.push_back(offscreenImages_.back()->Handle());
+		imageViews_.push_back(std::make_unique<ImageView>(device_, images_.back(), format_, VK_IMAGE_ASPECT_COLOR_BIT));
+
+		readbackBuffers_.emplace_back(new Buffer(device_, readbackSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT));
+		readbackMemories_.emplace_back(new DeviceMemory(readbackBuffers_.back()->AllocateMemory(VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)));
+		readbackData_.push_back(static_cast<uint8_t*>(readbackMemories_.back()->Map(0, readbackSize)));
+
+		debugUtils.SetObjectName(images_[i], ("Offscreen Image #" + std::to_string(i)).c_str());
+		debugUtils.SetObjectName(imageViews_[i]->Handle(), ("Offscreen ImageView #" + std::to_string(i)).c_str());
+	}
+}
+
+void SwapChain::RecordReadback(VkCommandBuffer commandBuffer, uint32_t imageIndex) const
+{
+	ImageMemoryBarrier::FullInsert(commandBuffer, images_[imageIndex], VK_ACCESS_MEMORY_WRITE_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+		VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL);
+
+	VkBufferImageCopy region{};
+	region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+	region.imageExtent = {extent_.width, extent_.height, 1};
+	vkCmdCopyImageToBuffer(commandBuffer, images_[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, readbackBuffers_[imageIndex]->Handle(), 1, &region);
+
+	ImageMemoryBarrier::FullInsert(commandBuffer, images_[imageIndex], VK_ACCESS_TRANSFER_READ_BIT, 0,
+		VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+
+	// make the copy visible to the host once the fence is waited on
+	VkMemoryBarrier hostBarrier{};
+	hostBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
+}
+
 void SwapChain::InsertBarrierToWrite(VkCommandBuffer commandBuffer, uint32_t imageIndex) const
 {
 	ImageMemoryBarrier::FullInsert(commandBuffer, Images()[imageIndex], 0,
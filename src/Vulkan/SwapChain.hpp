@@ -6,7 +6,10 @@
 
 namespace Vulkan
 {
+	class Buffer;
 	class Device;
+	class DeviceMemory;
+	class Image;
 	class ImageView;
 	class Window;
 
@@ -34,6 +37,13 @@ namespace Vulkan
 		VkPresentModeKHR PresentMode() const { return presentMode_; }
 		bool IsHDR() const { return hdr_;}
 
+		// headless: no VkSwapchainKHR, the images are an offscreen ring with one image per frame in flight.
+		// they rest in PRESENT_SRC like swap chain images, so every pass and the screenshot path stay the same
+		bool IsHeadless() const { return swapChain_ == nullptr; }
+		// headless: copy the image into its host visible slot, the pixels are valid once the frame's fence signaled
+		void RecordReadback(VkCommandBuffer commandBuffer, uint32_t imageIndex) const;
+		const uint8_t* ReadbackData(uint32_t imageIndex) const { return readbackData_[imageIndex]; }
+
 		void UpdateRenderViewport( int32_t x, int32_t y, uint32_t width, uint32_t height) const;
 		void UpdateOutputViewport( int32_t x, int32_t y, uint32_t width, uint32_t height) const;
 		
@@ -54,6 +64,9 @@ namespace Vulkan
 		static VkPresentModeKHR ChooseSwapPresentMode(const std::vector<VkPresentModeKHR>& presentModes, VkPresentModeKHR presentMode);
 		static VkExtent2D ChooseSwapExtent(const Window& window, const VkSurfaceCapabilitiesKHR& capabilities);
 		static uint32_t ChooseImageCount(const VkSurfaceCapabilitiesKHR& capabilities);
+		void CreateOffscreenRing(const Window& window);
+
+		static constexpr uint32_t OFFSCREEN_IMAGE_COUNT = 3;
 
 		const VkPhysicalDevice physicalDevice_;
 		const class Device& device_;
@@ -73,6 +86,12 @@ namespace Vulkan
 		std::vector<VkImage> images_;
 		std::vector<std::unique_ptr<ImageView>> imageViews_;
 		bool hdr_{};
+
+		std::vector<std::unique_ptr<Image>> offscreenImages_;
+		std::vector<std::unique_ptr<DeviceMemory>> offscreenMemories_;
+		std::vector<std::unique_ptr<Buffer>> readbackBuffers_;
+		std::vector<std::unique_ptr<DeviceMemory>> readbackMemories_;
+		std::vector<uint8_t*> readbackData_;
 	};
 
 }
@@ -2,186 +2,365 @@
 
 #include "Options.hpp"
 #include <vector>
-#include <list>
+#include <deque>
+#include <string>
+#include <tuple>
 #include <memory>
+#include <mutex>
 #include <unordered_map>
 #include <cassert>
 #include <chrono>
+#include <algorithm>
 #include "Device.hpp"
 
+// name -> handle resolved once per call site, the lambda gives every expansion its own static
+#define GPU_TIMER_HANDLE(name) []{ static const uint32_t handle = Vulkan::VulkanGpuTimer::RegisterTimer(name); return handle; }()
 #define SCOPED_GPU_TIMER_FOLDER(name, folder) ScopedGpuTimer scopedGpuTimer(commandBuffer, GpuTimer(), name, folder)
-#define SCOPED_GPU_TIMER(name) ScopedGpuTimer scopedGpuTimer(commandBuffer, GpuTimer(), name)
-#define SCOPED_CPU_TIMER(name) ScopedCpuTimer scopedCpuTimer(GpuTimer(), name)
+#define SCOPED_GPU_TIMER(name) ScopedGpuTimer scopedGpuTimer(commandBuffer, GpuTimer(), GPU_TIMER_HANDLE(name))
+#define SCOPED_CPU_TIMER(name) ScopedCpuTimer scopedCpuTimer(GpuTimer(), GPU_TIMER_HANDLE(name))
 #define BENCH_MARK_CHECK() if(!GOption->HardwareQuery) return
 
-namespace Vulkan 
+namespace Vulkan
 {
+	// rolling statistics of one timer, gpu and cpu timers share the same table
+	struct FTimerStats
+	{
+		static constexpr uint32_t WINDOW = 64;
+
+		float last{};
+		float min{};
+		float avg{};
+		float max{};
+		// frame index of the last sample
+		uint64_t frame{};
+
+		void AddSample(float ms, uint64_t frameIdx)
+		{
+			samples_[cursor_] = ms;
+			cursor_ = (cursor_ + 1) % WINDOW;
+			count_ = std::min(count_ + 1, WINDOW);
+
+			last = ms;
+			min = max = ms;
+			float sum = 0;
+			for (uint32_t i = 0; i < count_; ++i)
+			{
+				min = std::min(min, samples_[i]);
+				max = std::max(max, samples_[i]);
+				sum += samples_[i];
+			}
+			avg = sum / count_;
+			frame = frameIdx;
+		}
+
+	private:
+		float samples_[WINDOW]{};
+		uint32_t cursor_{};
+		uint32_t count_{};
+	};
+
+	// timestamps are written into a ring of query pools and read back without waiting.
+	// a slot is only read after the renderer reported the fence of its frame, before that the
+	// reset recorded in its command buffer may not have run and the pool still holds the old results
 	class VulkanGpuTimer
 	{
 	public:
 		DEFAULT_NON_COPIABLE(VulkanGpuTimer)
-		
-		VulkanGpuTimer(const Device& device, uint32_t totalCount, const VkPhysicalDeviceProperties& prop);
+
+		static constexpr uint32_t RING_SIZE = 3;
+		static constexpr uint32_t INVALID_HANDLE = ~0u;
+
+		VulkanGpuTimer(const Device& device, uint32_t queriesPerFrame, const VkPhysicalDeviceProperties& prop);
 		virtual ~VulkanGpuTimer();
 
-		void Reset(VkCommandBuffer commandBuffer)
+		// handles are global and stable, so call sites can cache them across timer instances
+		static uint32_t RegisterTimer(const std::string& name)
 		{
-			BENCH_MARK_CHECK();
-			vkCmdResetQueryPool(commandBuffer, query_pool_timestamps, 0, static_cast<uint32_t>(time_stamps.size()));
-			queryIdx = 0;
-			started_ = true;
-			
-			CalculatieGpuStats();
-			for(auto& [name, query] : gpu_timer_query_map)
+			std::lock_guard<std::mutex> lock(registryMutex_);
+			auto it = handleMap_.find(name);
+			if (it != handleMap_.end())
 			{
-				std::get<1>(gpu_timer_query_map[name]) = 0;
-				std::get<0>(gpu_timer_query_map[name]) = 0;
+				return it->second;
 			}
+			uint32_t handle = static_cast<uint32_t>(names_.size());
+			names_.push_back(name);
+			handleMap_.emplace(name, handle);
+			return handle;
 		}
 
-		void CpuFrameEnd()
+		// handle of "folder + name", only nested timers inside a folder timer go through here
+		static uint32_t RegisterPrefixed(uint32_t folder, uint32_t handle)
 		{
-			// iterate the cpu_timer_query_map
-			for(auto& [name, query] : cpu_timer_query_map)
+			const uint64_t key = (uint64_t(folder) << 32) | handle;
 			{
-				std::get<2>(cpu_timer_query_map[name]) = std::get<1>(cpu_timer_query_map[name]) - std::get<0>(cpu_timer_query_map[name]);
+				std::lock_guard<std::mutex> lock(registryMutex_);
+				auto it = prefixedMap_.find(key);
+				if (it != prefixedMap_.end())
+				{
+					return it->second;
+				}
 			}
+			uint32_t prefixed = RegisterTimer(GetName(folder) + GetName(handle));
+			std::lock_guard<std::mutex> lock(registryMutex_);
+			prefixedMap_.emplace(key, prefixed);
+			return prefixed;
+		}
+
+		static const std::string& GetName(uint32_t handle)
+		{
+			std::lock_guard<std::mutex> lock(registryMutex_);
+			return names_[handle];
+		}
+
+		// begin a new frame on the next slot of the ring, whatever was left unread there is dropped
+		void Reset(VkCommandBuffer commandBuffer)
+		{
+			BENCH_MARK_CHECK();
+			frameIdx_++;
+			FSlot& slot = slots_[frameIdx_ % RING_SIZE];
+			vkCmdResetQueryPool(commandBuffer, slot.pool, 0, queriesPerFrame_);
+			slot.frame = frameIdx_;
+			slot.queryCount = 0;
+			slot.records.clear();
+			slot.pending = true;
+			openRecords_.clear();
+			recording_ = &slot;
+		}
+
+		// the command buffer recorded since Reset has been submitted
+		void FrameSubmitted()
+		{
+			BENCH_MARK_CHECK();
+			submittedFrame_ = frameIdx_;
 		}
 
-		void FrameEnd(VkCommandBuffer commandBuffer)
+		// the fence of the last submitted frame has signaled, its slot and the older ones can be read
+		void FrameFenced()
 		{
 			BENCH_MARK_CHECK();
-			if(started_)
+			completedFrame_ = submittedFrame_;
+		}
+
+		// read back every fenced slot, oldest first, never blocks
+		void FrameEnd()
+		{
+			BENCH_MARK_CHECK();
+			recording_ = nullptr;
+			for (uint64_t frame = frameIdx_ + 1 - RING_SIZE; frame <= frameIdx_; ++frame)
 			{
-				started_ = false;
+				FSlot& slot = slots_[frame % RING_SIZE];
+				if (!slot.pending || slot.frame != frame)
+				{
+					continue;
+				}
+				if (frame > completedFrame_ || !ResolveSlot(slot))
+				{
+					break;
+				}
 			}
-			else
+		}
+
+		void Start(VkCommandBuffer commandBuffer, uint32_t handle)
+		{
+			BENCH_MARK_CHECK();
+			device_.DebugUtils().BeginMarker(commandBuffer, MarkerName(handle));
+			if (recording_ == nullptr || recording_->queryCount + 2 > queriesPerFrame_)
 			{
+				openRecords_.push_back(INVALID_HANDLE);
 				return;
 			}
-			vkGetQueryPoolResults(
-				device_.Handle(),
-				query_pool_timestamps,
-				0,
-				queryIdx,
-				time_stamps.size() * sizeof(uint64_t),
-				time_stamps.data(),
-				sizeof(uint64_t),
-				VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
-
-			for(auto& [name, query] : gpu_timer_query_map)
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, recording_->pool, recording_->queryCount);
+			openRecords_.push_back(static_cast<uint32_t>(recording_->records.size()));
+			recording_->records.push_back({handle, recording_->queryCount, 0, static_cast<uint32_t>(openRecords_.size() - 1)});
+			recording_->queryCount++;
+		}
+		void End(VkCommandBuffer commandBuffer, uint32_t handle)
+		{
+			BENCH_MARK_CHECK();
+			assert( !openRecords_.empty() );
+			device_.DebugUtils().EndMarker(commandBuffer);
+			const uint32_t record = openRecords_.back();
+			openRecords_.pop_back();
+			if (recording_ == nullptr || record == INVALID_HANDLE)
 			{
-				std::get<2>(gpu_timer_query_map[name]) = (time_stamps[ std::get<1>(gpu_timer_query_map[name]) ] - time_stamps[ std::get<0>(gpu_timer_query_map[name])]);
+				return;
 			}
+			assert( recording_->records[record].handle == handle );
+			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, recording_->pool, recording_->queryCount);
+			recording_->records[record].endQuery = recording_->queryCount;
+			recording_->queryCount++;
 		}
-
-		void Start(VkCommandBuffer commandBuffer, const char* name)
+		void StartCpuTimer(uint32_t handle)
 		{
-			BENCH_MARK_CHECK();
-			if( gpu_timer_query_map.find(name) == gpu_timer_query_map.end())
+			if (handle >= cpuStarts_.size())
 			{
-				gpu_timer_query_map[name] = std::make_tuple(0, 0, 0);
+				cpuStarts_.resize(handle + 1);
 			}
-			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, query_pool_timestamps, queryIdx);
-			device_.DebugUtils().BeginMarker(commandBuffer, name);
-			std::get<0>(gpu_timer_query_map[name]) = queryIdx;
-			queryIdx++;
+			cpuStarts_[handle] = std::chrono::high_resolution_clock::now();
 		}
-		void End(VkCommandBuffer commandBuffer, const char* name)
+		void EndCpuTimer(uint32_t handle)
 		{
-			BENCH_MARK_CHECK();
-			assert( gpu_timer_query_map.find(name) != gpu_timer_query_map.end() );
-			vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, query_pool_timestamps, queryIdx);
-			device_.DebugUtils().EndMarker(commandBuffer);
-			std::get<1>(gpu_timer_query_map[name]) = queryIdx;
-			queryIdx++;
+			assert( handle < cpuStarts_.size() );
+			const auto elapsed = std::chrono::high_resolution_clock::now() - cpuStarts_[handle];
+			Stats(handle).AddSample(std::chrono::duration<float, std::milli>(elapsed).count(), frameIdx_);
+		}
+
+		const FTimerStats* GetStats(const char* name) const
+		{
+			uint32_t handle = FindHandle(name);
+			return handle < stats_.size() ? &stats_[handle] : nullptr;
 		}
-		void StartCpuTimer(const char* name)
+		// last sample in ms, kept for the overlay
+		float GetGpuTime(const char* name) const
 		{
-			if( cpu_timer_query_map.find(name) == cpu_timer_query_map.end())
+			const FTimerStats* stats = GetStats(name);
+			return stats ? stats->last : 0;
+		}
+		float GetCpuTime(const char* name) const
+		{
+			const FTimerStats* stats = GetStats(name);
+			return stats ? stats->last : 0;
+		}
+
+		// gpu timers of the latest resolved frame in recording order: prefixed name, avg, min, max
+		std::vector<std::tuple<std::string, float, float, float> > FetchAllTimes( int maxStack )
+		{
+			std::vector<std::tuple<std::string, float, float, float> > result;
+			for(auto& [handle, stackDepth] : lastStats)
 			{
-				cpu_timer_query_map[name] = std::make_tuple(0, 0, 0);
+				std::string prefix = "";
+			    for (int i = 0; i < stackDepth; i++) {
+			    	prefix += (i == stackDepth - 1) ? " - " : "   ";
+			    }
+				if (maxStack > stackDepth)
+				{
+					const FTimerStats& stats = stats_[handle];
+					result.push_back(std::make_tuple(prefix + GetName(handle), stats.avg, stats.min, stats.max));
+				}
 			}
-			std::get<0>(cpu_timer_query_map[name]) = std::chrono::high_resolution_clock::now().time_since_epoch().count();
+			return result;
 		}
-		void EndCpuTimer(const char* name)
+
+	private:
+		static constexpr uint64_t UNSEEN = ~0ull;
+
+		struct FRecord
 		{
-			assert( cpu_timer_query_map.find(name) != cpu_timer_query_map.end() );
-			std::get<1>(cpu_timer_query_map[name]) = std::chrono::high_resolution_clock::now().time_since_epoch().count();
+			uint32_t handle;
+			uint32_t startQuery;
+			uint32_t endQuery;
+			uint32_t depth;
+		};
+
+		struct FSlot
+		{
+			VkQueryPool pool = VK_NULL_HANDLE;
+			uint64_t frame{};
+			uint32_t queryCount{};
+			std::vector<FRecord> records;
+			bool pending{};
+		};
+
+		static uint32_t FindHandle(const char* name)
+		{
+			std::lock_guard<std::mutex> lock(registryMutex_);
+			auto it = handleMap_.find(name);
+			return it != handleMap_.end() ? it->second : INVALID_HANDLE;
 		}
-		float GetGpuTime(const char* name)
+
+		// names never move once registered, the registry lock is taken once per handle
+		const char* MarkerName(uint32_t handle)
 		{
-			if(gpu_timer_query_map.find(name) == gpu_timer_query_map.end())
+			if (handle >= markerNames_.size())
+			{
+				markerNames_.resize(handle + 1, nullptr);
+			}
+			if (markerNames_[handle] == nullptr)
 			{
-				return 0;
+				markerNames_[handle] = GetName(handle).c_str();
 			}
-			return std::get<2>(gpu_timer_query_map[name]) * timeStampPeriod_ * 1e-6f;
+			return markerNames_[handle];
 		}
-		float GetCpuTime(const char* name)
+
+		FTimerStats& Stats(uint32_t handle)
 		{
-			if(cpu_timer_query_map.find(name) == cpu_timer_query_map.end())
+			if (handle >= stats_.size())
 			{
-				return 0;
+				stats_.resize(handle + 1);
 			}
-			return std::get<2>(cpu_timer_query_map[name]) * 1e-6f;
+			return stats_[handle];
 		}
 
-		void CalculatieGpuStats()
+		// false if the gpu has not finished the slot yet
+		bool ResolveSlot(FSlot& slot)
 		{
-			lastStats.clear();
-			std::list<std::tuple<std::string, float, uint64_t, uint64_t> > order_list;
-			for(auto& [name, query] : gpu_timer_query_map)
+			if (slot.queryCount > 0)
 			{
-				if ( std::get<2>(gpu_timer_query_map[name]) == 0)
+				VkResult result = vkGetQueryPoolResults(
+					device_.Handle(),
+					slot.pool,
+					0,
+					slot.queryCount,
+					slot.queryCount * sizeof(uint64_t),
+					timeStamps_.data(),
+					sizeof(uint64_t),
+					VK_QUERY_RESULT_64_BIT);
+				if (result == VK_NOT_READY)
 				{
-					continue;
+					return false;
 				}
-				order_list.insert(order_list.begin(), (std::make_tuple(name, GetGpuTime(name.c_str()), std::get<0>(query), std::get<1>(query))));
+				Check(result, "get timestamp query results");
 			}
-			
-			order_list.sort([](const std::tuple<std::string, float, uint64_t, uint64_t>& a, const std::tuple<std::string, float, uint64_t, uint64_t>& b) -> bool
-			{
-				return std::get<2>(a) < std::get<2>(b);
-			});
-			
-			std::vector<std::tuple<std::string, float, uint64_t, uint64_t>> activeTimers;
-			for(auto& [name, time, startIdx, endIdx] : order_list)
+			slot.pending = false;
+
+			// a timer hit several times in one frame reports the sum
+			frameTicks_.assign(stats_.size(), UNSEEN);
+			lastStats.clear();
+			for (const FRecord& record : slot.records)
 			{
-				while (!activeTimers.empty() && std::get<3>(activeTimers.back()) < startIdx) {
-					activeTimers.pop_back();
+				if (record.endQuery == 0)
+				{
+					continue;
 				}
-				
-				int stackDepth = static_cast<int>(activeTimers.size());
-				activeTimers.push_back(std::make_tuple(name, time, startIdx, endIdx));
-				lastStats.push_back(std::make_tuple(name, stackDepth, time));
-			}
-		}
-		std::vector<std::tuple<std::string, float> > FetchAllTimes( int maxStack )
-		{
-			std::vector<std::tuple<std::string, float> > result;
-			for(auto& [name, stackDepth, time] : lastStats)
-			{
-				std::string prefix = "";
-			    for (size_t i = 0; i < stackDepth; i++) {
-			    	prefix += (i == stackDepth - 1) ? " - " : "   ";
-			    }
-				if (maxStack > stackDepth)
+				if (record.handle >= frameTicks_.size())
 				{
-					result.push_back(std::make_tuple(prefix + name, time));
+					Stats(record.handle);
+					frameTicks_.resize(stats_.size(), UNSEEN);
 				}
+				if (frameTicks_[record.handle] == UNSEEN)
+				{
+					frameTicks_[record.handle] = 0;
+					lastStats.push_back(std::make_tuple(record.handle, static_cast<int>(record.depth)));
+				}
+				frameTicks_[record.handle] += timeStamps_[record.endQuery] - timeStamps_[record.startQuery];
 			}
-			return result;
+			for (auto& [handle, depth] : lastStats)
+			{
+				stats_[handle].AddSample(frameTicks_[handle] * timeStampPeriod_ * 1e-6f, slot.frame);
+			}
+			return true;
 		}
 
-		std::vector<std::tuple<std::string, int, float> > lastStats; // name, depth, duration seconds
-		VkQueryPool query_pool_timestamps = VK_NULL_HANDLE;
-		std::vector<uint64_t> time_stamps{};
-		std::unordered_map<std::string, std::tuple<uint64_t, uint64_t, uint64_t> > gpu_timer_query_map{};
-		std::unordered_map<std::string, std::tuple<uint64_t, uint64_t, uint64_t> > cpu_timer_query_map{};
+		inline static std::mutex registryMutex_;
+		inline static std::deque<std::string> names_;
+		inline static std::unordered_map<std::string, uint32_t> handleMap_;
+		inline static std::unordered_map<uint64_t, uint32_t> prefixedMap_;
+
 		const Device& device_;
-		uint32_t queryIdx = 0;
+		FSlot slots_[RING_SIZE];
+		FSlot* recording_ = nullptr;
+		std::vector<uint32_t> openRecords_;
+		std::vector<const char*> markerNames_;
+		std::vector<uint64_t> timeStamps_;
+		std::vector<uint64_t> frameTicks_;
+		std::vector<std::chrono::high_resolution_clock::time_point> cpuStarts_;
+		std::vector<FTimerStats> stats_;
+		std::vector<std::tuple<uint32_t, int> > lastStats; // handle, depth
+		uint32_t queriesPerFrame_ = 0;
+		uint64_t frameIdx_ = RING_SIZE;
+		uint64_t submittedFrame_ = 0;
+		uint64_t completedFrame_ = 0;
 		float timeStampPeriod_ = 1;
-		bool started_ = false;
 	};
 
 	class ScopedGpuTimer
@@ -189,72 +368,56 @@ namespace Vulkan
 	public:
 		DEFAULT_NON_COPIABLE(ScopedGpuTimer)
 
-		ScopedGpuTimer(VkCommandBuffer commandBuffer, VulkanGpuTimer* timer, const char* name, const char* foldername ):commandBuffer_(commandBuffer),timer_(timer), name_(name)
+		ScopedGpuTimer(VkCommandBuffer commandBuffer, VulkanGpuTimer* timer, const char* name, const char* foldername ):commandBuffer_(commandBuffer),timer_(timer)
 		{
-			timer_->Start(commandBuffer_, name_.c_str());
+			handle_ = VulkanGpuTimer::RegisterTimer(name);
+			timer_->Start(commandBuffer_, handle_);
 			folderTimer = true;
-			PushFolder(foldername);
+			PushFolder(VulkanGpuTimer::RegisterTimer(foldername));
 		}
-		ScopedGpuTimer(VkCommandBuffer commandBuffer, VulkanGpuTimer* timer, const char* name ):commandBuffer_(commandBuffer),timer_(timer), name_(name)
+		ScopedGpuTimer(VkCommandBuffer commandBuffer, VulkanGpuTimer* timer, uint32_t handle ):commandBuffer_(commandBuffer),timer_(timer)
 		{
-			timer_->Start(commandBuffer_, (folderName_ + name_).c_str());
+			handle_ = folder_ == VulkanGpuTimer::INVALID_HANDLE ? handle : VulkanGpuTimer::RegisterPrefixed(folder_, handle);
+			timer_->Start(commandBuffer_, handle_);
 		}
 		virtual ~ScopedGpuTimer()
 		{
 			if (folderTimer)
 			{
 				PopFolder();
-				timer_->End(commandBuffer_, name_.c_str());
-			}
-			else
-			{
-				timer_->End(commandBuffer_, (folderName_ + name_).c_str());
 			}
+			timer_->End(commandBuffer_, handle_);
 		}
 		VkCommandBuffer commandBuffer_;
 		VulkanGpuTimer* timer_;
-		std::string name_;
+		uint32_t handle_;
 		bool folderTimer = false;
 
-		static std::string folderName_;
-		static void PushFolder(const std::string& name)
+		inline static uint32_t folder_ = VulkanGpuTimer::INVALID_HANDLE;
+		static void PushFolder(uint32_t folder)
 		{
-			folderName_ = name;
+			folder_ = folder;
 		}
 		static void PopFolder()
 		{
-			folderName_ = "";
+			folder_ = VulkanGpuTimer::INVALID_HANDLE;
 		}
 	};
 
-	inline std::string ScopedGpuTimer::folderName_;
-
 	class ScopedCpuTimer
 	{
 	public:
 		DEFAULT_NON_COPIABLE(ScopedCpuTimer)
-		
-		ScopedCpuTimer(VulkanGpuTimer* timer, const char* name ):timer_(timer), name_(name)
+
+		ScopedCpuTimer(VulkanGpuTimer* timer, uint32_t handle ):timer_(timer), handle_(handle)
 		{
-			timer_->StartCpuTimer((folderName_ + name_).c_str());
+			timer_->StartCpuTimer(handle_);
 		}
 		virtual ~ScopedCpuTimer()
 		{
-			timer_->EndCpuTimer( (folderName_ + name_).c_str());
+			timer_->EndCpuTimer(handle_);
 		}
 		VulkanGpuTimer* timer_;
-		std::string name_;
-
-		static std::string folderName_;
-		static void PushFolder(const std::string& name)
-		{
-			folderName_ = name;
-		}
-		static void PopFolder(const std::string& name)
-		{
-			folderName_ = "";
-		}
+		uint32_t handle_;
 	};
-
-	inline std::string ScopedCpuTimer::folderName_;
 }
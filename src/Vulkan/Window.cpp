@@ -96,6 +96,12 @@ Window::Window(const WindowConfig& config) :
 	config_(config)
 {
 #if !ANDROID
+	// headless runs never touch glfw, sizes come from the config
+	if (config.Headless)
+	{
+		return;
+	}
+
 	if ( !glfwJoystickIsGamepad(0) ) {
 		std::ifstream file(Utilities::FileHelper::GetNormalizedFilePath("assets/locale/gamecontrollerdb.txt"));
 		if(file.is_open())
@@ -207,8 +213,12 @@ Window::~Window()
 float Window::ContentScale() const
 {
 #if !ANDROID
-	float xscale;
-	float yscale;
+	float xscale = 1;
+	float yscale = 1;
+	if (window_ == nullptr)
+	{
+		return xscale;
+	}
 	glfwGetWindowContentScale(window_, &xscale, &yscale);
 #else
 	float xscale = 1;
@@ -219,6 +229,10 @@ float Window::ContentScale() const
 VkExtent2D Window::FramebufferSize() const
 {
 #if !ANDROID
+	if (window_ == nullptr)
+	{
+		return VkExtent2D{ config_.Width, config_.Height };
+	}
 	int width, height;
 	glfwGetFramebufferSize(window_, &width, &height);
 	return VkExtent2D{ static_cast<uint32_t>(width), static_cast<uint32_t>(height) };
@@ -231,6 +245,10 @@ VkExtent2D Window::FramebufferSize() const
 VkExtent2D Window::WindowSize() const
 {
 #if !ANDROID
+	if (window_ == nullptr)
+	{
+		return VkExtent2D{ config_.Width, config_.Height };
+	}
 	int width, height;
 	glfwGetWindowSize(window_, &width, &height);
 	return VkExtent2D{ static_cast<uint32_t>(width), static_cast<uint32_t>(height) };
@@ -242,6 +260,10 @@ VkExtent2D Window::WindowSize() const
 const char* Window::GetKeyName(const int key, const int scancode) const
 {
 #if !ANDROID
+	if (window_ == nullptr)
+	{
+		return "";
+	}
 	return glfwGetKeyName(key, scancode);
 #else
 	return "A";
@@ -251,6 +273,11 @@ const char* Window::GetKeyName(const int key, const int scancode) const
 std::vector<const char*> Window::GetRequiredInstanceExtensions() const
 {
 #if !ANDROID
+	// VK_KHR_swapchain stays enabled on the device for the present layouts, it only depends on VK_KHR_surface
+	if (IsHeadless())
+	{
+		return std::vector<const char*>{ VK_KHR_SURFACE_EXTENSION_NAME };
+	}
 	uint32_t glfwExtensionCount = 0;
 	const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 	return std::vector<const char*>(glfwExtensions, glfwExtensions + glfwExtensionCount);
@@ -262,6 +289,10 @@ std::vector<const char*> Window::GetRequiredInstanceExtensions() const
 double Window::GetTime() const
 {
 #if !ANDROID
+	if (IsHeadless())
+	{
+		return std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime_).count();
+	}
 	return glfwGetTime();
 #else
 	return now_ms() / 1000.0;
@@ -271,10 +302,28 @@ double Window::GetTime() const
 void Window::Close()
 {
 #if !ANDROID
+	if (window_ == nullptr)
+	{
+		closeRequested_ = true;
+		return;
+	}
 	glfwSetWindowShouldClose(window_, 1);
 #endif
 }
 
+bool Window::ShouldClose() const
+{
+#if !ANDROID
+	if (window_ == nullptr)
+	{
+		return closeRequested_;
+	}
+	return glfwWindowShouldClose(window_) != 0;
+#else
+	return false;
+#endif
+}
+
 bool Window::IsMinimized() const
 {
 	const auto size = FramebufferSize();
@@ -284,7 +333,7 @@ bool Window::IsMinimized() const
 bool Window::IsMaximumed() const
 {
 #if !ANDROID
-	return glfwGetWindowAttrib(window_, GLFW_MAXIMIZED);
+	return window_ != nullptr && glfwGetWindowAttrib(window_, GLFW_MAXIMIZED);
 #endif
 	return false;
 }
@@ -292,6 +341,10 @@ bool Window::IsMaximumed() const
 void Window::WaitForEvents() const
 {
 #if !ANDROID
+	if (window_ == nullptr)
+	{
+		return;
+	}
 	glfwWaitEvents();
 #endif
 }
@@ -299,12 +352,20 @@ void Window::WaitForEvents() const
 void Window::Show() const
 {
 #if !ANDROID
+	if (window_ == nullptr)
+	{
+		return;
+	}
 	glfwShowWindow(window_);
 #endif
 }
 
 void Window::Minimize() {
 #if !ANDROID
+	if (window_ == nullptr)
+	{
+		return;
+	}
 	//glfwSetWindowSize(window_, 0,0);
 	glfwIconifyWindow(window_);
 #endif
@@ -312,6 +373,10 @@ void Window::Minimize() {
 
 void Window::Maximum() {
 #if !ANDROID
+	if (window_ == nullptr)
+	{
+		return;
+	}
 	glfwMaximizeWindow(window_);
 #endif
 }
@@ -319,6 +384,10 @@ void Window::Maximum() {
 void Window::Restore()
 {
 #if !ANDROID
+	if (window_ == nullptr)
+	{
+		return;
+	}
 	glfwRestoreWindow(window_);
 #endif
 }
@@ -327,6 +396,10 @@ constexpr double CLOSE_AREA_WIDTH = 0;
 constexpr double TITLE_AREA_HEIGHT = 55;	
 void Window::attemptDragWindow() {
 #if !ANDROID
+	if (window_ == nullptr)
+	{
+		return;
+	}
 	if (glfwGetMouseButton(window_, 0) == GLFW_PRESS && dragState == 0) {
 		glfwGetCursorPos(window_, &s_xpos, &s_ypos);
 		glfwGetWindowSize(window_, &w_xsiz, &w_ysiz);
@@ -358,6 +431,10 @@ void Window::attemptDragWindow() {
 void Window::PollGamepadInput()
 {
 #if !ANDROID
+	if (window_ == nullptr)
+	{
+		return;
+	}
 	// 检查手柄是否连接并可用(GLFW支持最多16个手柄，GLFW_JOYSTICK_1到GLFW_JOYSTICK_16)
 	for (int jid = GLFW_JOYSTICK_1; jid <= GLFW_JOYSTICK_LAST; jid++)
 	{
@@ -395,6 +472,11 @@ void Window::PollGamepadInput()
 void Window::InitGLFW()
 {
 #if !ANDROID
+	// a headless run may have no display to connect to
+	if (GOption->Headless)
+	{
+		return;
+	}
 	glfwSetErrorCallback(GlfwErrorCallback);
 	if (!glfwInit())
 	{
@@ -411,6 +493,10 @@ void Window::InitGLFW()
 void Window::TerminateGLFW()
 {
 #if !ANDROID
+	if (GOption->Headless)
+	{
+		return;
+	}
 	glfwTerminate();
 	glfwSetErrorCallback(nullptr);
 #endif
@@ -2,6 +2,7 @@
 
 #include "WindowConfig.hpp"
 #include "Vulkan.hpp"
+#include <chrono>
 #include <functional>
 #include <vector>
 
@@ -19,6 +20,7 @@ namespace Vulkan
 
 		// Window instance properties.
 		const WindowConfig& Config() const { return config_; }
+		bool IsHeadless() const { return config_.Headless; }
 
 		GLFWwindow* Handle() const { return window_; }
 
@@ -50,6 +52,7 @@ namespace Vulkan
 		
 		// Methods
 		void Close();
+		bool ShouldClose() const;
 		bool IsMinimized() const;
 		bool IsMaximumed() const;
 		void WaitForEvents() const;
@@ -69,6 +72,10 @@ namespace Vulkan
 		const WindowConfig config_;
 		GLFWwindow* window_{};
 
+		// headless: no glfw at all, time and close requests are tracked here
+		std::chrono::steady_clock::time_point startTime_{std::chrono::steady_clock::now()};
+		bool closeRequested_{};
+
 		double s_xpos = 0, s_ypos = 0;
 		int w_xsiz = 0, w_ysiz = 0;
 		int dragState = 0;
@@ -17,5 +17,7 @@ namespace Vulkan
 		void* AndroidNativeWindow;
 		bool ForceSDR;
 		bool HideTitleBar {};
+		// no glfw window at all, the renderer draws into an offscreen image ring
+		bool Headless {};
 	};
 }